@@ -1,8 +1,10 @@
 #include <mapbox/shelf-pack.hpp>
+#include <mapbox/stream-pack.hpp>
 
 #include <iostream>
 #include <stdlib.h>
 #include <stdexcept>
+#include <string>
 #include <ctime>
 
 using namespace mapbox;
@@ -138,10 +140,49 @@ void benchPack4() {
     std::cout << "duration: " << duration << std::endl;
 }
 
+void benchPackSorted(const char* name, std::vector<Bin>& bins, ShelfPack::SortStrategy sort) {
+    std::cout << "ShelfPack batch pack() " << name << std::endl;
+    ShelfPack sprite(dim, dim);
+    ShelfPack::PackOptions options;
+    options.sort = sort;
+
+    std::clock_t start = std::clock();
+    sprite.pack(bins, options);
+    double duration = (std::clock() - start) / (double) CLOCKS_PER_SEC;
+    std::cout << "duration: " << duration << ", height: " << sprite.height() << std::endl;
+}
+
+void benchPackSorted(const char* dataset, std::vector<Bin>& bins) {
+    std::string prefix = std::string(dataset) + ", ";
+    benchPackSorted((prefix + "unsorted").c_str(), bins, ShelfPack::SortStrategy::None);
+    benchPackSorted((prefix + "height desc").c_str(), bins, ShelfPack::SortStrategy::HeightDesc);
+    benchPackSorted((prefix + "area desc").c_str(), bins, ShelfPack::SortStrategy::AreaDesc);
+    benchPackSorted((prefix + "max side desc").c_str(), bins, ShelfPack::SortStrategy::MaxSideDesc);
+}
+
+void benchStream() {
+    std::cout << "StreamPack packOne() random height and width bins, generated on the fly" << std::endl;
+    std::size_t pages = 0;
+    StreamPack::StreamPackOptions options;
+    options.onPage = [&pages](int32_t) { pages++; };
+    StreamPack stream(1024, 1024, options);
+    int32_t packed = 0;
+
+    std::clock_t start = std::clock();
+    for (int32_t j = 0; j < N; j++) {
+        packed += stream.packOne(-1, randSize(), randSize()).page != -1;
+    }
+    stream.finish();
+    if (packed != N) throw std::runtime_error("out of space");
+
+    double duration = (std::clock() - start) / (double) CLOCKS_PER_SEC;
+    std::cout << "duration: " << duration << ", pages: " << pages << std::endl;
+}
+
 
 int main() {
     std::cout << std::endl << "generateData()" << std::endl << std::string(70, '-') << std::endl;
-    srand (time(NULL));
+    srand(20161222);
     generateData();
 
     std::cout << std::endl << "pack()" << std::endl << std::string(70, '-') << std::endl;
@@ -150,11 +191,18 @@ int main() {
     benchPack3();
     benchPack4();
 
+    std::cout << std::endl << "pack() sort strategies" << std::endl << std::string(70, '-') << std::endl;
+    benchPackSorted("random height bins", randHeight);
+    benchPackSorted("random height and width bins", randBoth);
+
     std::cout << std::endl << "packOne()" << std::endl << std::string(70, '-') << std::endl;
     benchPackOne1();
     benchPackOne2();
     benchPackOne3();
     benchPackOne4();
 
+    std::cout << std::endl << "StreamPack" << std::endl << std::string(70, '-') << std::endl;
+    benchStream();
+
     return 0;
 }
@@ -0,0 +1,323 @@
+#include <mapbox/shelf-pack.hpp>
+#include <mapbox/skyline-pack.hpp>
+#include <mapbox/maxrects-pack.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace mapbox;
+
+
+/*
+ * Benchmarks for ShelfPack, built on Google Benchmark.
+ * Every dataset is generated from a fixed seed, so runs are comparable between commits.
+ *
+ * @example
+ * make benchmark
+ * make runbenchmark   # 5 repetitions, aggregates written to benchmark.json
+ */
+
+const uint32_t seed = 20161222;
+const int32_t dim = 1000000;
+
+
+enum Dataset {
+    FixedBoth,     // 12x12
+    RandWidth,     // w in {12, 16, 20, 24}, h = 12
+    RandHeight,    // w = 12, h in {12, 16, 20, 24}
+    RandBoth,      // w, h in {12, 16, 20, 24}
+    Glyphs         // glyph-like sizes, a mix of font sizes with 3px padding
+};
+
+const char* const datasetNames[] = { "fixedBoth", "randWidth", "randHeight", "randBoth", "glyphs" };
+
+std::vector<Bin> generate(Dataset dataset, std::size_t count) {
+    const int32_t sizes[4] = { 12, 16, 20, 24 };
+    const int32_t fontSizes[5] = { 12, 14, 16, 18, 24 };
+
+    std::mt19937 rng(seed + uint32_t(dataset));
+    std::uniform_int_distribution<int32_t> size(0, 3);
+    std::uniform_int_distribution<int32_t> font(0, 4);
+    std::normal_distribution<double> aspect(0.6, 0.15);   // glyph width / font size
+    std::normal_distribution<double> extent(0.75, 0.1);   // glyph height / font size
+
+    std::vector<Bin> bins;
+    bins.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        int32_t w = 12, h = 12;
+        switch (dataset) {
+            case FixedBoth:  break;
+            case RandWidth:  w = sizes[size(rng)]; break;
+            case RandHeight: h = sizes[size(rng)]; break;
+            case RandBoth:   w = sizes[size(rng)]; h = sizes[size(rng)]; break;
+            case Glyphs: {
+                double fontSize = fontSizes[font(rng)];
+                w = std::max(1, int32_t(std::lround(fontSize * std::max(0.1, aspect(rng))))) + 6;
+                h = std::max(1, int32_t(std::lround(fontSize * std::max(0.1, extent(rng))))) + 6;
+                break;
+            }
+        }
+        bins.emplace_back(-1, w, h);
+    }
+    return bins;
+}
+
+void setPerOp(benchmark::State& state, int64_t ops) {
+    state.SetItemsProcessed(state.iterations() * ops);
+    state.counters["time_per_op"] = benchmark::Counter(double(ops),
+        benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+
+// packOne() `range(1)` bins of a dataset into an empty sprite
+void BM_PackOne(benchmark::State& state) {
+    Dataset dataset = Dataset(state.range(0));
+    std::vector<Bin> bins = generate(dataset, std::size_t(state.range(1)));
+    state.SetLabel(datasetNames[dataset]);
+
+    for (auto _ : state) {
+        ShelfPack sprite(dim, dim);
+        for (const auto& bin : bins) {
+            benchmark::DoNotOptimize(sprite.packOne(-1, bin.w, bin.h));
+        }
+    }
+    setPerOp(state, state.range(1));
+}
+BENCHMARK(BM_PackOne)
+    ->ArgsProduct({ { FixedBoth, RandWidth, RandHeight, RandBoth, Glyphs }, { 100000 } })
+    ->Unit(benchmark::kMillisecond);
+
+
+// batch pack() with each sort strategy, reporting the packed height
+void BM_Pack(benchmark::State& state) {
+    Dataset dataset = Dataset(state.range(0));
+    std::vector<Bin> bins = generate(dataset, std::size_t(state.range(2)));
+    ShelfPack::PackOptions options;
+    options.sort = ShelfPack::SortStrategy(state.range(1));
+
+    const char* const sortNames[] = { "none", "heightDesc", "areaDesc", "maxSideDesc" };
+    state.SetLabel(std::string(datasetNames[dataset]) + "/" + sortNames[state.range(1)]);
+
+    int32_t height = 0;
+    for (auto _ : state) {
+        ShelfPack sprite(4096, dim);
+        benchmark::DoNotOptimize(sprite.pack(bins, options));
+        height = sprite.height();
+    }
+    setPerOp(state, state.range(2));
+    state.counters["height"] = height;
+}
+BENCHMARK(BM_Pack)
+    ->ArgsProduct({ { RandHeight, RandBoth, Glyphs }, { 0, 1, 2, 3 }, { 100000 } })
+    ->Unit(benchmark::kMillisecond);
+
+
+// batch pack() 10k bins with each engine, unsorted or tallest first,
+// reporting the share of the shrunk sprite covered by bins
+template <typename Engine>
+void packEngine(benchmark::State& state, std::vector<Bin>& bins, typename Engine::PackOptions options) {
+    int64_t area = 0;
+    for (const auto& bin : bins) {
+        area += int64_t(bin.w) * bin.h;
+    }
+
+    double fill = 0;
+    for (auto _ : state) {
+        Engine sprite(1024, dim);
+        benchmark::DoNotOptimize(sprite.pack(bins, options));
+        fill = double(area) / (double(sprite.width()) * sprite.height());
+    }
+    state.counters["fill"] = fill;
+}
+
+void BM_Engine(benchmark::State& state) {
+    Dataset dataset = Dataset(state.range(0));
+    std::vector<Bin> bins = generate(dataset, 10000);
+    ShelfPack::PackOptions options;
+    options.sort = ShelfPack::SortStrategy(state.range(2));
+
+    const char* const engineNames[] = { "shelf", "skyline", "maxrects" };
+    const char* const sortNames[] = { "none", "heightDesc" };
+    state.SetLabel(std::string(datasetNames[dataset]) + "/" + engineNames[state.range(1)] + "/" + sortNames[state.range(2)]);
+
+    switch (state.range(1)) {
+        case 0: packEngine<ShelfPack>(state, bins, options); break;
+        case 1: packEngine<SkylinePack>(state, bins, options); break;
+        case 2: packEngine<MaxRectsPack>(state, bins, options); break;
+    }
+    setPerOp(state, int64_t(bins.size()));
+}
+BENCHMARK(BM_Engine)
+    ->ArgsProduct({ { RandBoth, Glyphs }, { 0, 1, 2 }, { 0, 1 } })
+    ->Unit(benchmark::kMillisecond);
+
+
+// steady state churn: unref a random live bin, then pack a new one that reuses free bins,
+// with `range(1)` set to split and merge free bins, reporting the used height
+void BM_Churn(benchmark::State& state) {
+    std::size_t live = std::size_t(state.range(0));
+    std::vector<Bin> bins = generate(Glyphs, live * 2);
+    ShelfPack::ShelfPackOptions options;
+    options.splitFreebins = options.mergeFreebins = state.range(1) != 0;
+    state.SetLabel(state.range(1) ? "split+merge" : "whole");
+
+    ShelfPack sprite(4096, dim, options);
+    std::vector<int32_t> ids;
+    for (std::size_t i = 0; i < live; i++) {
+        ids.push_back(sprite.packOne(-1, bins[i].w, bins[i].h)->id);
+    }
+
+    std::mt19937 rng(seed);
+    std::size_t next = live;
+    for (auto _ : state) {
+        std::size_t victim = rng() % ids.size();
+        sprite.unref(*sprite.getBin(ids[victim]));
+        const Bin& bin = bins[next++ % bins.size()];
+        Bin* packed = sprite.packOne(-1, bin.w, bin.h);
+        benchmark::DoNotOptimize(packed);
+        ids[victim] = packed->id;
+    }
+    setPerOp(state, 1);
+    sprite.shrink();
+    state.counters["height"] = sprite.height();
+}
+BENCHMARK(BM_Churn)->ArgsProduct({ { 10000, 100000 }, { 0, 1 } });
+
+
+// getBin() lookups of random live ids, with each id index
+void BM_GetBin(benchmark::State& state) {
+    ShelfPack::ShelfPackOptions options;
+    options.idIndex = ShelfPack::IdIndex(state.range(0));
+    state.SetLabel(state.range(0) ? "dense" : "hash");
+
+    std::size_t count = std::size_t(state.range(1));
+    ShelfPack sprite(dim, dim, options);
+    for (std::size_t i = 0; i < count; i++) {
+        sprite.packOne(-1, 12, 12);
+    }
+
+    std::mt19937 rng(seed);
+    std::vector<int32_t> lookups(4096);
+    for (auto& id : lookups) {
+        id = int32_t(rng() % count) + 1;
+    }
+
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sprite.getBin(lookups[i++ & 4095]));
+    }
+    setPerOp(state, 1);
+}
+BENCHMARK(BM_GetBin)->ArgsProduct({ { 0, 1 }, { 10000, 1000000 } });
+
+
+// shrink() a sprite with `range(0)` shelves
+void BM_Shrink(benchmark::State& state) {
+    ShelfPack sprite(64, dim);
+    for (int64_t i = 0; i < state.range(0); i++) {
+        sprite.packOne(-1, 64, 4 + int32_t(i % 4));
+    }
+
+    for (auto _ : state) {
+        sprite.shrink();
+        benchmark::ClobberMemory();
+    }
+    setPerOp(state, 1);
+}
+BENCHMARK(BM_Shrink)->Arg(1000)->Arg(100000);
+
+
+// restore a warm sprite of `range(1)` glyphs, replaying packOne() or with deserialize()
+void BM_Restore(benchmark::State& state) {
+    std::vector<Bin> bins = generate(Glyphs, std::size_t(state.range(1)));
+    state.SetLabel(state.range(0) ? "deserialize" : "replay");
+
+    ShelfPack warm(4096, dim);
+    for (const auto& bin : bins) {
+        warm.packOne(-1, bin.w, bin.h);
+    }
+    std::vector<uint8_t> snapshot = warm.serialize();
+
+    for (auto _ : state) {
+        ShelfPack sprite(4096, dim);
+        if (state.range(0)) {
+            benchmark::DoNotOptimize(sprite.deserialize(snapshot.data(), snapshot.size()));
+        } else {
+            for (const auto& bin : bins) {
+                benchmark::DoNotOptimize(sprite.packOne(-1, bin.w, bin.h));
+            }
+        }
+    }
+    setPerOp(state, state.range(1));
+    state.counters["bytes"] = double(snapshot.size());
+}
+BENCHMARK(BM_Restore)->ArgsProduct({ { 0, 1 }, { 100000 } })->Unit(benchmark::kMillisecond);
+
+
+// scan `range(1)` shelf buckets for room, as findShelf() does when only the last one fits,
+// with the scalar loop or the SIMD kernel
+void BM_FindAtMost(benchmark::State& state) {
+    std::size_t count = std::size_t(state.range(1));
+    std::vector<int32_t> minx(count, 4000);
+    minx.back() = 0;
+    state.SetLabel(state.range(0) ? "simd" : "scalar");
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(state.range(0) ?
+            detail::findAtMost(minx.data(), count, 100) : detail::findAtMostScalar(minx.data(), count, 100));
+    }
+    setPerOp(state, state.range(1));
+}
+BENCHMARK(BM_FindAtMost)->ArgsProduct({ { 0, 1 }, { 10000, 100000 } });
+
+
+// pack a 64x1 bin when every shelf is full, so packOne() scans all `range(0)` taller heights,
+// then unref it and let mergeFreebins drop its shelf again
+void BM_PackTallShelves(benchmark::State& state) {
+    int32_t count = int32_t(state.range(0));
+    ShelfPack::ShelfPackOptions options;
+    options.mergeFreebins = true;
+    ShelfPack sprite(64, std::numeric_limits<int32_t>::max(), options);
+    for (int32_t h = 1; h <= count; h++) {
+        sprite.packOne(-1, 64, h);
+    }
+
+    for (auto _ : state) {
+        Bin* bin = sprite.packOne(-1, 64, 1);
+        benchmark::DoNotOptimize(bin);
+        sprite.unref(*bin);
+    }
+    setPerOp(state, 1);
+}
+BENCHMARK(BM_PackTallShelves)->Arg(10000)->Arg(50000);
+
+
+// pack `range(0)` glyphs into a tiny sprite that grows with `autoResize`
+void BM_AutoResize(benchmark::State& state) {
+    std::vector<Bin> bins = generate(Glyphs, std::size_t(state.range(0)));
+    ShelfPack::ShelfPackOptions options;
+    options.autoResize = true;
+
+    int32_t width = 0, height = 0;
+    for (auto _ : state) {
+        ShelfPack sprite(64, 64, options);
+        for (const auto& bin : bins) {
+            benchmark::DoNotOptimize(sprite.packOne(-1, bin.w, bin.h));
+        }
+        width = sprite.width();
+        height = sprite.height();
+    }
+    setPerOp(state, state.range(0));
+    state.counters["width"] = width;
+    state.counters["height"] = height;
+}
+BENCHMARK(BM_AutoResize)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+
+BENCHMARK_MAIN();
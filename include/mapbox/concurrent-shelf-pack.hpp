@@ -0,0 +1,560 @@
+#ifndef CONCURRENT_SHELF_PACK_HPP
+#define CONCURRENT_SHELF_PACK_HPP
+
+#include <mapbox/shelf-pack.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace mapbox {
+
+namespace detail {
+
+// Atomic operations on a plain `int32_t`, so that `Bin` stays copyable..
+inline int32_t atomicLoad(const int32_t& value) {
+#if defined(_MSC_VER)
+    return _InterlockedCompareExchange(reinterpret_cast<volatile long*>(const_cast<int32_t*>(&value)), 0, 0);
+#else
+    return __atomic_load_n(&value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+inline int32_t atomicAdd(int32_t& value, int32_t delta) {
+#if defined(_MSC_VER)
+    return _InterlockedExchangeAdd(reinterpret_cast<volatile long*>(&value), delta) + delta;
+#else
+    return __atomic_add_fetch(&value, delta, __ATOMIC_ACQ_REL);
+#endif
+}
+
+inline bool atomicCompareExchange(int32_t& value, int32_t& expected, int32_t desired) {
+#if defined(_MSC_VER)
+    long previous = _InterlockedCompareExchange(reinterpret_cast<volatile long*>(&value), desired, expected);
+    if (previous == expected) {
+        return true;
+    }
+    expected = previous;
+    return false;
+#else
+    return __atomic_compare_exchange_n(&value, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+inline void atomicStore(int32_t& value, int32_t desired) {
+#if defined(_MSC_VER)
+    _InterlockedExchange(reinterpret_cast<volatile long*>(&value), desired);
+#else
+    __atomic_store_n(&value, desired, __ATOMIC_RELEASE);
+#endif
+}
+
+
+
+class ConcurrentBinDirectory {
+public:
+    /**
+     * Index of the used bins by id, with lock-free lookups.
+     * Ids in `[0, 2^26)` are kept in a two level table of atomic pointers, whose
+     * segments are allocated on first use and never moved.  Ids outside of that
+     * range fall back to a hash map behind a mutex.
+     *
+     * @private
+     * @class  ConcurrentBinDirectory
+     */
+    ConcurrentBinDirectory() {
+        for (auto& segment : segments_) {
+            segment.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ConcurrentBinDirectory(const ConcurrentBinDirectory&) = delete;
+    ConcurrentBinDirectory& operator=(const ConcurrentBinDirectory&) = delete;
+
+    ~ConcurrentBinDirectory() {
+        for (auto& segment : segments_) {
+            delete[] segment.load(std::memory_order_relaxed);
+        }
+    }
+
+
+    /**
+     * Return the bin for `id`, or nullptr if the id is not found.
+     *
+     * @private
+     * @param    {int32_t}  id   Bin identifier
+     * @returns  {Bin*}     Pointer to the bin
+     */
+    Bin* find(int32_t id) const {
+        if (dense(id)) {
+            std::atomic<Bin*>* segment = segments_[uint32_t(id) >> kSegmentBits].load(std::memory_order_acquire);
+            return segment ? segment[id & kSegmentMask].load(std::memory_order_acquire) : nullptr;
+        }
+        std::lock_guard<std::mutex> lock(overflowMutex_);
+        auto it = overflow_.find(id);
+        return (it == overflow_.end()) ? nullptr : it->second;
+    }
+
+
+    /**
+     * Store `bin` for `id`, unless another bin already has that id.
+     *
+     * @private
+     * @param    {int32_t}  id    Bin identifier
+     * @param    {Bin*}     bin   Pointer to the bin
+     * @returns  {Bin*}     The bin now stored for `id`, either `bin` or the existing one
+     */
+    Bin* insert(int32_t id, Bin* bin) {
+        if (dense(id)) {
+            Bin* expected = nullptr;
+            if (slot(id).compare_exchange_strong(expected, bin, std::memory_order_acq_rel)) {
+                return bin;
+            }
+            return expected;
+        }
+        std::lock_guard<std::mutex> lock(overflowMutex_);
+        return overflow_.emplace(id, bin).first->second;
+    }
+
+
+    /**
+     * Remove `bin` for `id`, if it is still the bin stored for that id.
+     *
+     * @private
+     * @param    {int32_t}  id    Bin identifier
+     * @param    {Bin*}     bin   Pointer to the bin
+     */
+    void erase(int32_t id, Bin* bin) {
+        if (dense(id)) {
+            Bin* expected = bin;
+            slot(id).compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(overflowMutex_);
+        auto it = overflow_.find(id);
+        if (it != overflow_.end() && it->second == bin) {
+            overflow_.erase(it);
+        }
+    }
+
+
+    /**
+     * Remove all bins, keeping the segments.  Must not run concurrently with other calls.
+     *
+     * @private
+     */
+    void clear() {
+        for (auto& segment : segments_) {
+            std::atomic<Bin*>* bins = segment.load(std::memory_order_relaxed);
+            for (uint32_t i = 0; bins && i < kSegmentSize; i++) {
+                bins[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        std::lock_guard<std::mutex> lock(overflowMutex_);
+        overflow_.clear();
+    }
+
+private:
+    enum : uint32_t {
+        kSegmentBits = 16,
+        kSegmentSize = 1u << kSegmentBits,
+        kSegmentMask = kSegmentSize - 1,
+        kSegments = 1024
+    };
+
+    static bool dense(int32_t id) {
+        return id >= 0 && uint32_t(id) < kSegments * kSegmentSize;
+    }
+
+    std::atomic<Bin*>& slot(int32_t id) {
+        std::atomic<std::atomic<Bin*>*>& segment = segments_[uint32_t(id) >> kSegmentBits];
+        std::atomic<Bin*>* bins = segment.load(std::memory_order_acquire);
+        if (!bins) {
+            std::atomic<Bin*>* fresh = new std::atomic<Bin*>[kSegmentSize];
+            for (uint32_t i = 0; i < kSegmentSize; i++) {
+                fresh[i].store(nullptr, std::memory_order_relaxed);
+            }
+            if (segment.compare_exchange_strong(bins, fresh, std::memory_order_acq_rel)) {
+                bins = fresh;
+            } else {
+                delete[] fresh;   // another thread installed the segment first
+            }
+        }
+        return bins[id & kSegmentMask];
+    }
+
+    std::atomic<std::atomic<Bin*>*> segments_[kSegments];
+    mutable std::mutex overflowMutex_;
+    std::unordered_map<int32_t, Bin*> overflow_;
+};
+
+}  // namespace detail
+
+
+
+class ConcurrentShelfPack {
+public:
+
+    struct ConcurrentShelfPackOptions {
+        inline ConcurrentShelfPackOptions() : shards(16) { };
+        int32_t shards;
+    };
+
+
+    /**
+     * Create a new thread-safe ShelfPack bin allocator.
+     *
+     * Shelves are sharded by height: every shard owns the shelves (and the free bins)
+     * of the heights that map to it, behind its own mutex, so threads packing bins of
+     * different heights rarely contend.  New shelves claim rows of the sprite with a
+     * lock-free compare-and-swap.  `getBin()`, `ref()` and `unref()` are lock-free,
+     * except when `unref()` releases the last reference and frees the bin.
+     *
+     * Bins are only reused within their shard, and the sprite never resizes,
+     * so placements differ from a single-threaded `ShelfPack`.
+     *
+     * @class  ConcurrentShelfPack
+     * @param  {int32_t}  [w=64]  Width of the sprite
+     * @param  {int32_t}  [h=64]  Height of the sprite
+     * @param  {ConcurrentShelfPackOptions}  [options]
+     * @param  {int32_t} [options.shards=16]  Number of height shards
+     *
+     * @example
+     * ConcurrentShelfPack sprite(1024, 1024);
+     * // from any thread..
+     * Bin* bin = sprite.packOne(-1, 12, 16);
+     */
+    explicit ConcurrentShelfPack(int32_t w = 0, int32_t h = 0,
+                                 const ConcurrentShelfPackOptions &options = ConcurrentShelfPackOptions{}) :
+        width_(w > 0 ? w : 64),
+        height_(h > 0 ? h : 64),
+        shardCount_(options.shards > 0 ? uint32_t(options.shards) : 1),
+        shards_(new Shard[shardCount_]),
+        maxId_(0),
+        nextShelfY_(0) { }
+
+
+    /**
+     * Pack a single bin into the sprite.  Safe to call from any thread.
+     *
+     * @param   {int32_t}  id     Unique bin identifier, pass -1 to generate a new one
+     * @param   {int32_t}  w      Width of the bin to allocate
+     * @param   {int32_t}  h      Height of the bin to allocate
+     * @returns {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members
+     *
+     * @example
+     * Bin* result = sprite.packOne(-1, 12, 16);
+     */
+    Bin* packOne(int32_t id, int32_t w, int32_t h) {
+        // if id was supplied, attempt a lookup..
+        if (id != -1) {
+            Bin* pbin = findRef(id);
+            if (pbin) {   // we packed this bin already
+                return pbin;
+            }
+            int32_t maxId = maxId_.load(std::memory_order_relaxed);
+            while (id > maxId && !maxId_.compare_exchange_weak(maxId, id, std::memory_order_relaxed)) { }
+        } else {
+            id = ++maxId_;
+        }
+
+        uint32_t home = shardIndex(h);
+        Bin* pbin = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(shards_[home].mutex);
+            pbin = packShard(shards_[home], id, w, h, true);
+        }
+
+        // No room for more shelves..  look for existing space in the other shards..
+        for (uint32_t i = 1; !pbin && i < shardCount_; i++) {
+            Shard& shard = shards_[(home + i) % shardCount_];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            pbin = packShard(shard, id, w, h, false);
+        }
+
+        if (!pbin) {
+            return nullptr;
+        }
+
+        for (;;) {
+            Bin* existing = directory_.insert(id, pbin);
+            if (existing == pbin) {
+                return pbin;
+            }
+            if (tryRef(*existing, id)) {
+                // another thread packed this id first, give our bin back and use theirs..
+                unref(*pbin);
+                return existing;
+            }
+            // theirs is being freed, and leaves the directory before its shard is unlocked..
+        }
+    }
+
+
+    /**
+     * Return a packed bin given its id, or nullptr if the id is not found.
+     * Lock-free.  The bin may be freed and reused by another thread
+     * unless the caller holds a reference to it.
+     *
+     * @param    {int32_t}  id  Unique identifier for this bin,
+     * @returns  {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members
+     *
+     * @example
+     * Bin* result = sprite.getBin(5);
+     */
+    Bin* getBin(int32_t id) const {
+        return directory_.find(id);
+    }
+
+
+    /**
+     * Increment the ref count of a bin.  Lock-free.
+     * The caller must hold a reference to the bin, otherwise another thread could
+     * free it first.  `packOne()` with the bin's id is safe without one.
+     *
+     * @param    {Bin&}      bin  Bin reference
+     * @returns  {int32_t}   New refcount of the bin
+     *
+     * @example
+     * Bin* bin = sprite.getBin(5);
+     * if (bin) {
+     *     sprite.ref(*bin);
+     * }
+     */
+    int32_t ref(Bin& bin) {
+        return detail::atomicAdd(bin.refcount_, 1);
+    }
+
+
+    /**
+     * Decrement the ref count of a bin.
+     * The bin will be automatically marked as free space once the refcount reaches 0.
+     * Lock-free unless this releases the last reference.
+     *
+     * @param    {Bin&}     bin  Bin reference
+     * @returns  {int32_t}  New refcount of the bin
+     *
+     * @example
+     * Bin* bin = sprite.getBin(5);
+     * if (bin) {
+     *     sprite.unref(*bin);
+     * }
+     */
+    int32_t unref(Bin& bin) {
+        int32_t refcount = detail::atomicLoad(bin.refcount_);
+        while (refcount > 1) {
+            if (detail::atomicCompareExchange(bin.refcount_, refcount, refcount - 1)) {
+                return refcount - 1;
+            }
+        }
+
+        // last reference, free the bin in the shard that owns its shelf..
+        Shard& shard = shards_[shardIndex(bin.maxh)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        refcount = detail::atomicLoad(bin.refcount_);
+        while (refcount > 0) {
+            if (detail::atomicCompareExchange(bin.refcount_, refcount, refcount - 1)) {
+                if (refcount == 1) {
+                    directory_.erase(bin.id, &bin);
+                    shard.freebins.push(&bin);
+                }
+                return refcount - 1;
+            }
+        }
+        return 0;
+    }
+
+
+    /**
+     * Clear the sprite.  Invalidates all Bin pointers, and must not run
+     * concurrently with calls from other threads.
+     *
+     * @example
+     * sprite.clear();
+     */
+    void clear() {
+        for (uint32_t i = 0; i < shardCount_; i++) {
+            Shard& shard = shards_[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.shelves.clear();
+            shard.pool.clear();
+            shard.buckets.clear();
+            shard.freebins.clear();
+        }
+        directory_.clear();
+        maxId_ = 0;
+        nextShelfY_ = 0;
+    }
+
+    int32_t width() const { return width_; }
+    int32_t height() const { return height_; }
+
+
+private:
+
+    struct Shard {
+        std::mutex mutex;
+        detail::BinPool<Bin> pool;
+        std::deque<Shelf> shelves;
+        std::vector<detail::ShelfBucket<Shelf>> buckets;
+        detail::FreebinIndex<Bin> freebins;
+    };
+
+    /**
+     * Called by packOne() to look up a bin and ref it, retrying if the bin is freed
+     * by another thread in between
+     *
+     * @private
+     * @param    {int32_t}  id   Bin identifier
+     * @returns  {Bin*}     Pointer to the referenced bin, or nullptr if the id is not found
+     */
+    Bin* findRef(int32_t id) {
+        for (;;) {
+            Bin* pbin = directory_.find(id);
+            if (!pbin || tryRef(*pbin, id)) {
+                return pbin;
+            }
+        }
+    }
+
+
+    /**
+     * Ref a bin found by id, unless its last reference is gone.  A bin is only reused
+     * once its refcount reaches 0, so refusing to go from 0 to 1 keeps a freed bin dead.
+     * If the bin was freed and reused before the ref, the ref is given back.
+     *
+     * @private
+     * @param    {Bin&}     bin  Bin found for `id`
+     * @param    {int32_t}  id   Bin identifier
+     * @returns  {bool}     `true` if the bin was referenced, and is still the bin for `id`
+     */
+    bool tryRef(Bin& bin, int32_t id) {
+        int32_t refcount = detail::atomicLoad(bin.refcount_);
+        while (refcount > 0) {
+            if (detail::atomicCompareExchange(bin.refcount_, refcount, refcount + 1)) {
+                // the ref keeps the bin from being reused, check it was not reused already..
+                if (bin.id == id && directory_.find(id) == &bin) {
+                    return true;
+                }
+                unref(bin);
+                return false;
+            }
+        }
+        return false;
+    }
+
+
+    uint32_t shardIndex(int32_t h) const {
+        return uint32_t(h) % shardCount_;
+    }
+
+
+    /**
+     * Called by packOne() to pack a bin into a shard, with the shard locked.
+     * Follows the same Shelf Best Height Fit steps as `ShelfPack::packOne()`.
+     *
+     * @private
+     * @param    {Shard&}    shard     Locked shard
+     * @param    {int32_t}   id        Unique identifier for this bin
+     * @param    {int32_t}   w         Width of the bin to allocate
+     * @param    {int32_t}   h         Height of the bin to allocate
+     * @param    {bool}      addShelf  If `true`, a new shelf may be opened
+     * @returns  {Bin*}      Pointer to the packed Bin, or nullptr if out of space
+     */
+    Bin* packShard(Shard& shard, int32_t id, int32_t w, int32_t h, bool addShelf) {
+        // First try to reuse a free bin..
+        Bin* pfreebin = shard.freebins.find(w, h);
+        if (pfreebin && pfreebin->maxw == w && pfreebin->maxh == h) {
+            return allocFreebin(shard, pfreebin, id, w, h);
+        }
+
+        // Next find the best shelf..
+        auto bucket = std::lower_bound(shard.buckets.begin(), shard.buckets.end(), h,
+            [](const detail::ShelfBucket<Shelf>& b, int32_t h1) { return b.h() < h1; });
+
+        if (bucket != shard.buckets.end() && bucket->h() == h) {
+            Shelf* pshelf = bucket->find(width_ - w);
+            if (pshelf) {
+                return allocShelf(shard, *pshelf, id, w, h);
+            }
+            ++bucket;
+        }
+
+        if (pfreebin) {
+            return allocFreebin(shard, pfreebin, id, w, h);
+        }
+
+        for (; bucket != shard.buckets.end(); ++bucket) {
+            Shelf* pshelf = bucket->find(width_ - w);
+            if (pshelf) {
+                return allocShelf(shard, *pshelf, id, w, h);
+            }
+        }
+
+        // No free bins or shelves.. claim rows for a new shelf..
+        if (!addShelf || w > width_) {
+            return nullptr;
+        }
+        int32_t y = nextShelfY_.load(std::memory_order_relaxed);
+        do {
+            if (h > height_ - y) {
+                return nullptr;
+            }
+        } while (!nextShelfY_.compare_exchange_weak(y, y + h, std::memory_order_relaxed));
+
+        shard.shelves.emplace_back(y, width_, h, shard.pool);
+        Shelf& shelf = shard.shelves.back();
+        shelf.slot_ = bucketFor(shard, h).push(&shelf);
+        return allocShelf(shard, shelf, id, w, h);
+    }
+
+    Bin* allocFreebin(Shard& shard, Bin* bin, int32_t id, int32_t w, int32_t h) {
+        shard.freebins.erase(bin);
+        bin->id = id;
+        bin->w = w;
+        bin->h = h;
+        detail::atomicStore(bin->refcount_, 1);
+        return bin;
+    }
+
+    Bin* allocShelf(Shard& shard, Shelf& shelf, int32_t id, int32_t w, int32_t h) {
+        Bin* pbin = shelf.alloc(id, w, h);
+        if (pbin) {
+            bucketFor(shard, shelf.h()).update(shelf.slot_);
+            detail::atomicStore(pbin->refcount_, 1);
+        }
+        return pbin;
+    }
+
+    detail::ShelfBucket<Shelf>& bucketFor(Shard& shard, int32_t h) {
+        auto bucket = std::lower_bound(shard.buckets.begin(), shard.buckets.end(), h,
+            [](const detail::ShelfBucket<Shelf>& b, int32_t h1) { return b.h() < h1; });
+        if (bucket == shard.buckets.end() || bucket->h() != h) {
+            bucket = shard.buckets.emplace(bucket, h);
+        }
+        return *bucket;
+    }
+
+
+    const int32_t width_;
+    const int32_t height_;
+    const uint32_t shardCount_;
+
+    std::unique_ptr<Shard[]> shards_;
+    detail::ConcurrentBinDirectory directory_;
+    std::atomic<int32_t> maxId_;
+    std::atomic<int32_t> nextShelfY_;
+};
+
+
+}  // namespace mapbox
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef MAXRECTS_PACK_HPP
+#define MAXRECTS_PACK_HPP
+
+#include <mapbox/shelf-pack.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace mapbox {
+
+
+class MaxRectsPack {
+public:
+
+    using PackOptions = ShelfPack::PackOptions;
+    using SortStrategy = ShelfPack::SortStrategy;
+
+
+    /**
+     * Create a new MaxRects bin allocator.
+     *
+     * Uses the MaxRects Bottom-Left algorithm from
+     * http://clb.demon.fi/files/RectangleBinPack.pdf
+     *
+     * The free space of the sprite is kept as a list of maximal free rectangles, which may
+     * overlap.  Each bin goes into the free rectangle where its bottom edge ends up highest,
+     * leftmost first, and every free rectangle it overlaps is split around it.  Only the
+     * rectangles split by a placement are checked for redundancy, and only against the free
+     * rectangles touching the bin, rather than all pairs.
+     * Free rectangles are bucketed by their top edge in bands of 32 pixels, so a search stops
+     * at the first band with room, and a placement only visits the bands that reach its bin.
+     * With sorted input this packs densest of the engines.  It is still the slowest.
+     *
+     * Shares `Bin`, `packOne()`, `pack()`, `getBin()`, `ref()`, `unref()` with `ShelfPack`.
+     * Bins freed by `unref()` become free rectangles of their own, and are not merged
+     * with the free space around them.  The sprite never grows by itself, see `resize()`.
+     *
+     * @class  MaxRectsPack
+     * @param  {int32_t}  [w=64]  Width of the sprite
+     * @param  {int32_t}  [h=64]  Height of the sprite
+     *
+     * @example
+     * MaxRectsPack sprite(1024, 1024);
+     * Bin* bin = sprite.packOne(-1, 12, 16);
+     */
+    explicit MaxRectsPack(int32_t w = 0, int32_t h = 0) :
+        width_(w > 0 ? w : 64),
+        height_(h > 0 ? h : 64),
+        maxId_(0),
+        usedWidth_(0),
+        usedHeight_(0) {
+        bands_.resize(bandIndex(height_) + 1);
+        insert(Rect{ 0, 0, width_, height_ });
+    }
+
+
+    /**
+     * Batch pack multiple bins into the sprite.
+     *
+     * @param   {vector<Bin>}   bins   Array of requested bins - each object should have `w`, `h` values
+     * @param   {PackOptions}   [options]  Same as `ShelfPack::pack()`, `presize` has no effect
+     * @returns {vector<Bin*>}   Array of Bin pointers - each bin is a struct with `x`, `y`, `w`, `h` values
+     *
+     * @example
+     * MaxRectsPack::PackOptions options;
+     * options.sort = MaxRectsPack::SortStrategy::AreaDesc;
+     * std::vector<Bin*> results = sprite.pack(bins, options);
+     */
+    std::vector<Bin*> pack(std::vector<Bin> &bins, const PackOptions &options = PackOptions{}) {
+        std::vector<Bin*> allocations(bins.size(), nullptr);
+        if (options.sort == SortStrategy::None) {
+            for (std::size_t i = 0; i < bins.size(); i++) {
+                allocations[i] = packBin(bins[i], options);
+            }
+        } else {
+            detail::sortOrder(order_, bins.size(), options.sort,
+                [&bins](std::size_t i) { return bins[i].w; },
+                [&bins](std::size_t i) { return bins[i].h; });
+            for (std::size_t i : order_) {
+                allocations[i] = packBin(bins[i], options);
+            }
+        }
+
+        std::vector<Bin*> results;
+        for (Bin* allocation : allocations) {
+            if (allocation) {
+                results.push_back(allocation);
+            }
+        }
+        if (options.shrink) {
+            shrink();
+        }
+        return results;
+    }
+
+
+    /**
+     * Pack a single bin into the sprite.
+     *
+     * @param   {int32_t}  id     Unique bin identifier, pass -1 to generate a new one
+     * @param   {int32_t}  w      Width of the bin to allocate
+     * @param   {int32_t}  h      Height of the bin to allocate
+     * @returns {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members,
+     *   or nullptr if there is no room
+     *
+     * @example
+     * Bin* result = sprite.packOne(-1, 12, 16);
+     */
+    Bin* packOne(int32_t id, int32_t w, int32_t h) {
+        // if id was supplied, attempt a lookup..
+        if (id != -1) {
+            Bin* pbin = getBin(id);
+            if (pbin) {   // we packed this bin already
+                ref(*pbin);
+                return pbin;
+            }
+            maxId_ = std::max(id, maxId_);
+        } else {
+            id = ++maxId_;
+        }
+
+        // the free rectangle where the bin's bottom ends up highest, then leftmost..
+        // bands further down only hold rectangles with a higher top, so stop at the first fit
+        const Rect* best = nullptr;
+        for (const Band& band : bands_) {
+            for (const auto& rect : band.rects) {
+                if (rect.w < w || rect.h < h) {
+                    continue;
+                }
+                if (!best || rect.y < best->y || (rect.y == best->y && rect.x < best->x)) {
+                    best = &rect;
+                }
+            }
+            if (best) {
+                break;
+            }
+        }
+        if (!best) {
+            return nullptr;
+        }
+
+        Rect placed{ best->x, best->y, w, h };
+        place(placed);
+
+        Bin* bin = pool_.create(id, w, h, w, h, placed.x, placed.y);
+        bin->refcount_ = 1;
+        usedbins_.insert(id, bin);
+        usedWidth_ = std::max(placed.x + w, usedWidth_);
+        usedHeight_ = std::max(placed.y + h, usedHeight_);
+        return bin;
+    }
+
+
+    /**
+     * Shrink the width/height of the sprite to the bare minimum.
+     *
+     * @example
+     * sprite.shrink();
+     */
+    void shrink() {
+        resize(usedWidth_, usedHeight_);
+    }
+
+
+    /**
+     * Return a packed bin given its id, or nullptr if the id is not found
+     *
+     * @param    {int32_t}  id  Unique identifier for this bin,
+     * @returns  {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members
+     *
+     * @example
+     * Bin* result = sprite.getBin(5);
+     */
+    Bin* getBin(int32_t id) {
+        return usedbins_.find(id);
+    }
+
+
+    /**
+     * Increment the ref count of a bin.
+     *
+     * @param    {Bin&}      bin  Bin reference
+     * @returns  {int32_t}   New refcount of the bin
+     *
+     * @example
+     * Bin* bin = sprite.getBin(5);
+     * if (bin) {
+     *     sprite.ref(*bin);
+     * }
+     */
+    int32_t ref(Bin& bin) {
+        return ++bin.refcount_;
+    }
+
+
+    /**
+     * Decrement the ref count of a bin.
+     * The bin's area becomes a free rectangle once the refcount reaches 0, and the
+     * `Bin` itself is recycled, so pointers to it must not be used afterwards.
+     *
+     * @param    {Bin&}     bin  Bin reference
+     * @returns  {int32_t}  New refcount of the bin
+     *
+     * @example
+     * Bin* bin = sprite.getBin(5);
+     * if (bin) {
+     *     sprite.unref(*bin);
+     * }
+     */
+    int32_t unref(Bin& bin) {
+        if (bin.refcount_ == 0) {
+            return 0;
+        }
+        if (--bin.refcount_ > 0) {
+            return bin.refcount_;
+        }
+        usedbins_.erase(bin.id);
+        insert(Rect{ bin.x, bin.y, bin.maxw, bin.maxh });
+        pool_.recycle(&bin);
+        return 0;
+    }
+
+
+    /**
+     * Clear the sprite.
+     *
+     * @example
+     * sprite.clear();
+     */
+    void clear() {
+        pool_.clear();
+        usedbins_.clear();
+        bands_.assign(bandIndex(height_) + 1, Band{});
+        insert(Rect{ 0, 0, width_, height_ });
+        maxId_ = 0;
+        usedWidth_ = 0;
+        usedHeight_ = 0;
+    }
+
+
+    /**
+     * Resize the sprite.  Shrinking below bins that are already packed leaves them outside.
+     *
+     * @param   {int32_t}  w  Requested new sprite width
+     * @param   {int32_t}  h  Requested new sprite height
+     * @returns {bool}     `true` if resize succeeded, `false` if failed
+     *
+     * @example
+     * sprite.resize(256, 256);
+     */
+    bool resize(int32_t w, int32_t h) {
+        // clip to the new size, or stretch the rectangles along the old edges into the new space..
+        std::vector<Band> bands(std::move(bands_));
+        bands_.assign(bandIndex(h) + 1, Band{});
+        for (const Band& band : bands) {
+            for (Rect rect : band.rects) {
+                if (rect.x + rect.w >= width_ || rect.x + rect.w > w) {
+                    rect.w = w - rect.x;
+                }
+                if (rect.y + rect.h >= height_ || rect.y + rect.h > h) {
+                    rect.h = h - rect.y;
+                }
+                if (rect.w > 0 && rect.h > 0) {
+                    insert(rect);
+                }
+            }
+        }
+        if (w > width_) {
+            insert(Rect{ width_, 0, w - width_, h });
+        }
+        if (h > height_) {
+            insert(Rect{ 0, height_, w, h - height_ });
+        }
+
+        // ..then drop the ones inside another, looking up only the bands above each rectangle
+        bands.assign(bands_.size(), Band{});
+        for (std::size_t b = 0; b < bands_.size(); b++) {
+            for (std::size_t i = 0; i < bands_[b].rects.size(); i++) {
+                const Rect& rect = bands_[b].rects[i];
+                if (!covered(rect, b, i)) {
+                    bands[b].rects.push_back(rect);
+                    bands[b].bottom = std::max(rect.y + rect.h, bands[b].bottom);
+                }
+            }
+        }
+        bands_.swap(bands);
+        width_ = w;
+        height_ = h;
+        return true;
+    }
+
+    int32_t width() const { return width_; }
+    int32_t height() const { return height_; }
+
+
+private:
+
+    struct Rect {
+        int32_t x;
+        int32_t y;
+        int32_t w;
+        int32_t h;
+    };
+
+    // free rectangles with their top in `[b << kBandShift, (b + 1) << kBandShift)`
+    struct Band {
+        std::vector<Rect> rects;
+        int32_t bottom = 0;   // at least the max `y + h` of `rects`
+    };
+
+    static constexpr int32_t kBandShift = 5;
+
+    static std::size_t bandIndex(int32_t y) {
+        return std::size_t(std::max(y, 0) >> kBandShift);
+    }
+
+    static bool contains(const Rect& a, const Rect& b) {
+        return b.x >= a.x && b.y >= a.y && b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h;
+    }
+
+    static bool overlaps(const Rect& a, const Rect& b) {
+        return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+    }
+
+    // overlapping or sharing an edge..
+    static bool touches(const Rect& a, const Rect& b) {
+        return a.x <= b.x + b.w && b.x <= a.x + a.w && a.y <= b.y + b.h && b.y <= a.y + a.h;
+    }
+
+    // `rects[i]` is inside another one of `rects`, equal rectangles keep the first copy..
+    static bool redundant(const std::vector<Rect> &rects, std::size_t i) {
+        for (std::size_t j = 0; j < rects.size(); j++) {
+            if (j != i && contains(rects[j], rects[i]) && (j < i || !contains(rects[i], rects[j]))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    /**
+     * Called by pack() to pack a single requested bin
+     *
+     * @private
+     * @param    {Bin&}          bin      Requested bin with `id`, `w`, `h` values
+     * @param    {PackOptions}   options  Options passed to `pack()`
+     * @returns  {Bin*}          Pointer to the packed Bin, or nullptr if skipped or out of space
+     */
+    Bin* packBin(Bin& bin, const PackOptions &options) {
+        if (bin.w <= 0 || bin.h <= 0) {
+            return nullptr;
+        }
+        Bin* allocation = packOne(bin.id, bin.w, bin.h);
+        if (allocation && options.inPlace) {
+            bin.id = allocation->id;
+            bin.x = allocation->x;
+            bin.y = allocation->y;
+        }
+        return allocation;
+    }
+
+
+    /**
+     * Called by resize() to check if `rects[i]` of band `b` is inside another free rectangle,
+     * equal rectangles keep the first copy.  A rectangle containing it has its top in the
+     * same band or one above, and reaches down at least as far.
+     *
+     * @private
+     * @param    {Rect}     rect   Free rectangle, `bands_[b].rects[i]`
+     * @param    {size_t}   b      Band of the rectangle
+     * @param    {size_t}   i      Index of the rectangle in its band
+     * @returns  {bool}     `true` if the rectangle can be dropped
+     */
+    bool covered(const Rect& rect, std::size_t b, std::size_t i) const {
+        for (std::size_t c = 0; c <= b; c++) {
+            if (bands_[c].bottom < rect.y + rect.h) {
+                continue;
+            }
+            const std::vector<Rect>& rects = bands_[c].rects;
+            for (std::size_t j = 0; j < rects.size(); j++) {
+                if ((c != b || j != i) && contains(rects[j], rect) &&
+                    (c < b || j < i || !contains(rect, rects[j]))) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+
+    void insert(const Rect& rect) {
+        std::size_t b = bandIndex(rect.y);
+        if (b >= bands_.size()) {
+            bands_.resize(b + 1);   // an unref'd bin left outside by shrinking
+        }
+        bands_[b].rects.push_back(rect);
+        bands_[b].bottom = std::max(rect.y + rect.h, bands_[b].bottom);
+    }
+
+
+    /**
+     * Called by packOne() to take a placed bin out of the free rectangles.
+     * Every free rectangle it overlaps is replaced by the up to four maximal rectangles
+     * around it.  Only the new rectangles are checked for being inside another one, an
+     * untouched rectangle inside a new one can only be an unref'd bin, and is left alone.
+     * A new rectangle shares an edge with the bin, so anything containing it touches the bin
+     * too, and only those rectangles are kept to check against.  Bands above the bin whose
+     * rectangles all end above it are skipped.
+     *
+     * @private
+     * @param    {Rect}   placed   Area of the placed bin
+     */
+    void place(const Rect& placed) {
+        split_.clear();
+        touching_.clear();
+        std::size_t last = std::min(bandIndex(placed.y + placed.h) + 1, bands_.size());
+        for (std::size_t b = 0; b < last; b++) {
+            Band& band = bands_[b];
+            if (band.bottom < placed.y) {
+                continue;
+            }
+            band.bottom = 0;
+            split(band.rects, placed);
+            for (const Rect& rect : band.rects) {
+                band.bottom = std::max(rect.y + rect.h, band.bottom);
+                if (touches(rect, placed)) {
+                    touching_.push_back(rect);
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < split_.size(); i++) {
+            bool inside = redundant(split_, i);
+            for (std::size_t j = 0; !inside && j < touching_.size(); j++) {
+                inside = contains(touching_[j], split_[i]);
+            }
+            if (!inside) {
+                insert(split_[i]);
+            }
+        }
+    }
+
+
+    // takes the rectangles overlapping `placed` out of `rects`, their pieces go to `split_`..
+    void split(std::vector<Rect>& rects, const Rect& placed) {
+        for (std::size_t i = 0; i < rects.size(); ) {
+            Rect rect = rects[i];
+            if (!overlaps(rect, placed)) {
+                i++;
+                continue;
+            }
+            if (placed.x > rect.x) {
+                split_.push_back(Rect{ rect.x, rect.y, placed.x - rect.x, rect.h });
+            }
+            if (placed.x + placed.w < rect.x + rect.w) {
+                split_.push_back(Rect{ placed.x + placed.w, rect.y, rect.x + rect.w - placed.x - placed.w, rect.h });
+            }
+            if (placed.y > rect.y) {
+                split_.push_back(Rect{ rect.x, rect.y, rect.w, placed.y - rect.y });
+            }
+            if (placed.y + placed.h < rect.y + rect.h) {
+                split_.push_back(Rect{ rect.x, placed.y + placed.h, rect.w, rect.y + rect.h - placed.y - placed.h });
+            }
+            rects[i] = rects.back();
+            rects.pop_back();
+        }
+    }
+
+
+    int32_t width_;
+    int32_t height_;
+    int32_t maxId_;
+    int32_t usedWidth_;    // right edge of the bins, max `x + w`
+    int32_t usedHeight_;   // bottom edge of the bins, max `y + h`
+
+    detail::BinPool<Bin> pool_;
+    detail::BinIdIndex<Bin> usedbins_;
+    std::vector<Band> bands_;      // maximal free rectangles, except for unref'd bins
+    std::vector<Rect> split_;      // scratch space of `place()`
+    std::vector<Rect> touching_;   // scratch space of `place()`
+    std::vector<std::size_t> order_;
+};
+
+
+}  // namespace mapbox
+
+#endif
@@ -0,0 +1,457 @@
+#ifndef MULTI_PACK_HPP
+#define MULTI_PACK_HPP
+
+#include <mapbox/shelf-pack.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mapbox {
+
+namespace detail {
+
+class WorkerPool {
+public:
+    /**
+     * Threads kept waiting for tasks, so repeated batches do not start new threads.
+     * The calling thread works on each batch too.
+     *
+     * @private
+     * @class  WorkerPool
+     * @param  {size_t}  threads  Number of threads to start, besides the caller
+     */
+    explicit WorkerPool(std::size_t threads) {
+        for (std::size_t i = 0; i < threads; i++) {
+            threads_.emplace_back([this]() { loop(); });
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+
+    /**
+     * Run `task(0) .. task(count - 1)` on the pool and the calling thread, and wait for them
+     *
+     * @private
+     * @param    {size_t}     count   Number of tasks
+     * @param    {function}   task    Called with the index of each task
+     */
+    void run(std::size_t count, const std::function<void(std::size_t)>& task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            count_ = count;
+            next_ = 0;
+            busy_ = threads_.size();
+            generation_++;
+        }
+        wake_.notify_all();
+        work();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return busy_ == 0; });
+        task_ = nullptr;
+    }
+
+private:
+    void loop() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+            if (stop_) {
+                return;
+            }
+            seen = generation_;
+            lock.unlock();
+            work();
+            lock.lock();
+            if (--busy_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    void work() {
+        for (std::size_t i = next_++; i < count_; i = next_++) {
+            (*task_)(i);
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(std::size_t)>* task_ = nullptr;
+    std::size_t count_ = 0;
+    std::atomic<std::size_t> next_{0};
+    std::size_t busy_ = 0;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+};
+
+}  // namespace detail
+
+
+class MultiPack {
+public:
+
+    struct MultiPackOptions {
+        inline MultiPackOptions() : threads(0), sort(ShelfPack::SortStrategy::HeightDesc) { };
+        int32_t threads;
+        ShelfPack::SortStrategy sort;
+    };
+
+    struct Placement {
+        int32_t page;   // index of the page the bin was packed on, or -1 if not packed
+        int32_t x;
+        int32_t y;
+        Bin* bin;
+    };
+
+
+    /**
+     * Create a new multi-page bin allocator.
+     *
+     * Bins that do not fit on one fixed size `ShelfPack` page spill onto more pages.
+     * Each call to `pack()` first fills the pages it already has, least full first.
+     * Then it works in rounds: it opens pages for about 80% of the area of the remaining
+     * bins, deals the bins out to the new pages, and packs those pages in parallel on
+     * a pool of threads kept by the atlas.  Bins that did not fit are tried on the pages
+     * with room, least full first, before the next round opens more.
+     *
+     * Bin ids given to `pack()` are looked up across all pages, so a bin packed before is
+     * referenced again on its page.  Ids generated for bins with an id of -1 are per page.
+     *
+     * @class  MultiPack
+     * @param  {int32_t}  [w=64]  Width of each page
+     * @param  {int32_t}  [h=64]  Height of each page
+     * @param  {MultiPackOptions}  [options]
+     * @param  {int32_t} [options.threads=0]  Number of threads to pack pages on, 0 to use all cores
+     * @param  {SortStrategy} [options.sort=SortStrategy::HeightDesc]  Order to pack each page's bins in
+     *
+     * @example
+     * MultiPack atlas(1024, 1024);
+     * std::vector<MultiPack::Placement> placements = atlas.pack(bins);
+     */
+    explicit MultiPack(int32_t w = 0, int32_t h = 0, const MultiPackOptions &options = MultiPackOptions{}) :
+        width_(w > 0 ? w : 64),
+        height_(h > 0 ? h : 64),
+        options_(options) {
+        if (options_.threads <= 0) {
+            options_.threads = std::max(1, int32_t(std::thread::hardware_concurrency()));
+        }
+    }
+
+
+    /**
+     * Batch pack multiple bins, opening as many pages as needed.
+     *
+     * @param   {vector<Bin>}         bins   Array of requested bins - each object should have `w`, `h` values
+     * @returns {vector<Placement>}   One placement per requested bin, in the order of `bins`.
+     *   Bins without a size, or larger than a page, have a `page` of -1
+     *
+     * @example
+     * std::vector<MultiPack::Placement> placements = atlas.pack(bins);
+     * for (const auto& placement : placements) {
+     *     upload(placement.page, placement.x, placement.y);
+     * }
+     */
+    std::vector<Placement> pack(const std::vector<Bin> &bins) {
+        std::vector<Placement> results(bins.size(), Placement{ -1, -1, -1, nullptr });
+        std::vector<std::size_t> pending;
+        std::vector<std::pair<std::size_t, std::size_t>> repeats;   // bin, and the earlier bin with its id
+        std::unordered_map<int32_t, std::size_t> batch;
+        int64_t area = 0;
+
+        for (std::size_t i = 0; i < bins.size(); i++) {
+            const Bin& bin = bins[i];
+            if (bin.w <= 0 || bin.h <= 0 || bin.w > width_ || bin.h > height_) {
+                continue;
+            }
+            if (bin.id != -1) {
+                // packed by an earlier call, reference it again on its page..
+                auto it = ids_.find(bin.id);
+                if (it != ids_.end()) {
+                    if (pages_[it->second]->getBin(bin.id)) {
+                        results[i] = refPage(it->second, bin);
+                        continue;
+                    }
+                    ids_.erase(it);   // freed since
+                }
+                // or earlier in this call, reference it once that one is packed..
+                auto first = batch.emplace(bin.id, i);
+                if (!first.second) {
+                    repeats.emplace_back(i, first.first->second);
+                    continue;
+                }
+            }
+            pending.push_back(i);
+            area += int64_t(bin.w) * bin.h;
+        }
+
+        fillPages(bins, pending, area, results);
+
+        // Every new page packs at least its first bin, so each round makes progress..
+        while (!pending.empty()) {
+            int64_t pageArea = int64_t(width_) * height_;
+            std::size_t first = pages_.size();
+            // pages rarely fill up, so open fewer than the area needs, and offer each more bins
+            // than it can take.  The rest go to the pages with room, like the leftovers..
+            std::size_t count = std::max(std::size_t(1), std::size_t(area * 4 / 5 / pageArea));
+            count = std::min(pending.size(), count);
+            for (std::size_t i = 0; i < count; i++) {
+                pages_.emplace_back(new ShelfPack(width_, height_));
+                used_.push_back(0);
+            }
+
+            std::vector<std::vector<std::size_t>> dealt(count);
+            for (std::size_t i = 0; i < pending.size(); i++) {
+                dealt[i % count].push_back(pending[i]);
+            }
+            parallel(count, [&](std::size_t p) {
+                packPage(first + p, bins, dealt[p], results);
+            });
+
+            std::vector<std::size_t> leftover;
+            area = 0;
+            for (std::size_t i : pending) {
+                if (results[i].page == -1) {
+                    leftover.push_back(i);
+                    area += int64_t(bins[i].w) * bins[i].h;
+                }
+            }
+            pending.swap(leftover);
+            fillPages(bins, pending, area, results);
+        }
+
+        for (const auto& repeat : repeats) {
+            int32_t page = results[repeat.second].page;
+            if (page != -1) {
+                results[repeat.first] = refPage(std::size_t(page), bins[repeat.first]);
+            }
+        }
+        for (const auto& placed : batch) {
+            int32_t page = results[placed.second].page;
+            if (page != -1) {
+                ids_[placed.first] = std::size_t(page);
+            }
+        }
+
+        return results;
+    }
+
+
+    /**
+     * Remove all pages.
+     *
+     * @example
+     * atlas.clear();
+     */
+    void clear() {
+        pages_.clear();
+        used_.clear();
+        ids_.clear();
+    }
+
+    std::size_t pages() const { return pages_.size(); }
+    ShelfPack& page(std::size_t i) { return *pages_[i]; }
+    const ShelfPack& page(std::size_t i) const { return *pages_[i]; }
+
+    int32_t width() const { return width_; }
+    int32_t height() const { return height_; }
+
+
+private:
+
+    /**
+     * Called by pack() to try the pending bins on the pages it has, least full first.
+     * Pages without the free area for the smallest pending bin are skipped, and each page
+     * is only offered the bins that fit its free area, largest first, twice that area in all.
+     * Pending bins are left sorted by area, largest first.
+     *
+     * @private
+     * @param    {vector<Bin>}        bins      Requested bins
+     * @param    {vector<size_t>}     pending   Indices of the bins still to pack, packed ones are removed
+     * @param    {int64_t}            area      Area of the pending bins, updated
+     * @param    {vector<Placement>}  results   Placements to fill in
+     */
+    void fillPages(const std::vector<Bin> &bins, std::vector<std::size_t> &pending, int64_t &area,
+                   std::vector<Placement> &results) {
+        if (pending.empty() || pages_.empty()) {
+            return;
+        }
+        std::vector<std::size_t> order(pages_.size());
+        std::iota(order.begin(), order.end(), std::size_t(0));
+        std::stable_sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) {
+            return used_[a] < used_[b];
+        });
+
+        auto binArea = [&bins](std::size_t i) { return int64_t(bins[i].w) * bins[i].h; };
+        std::stable_sort(pending.begin(), pending.end(), [&](std::size_t a, std::size_t b) {
+            return binArea(a) > binArea(b);
+        });
+
+        // skip[j] leads past the packed bins from pending[j] on, shortened as it is followed..
+        std::vector<std::size_t> skip(pending.size() + 1);
+        std::iota(skip.begin(), skip.end(), std::size_t(0));
+        auto unpacked = [&skip](std::size_t j) {
+            std::size_t k = j;
+            while (skip[k] != k) {
+                k = skip[k];
+            }
+            while (skip[j] != k) {
+                std::size_t next = skip[j];
+                skip[j] = k;
+                j = next;
+            }
+            return k;
+        };
+
+        int64_t pageArea = int64_t(width_) * height_;
+        std::size_t last = pending.size();   // one past the smallest pending bin
+        std::vector<std::size_t> slots, offer;
+        for (std::size_t page : order) {
+            while (last > 0 && results[pending[last - 1]].page != -1) {
+                last--;
+            }
+            if (last == 0) {
+                break;
+            }
+            int64_t room = pageArea - used_[page];
+            if (room < binArea(pending[last - 1])) {
+                continue;
+            }
+
+            std::size_t first = std::size_t(std::partition_point(pending.begin(), pending.begin() + std::ptrdiff_t(last),
+                [&](std::size_t i) { return binArea(i) > room; }) - pending.begin());
+            slots.clear();
+            offer.clear();
+            int64_t offered = 0;
+            for (std::size_t j = unpacked(first); j < last && offered < room * 2; j = unpacked(j + 1)) {
+                slots.push_back(j);
+                offer.push_back(pending[j]);
+                offered += binArea(pending[j]);
+            }
+
+            packPage(page, bins, offer, results);
+            for (std::size_t j : slots) {
+                if (results[pending[j]].page != -1) {
+                    skip[j] = j + 1;
+                    area -= binArea(pending[j]);
+                }
+            }
+        }
+
+        pending.erase(std::remove_if(pending.begin(), pending.end(), [&results](std::size_t i) {
+            return results[i].page != -1;
+        }), pending.end());
+    }
+
+
+    /**
+     * Called by pack() to reference a bin packed on a page before
+     *
+     * @private
+     * @param    {size_t}     page   Index of the page the bin is packed on
+     * @param    {Bin}        bin    Requested bin, with the id of the packed bin
+     * @returns  {Placement}  Placement of the packed bin
+     */
+    Placement refPage(std::size_t page, const Bin &bin) {
+        Bin* pbin = pages_[page]->packOne(bin.id, bin.w, bin.h);
+        return Placement{ int32_t(page), pbin->x, pbin->y, pbin };
+    }
+
+
+    /**
+     * Called by pack() to pack bins onto one page
+     *
+     * @private
+     * @param    {size_t}             page      Index of the page
+     * @param    {vector<Bin>}        bins      Requested bins
+     * @param    {vector<size_t>}     indices   Indices of the bins to pack on this page
+     * @param    {vector<Placement>}  results   Placements to fill in
+     */
+    void packPage(std::size_t page, const std::vector<Bin> &bins, const std::vector<std::size_t> &indices,
+                  std::vector<Placement> &results) {
+        std::vector<int32_t> widths, heights, ids;
+        for (std::size_t i : indices) {
+            const Bin& bin = bins[i];
+            widths.push_back(bin.w);
+            heights.push_back(bin.h);
+            ids.push_back(bin.id);
+        }
+
+        std::vector<Bin*> packed(widths.size());
+        ShelfPack::PackOptions options;
+        options.sort = options_.sort;
+        options.shrink = false;   // pages keep their full size
+
+        ShelfPack& sprite = *pages_[page];
+        sprite.pack(widths.size(), widths.data(), heights.data(), ids.data(),
+                    packed.data(), nullptr, options);
+
+        for (std::size_t j = 0; j < indices.size(); j++) {
+            if (packed[j]) {
+                results[indices[j]] = Placement{ int32_t(page), packed[j]->x, packed[j]->y, packed[j] };
+                used_[page] += int64_t(packed[j]->w) * packed[j]->h;
+            }
+        }
+    }
+
+
+    /**
+     * Run `task(0) .. task(count - 1)` on up to `options.threads` threads.
+     * The threads are started on first use, and kept for later calls.
+     *
+     * @private
+     */
+    void parallel(std::size_t count, const std::function<void(std::size_t)>& task) {
+        if (count <= 1 || options_.threads <= 1) {
+            for (std::size_t i = 0; i < count; i++) {
+                task(i);
+            }
+            return;
+        }
+        if (!workers_) {
+            workers_.reset(new detail::WorkerPool(std::size_t(options_.threads) - 1));
+        }
+        workers_->run(count, task);
+    }
+
+
+    int32_t width_;
+    int32_t height_;
+    MultiPackOptions options_;
+
+    std::vector<std::unique_ptr<ShelfPack>> pages_;
+    std::vector<int64_t> used_;                     // area packed on each page, for filling the least full first
+    std::unordered_map<int32_t, std::size_t> ids_;  // page of each bin packed with an id
+    std::unique_ptr<detail::WorkerPool> workers_;
+};
+
+
+}  // namespace mapbox
+
+#endif
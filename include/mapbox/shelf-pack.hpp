@@ -2,24 +2,116 @@
 #define SHELF_PACK_HPP
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <deque>
+#include <iterator>
 #include <limits>
-#include <map>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+// Define SHELF_PACK_NO_SIMD before including this header to force the scalar scans.
+#if !defined(SHELF_PACK_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define SHELF_PACK_AVX2
+#elif !defined(SHELF_PACK_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define SHELF_PACK_SSE2
+#elif !defined(SHELF_PACK_NO_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SHELF_PACK_NEON
+#endif
+
 namespace mapbox {
 
 const char * const SHELF_PACK_VERSION = "2.1.1";
 
+// Define SHELF_PACK_STATS before including this header to collect `ShelfPack::stats()`.
+// Otherwise the counters compile to nothing.
+#ifdef SHELF_PACK_STATS
+#define SHELF_PACK_COUNT(counter, n) (counters_.counter += (n))
+#else
+#define SHELF_PACK_COUNT(counter, n) ((void)0)
+#endif
+
+struct DoublingGrowth;
+
+template <typename Coord = int32_t, typename Growth = DoublingGrowth>
+class BasicShelfPack;
+
+class ConcurrentShelfPack;
+class SkylinePack;
+class MaxRectsPack;
+
+namespace detail {
+template <typename BinT> class FreebinIndex;
+template <typename BinT> class BinHandles;
+template <typename BinT> class BinLru;
+}  // namespace detail
+
+
+
+class BinHandle {
+public:
+    /**
+     * Compact reference to a packed bin: 4 bytes instead of a pointer, that can be checked.
+     * It is an index into the sprite's handle table, and a generation that changes each time
+     * the slot is reused, so `getBin()` returns nullptr for the handle of a bin that was freed,
+     * instead of whatever bin took its place.  Generations wrap after 1023 reuses of a slot.
+     * A default constructed handle refers to no bin.
+     *
+     * @class  BinHandle
+     * @param  {uint32_t}  [value=0]  Handle value, as returned by `value()`
+     *
+     * @example
+     * BinHandle handle = bin->handle();
+     * Bin* same = sprite.getBin(handle);
+     */
+    explicit BinHandle(uint32_t value1 = 0) : value_(value1) { }
+
+    uint32_t value() const { return value_; }
+    uint32_t index() const { return value_ & kIndexMask; }
+    uint32_t generation() const { return value_ >> kIndexBits; }
+
+    explicit operator bool() const { return value_ != 0; }
+    bool operator==(BinHandle other) const { return value_ == other.value_; }
+    bool operator!=(BinHandle other) const { return value_ != other.value_; }
+
+    enum : uint32_t {
+        kIndexBits = 22,
+        kIndexMask = (1u << kIndexBits) - 1,
+        kMaxGeneration = (1u << (32 - kIndexBits)) - 1
+    };
+
+private:
+    uint32_t value_;
+};
+
 
+template <typename Coord>
+class BasicBin {
+    template <typename, typename> friend class BasicShelfPack;
+    friend class ConcurrentShelfPack;
+    friend class SkylinePack;
+    friend class MaxRectsPack;
+    template <typename> friend class detail::FreebinIndex;
+    template <typename> friend class detail::BinHandles;
+    template <typename> friend class detail::BinLru;
 
-class Bin {
-    friend class ShelfPack;
+    static_assert(std::is_integral<Coord>::value && (std::is_signed<Coord>::value || sizeof(Coord) < sizeof(int32_t)),
+        "bin coordinates must be an integer type that int32_t arithmetic can hold");
 
 public:
     /**
      * Create a new Bin.
+     * Sizes and positions are stored as `Coord`, `Bin` stores them as `int32_t`.
+     * A smaller `Coord` like `uint16_t` makes bins smaller, for sprites up to 65535 pixels.
      *
      * @class  Bin
      * @param  {int32_t}  id          Unique bin identifier
@@ -33,7 +125,7 @@ public:
      * @example
      * Bin b(-1, 12, 16);
      */
-    explicit Bin(
+    explicit BasicBin(
         int32_t id1 = -1,
         int32_t w1 = -1,
         int32_t h1 = -1,
@@ -41,33 +133,279 @@ public:
         int32_t maxh1 = -1,
         int32_t x1 = -1,
         int32_t y1 = -1
-    ) : id(id1), w(w1), h(h1), maxw(maxw1), maxh(maxh1), x(x1), y(y1), refcount_(0) {
+    ) : id(id1), w(Coord(w1)), h(Coord(h1)), maxw(Coord(maxw1 == -1 ? w1 : maxw1)),
+        maxh(Coord(maxh1 == -1 ? h1 : maxh1)), x(Coord(x1)), y(Coord(y1)), refcount_(0),
+        prevFree_(nullptr), nextFree_(nullptr), freeStamp_(0), handle_(0) { }
+
+    int32_t id;
+    Coord w;
+    Coord h;
+    Coord maxw;
+    Coord maxh;
+    Coord x;
+    Coord y;
+
+    int32_t refcount() const { return refcount_; }
+
+    // handle of the bin, if the sprite has the `handles` option, and the bin is packed
+    BinHandle handle() const { return BinHandle(handle_); }
+
+private:
+
+    int32_t refcount_;
+
+    // intrusive links for the free bin index, or the unused bins kept by `evictUnused`,
+    // only meaningful while refcount is 0
+    BasicBin* prevFree_;
+    BasicBin* nextFree_;
+    uint32_t freeStamp_;
+
+    uint32_t handle_;
+};
+
+using Bin = BasicBin<int32_t>;
+
+
+class BinAllocator {
+public:
+    /**
+     * Interface for supplying the memory that bins are stored in.
+     * Bins are allocated in large chunks, so these are called rarely.
+     * Returned memory must be suitably aligned for `Bin`.
+     *
+     * @class  BinAllocator
+     *
+     * @example
+     * class MyAllocator : public BinAllocator {
+     *     void* allocate(std::size_t bytes) override { return myMalloc(bytes); }
+     *     void deallocate(void* p, std::size_t) override { myFree(p); }
+     * };
+     */
+    virtual ~BinAllocator() = default;
+    virtual void* allocate(std::size_t bytes) = 0;
+    virtual void deallocate(void* p, std::size_t bytes) = 0;
+};
+
+
+
+namespace detail {
+
+// heap bytes held by a container, for `memoryUsage()`..
+template <typename T>
+std::size_t heapBytes(const std::vector<T>& v) {
+    return v.capacity() * sizeof(T);
+}
+
+template <typename T>
+std::size_t heapBytes(const std::deque<T>& d) {
+    return d.size() * sizeof(T);
+}
+
+template <typename K, typename V>
+std::size_t heapBytes(const std::unordered_map<K, V>& m) {
+    // buckets, plus a node per element with its `next` link and cached hash
+    return m.bucket_count() * sizeof(void*) + m.size() * (sizeof(std::pair<const K, V>) + 2 * sizeof(void*));
+}
+
+
+template <typename Bin>
+class BinPool {
+public:
+    /**
+     * Chunked arena for bins.
+     * Chunks are never moved, so bin pointers stay valid until the pool is cleared,
+     * and `clear()` keeps the chunks for reuse rather than returning them.
+     *
+     * @private
+     * @class  BinPool
+     * @param  {BinAllocator*}  [allocator=nullptr]  Memory source, uses `operator new` if null
+     */
+    explicit BinPool(BinAllocator* allocator = nullptr) :
+        allocator_(allocator), chunk_(0), used_(0) { }
+
+    BinPool(const BinPool&) = delete;
+    BinPool& operator=(const BinPool&) = delete;
+
+    BinPool(BinPool&& other) noexcept :
+        allocator_(other.allocator_), chunks_(std::move(other.chunks_)),
+        spare_(std::move(other.spare_)), chunk_(other.chunk_), used_(other.used_) {
+        other.chunks_.clear();
+        other.spare_.clear();
+        other.chunk_ = other.used_ = 0;
+    }
+
+    BinPool& operator=(BinPool&& other) noexcept {
+        if (this != &other) {
+            release();
+            allocator_ = other.allocator_;
+            chunks_ = std::move(other.chunks_);
+            spare_ = std::move(other.spare_);
+            chunk_ = other.chunk_;
+            used_ = other.used_;
+            other.chunks_.clear();
+            other.spare_.clear();
+            other.chunk_ = other.used_ = 0;
+        }
+        return *this;
+    }
+
+    ~BinPool() { release(); }
 
-        if (maxw == -1) {
-            maxw = w;
+
+    /**
+     * Construct a new bin in the pool.
+     *
+     * @private
+     * @returns  {Bin*}     Pointer to the new bin, stable until `clear()`
+     */
+    template <typename... Args>
+    Bin* create(Args&&... args) {
+        if (!spare_.empty()) {
+            Bin* spare = spare_.back();
+            spare_.pop_back();
+            return new (spare) Bin(std::forward<Args>(args)...);
         }
-        if (maxh == -1) {
-            maxh = h;
+        if (chunk_ == chunks_.size() || used_ == chunks_[chunk_].capacity) {
+            if (chunk_ < chunks_.size()) {
+                chunk_++;
+                used_ = 0;
+            }
+            if (chunk_ == chunks_.size()) {
+                std::size_t capacity = (chunks_.size() < kGrowChunks) ?
+                    (kFirstChunk << chunks_.size()) : (kFirstChunk << kGrowChunks);
+                void* p = allocator_ ? allocator_->allocate(capacity * sizeof(Bin))
+                                     : ::operator new(capacity * sizeof(Bin));
+                chunks_.push_back(Chunk{ static_cast<Bin*>(p), capacity });
+            }
         }
+        return new (chunks_[chunk_].bins + used_++) Bin(std::forward<Args>(args)...);
     }
 
-    int32_t id;
-    int32_t w;
-    int32_t h;
-    int32_t maxw;
-    int32_t maxh;
-    int32_t x;
-    int32_t y;
 
-    int32_t refcount() const { return refcount_; }
+    /**
+     * Return a bin that is no longer referenced anywhere, so `create()` can reuse it.
+     *
+     * @private
+     * @param    {Bin*}   bin   Pointer to a bin created by this pool
+     */
+    void recycle(Bin* bin) {
+        spare_.push_back(bin);
+    }
+
+
+    /**
+     * Take back a bin given to `recycle()`, to undo it.
+     *
+     * @private
+     * @param    {Bin*}   bin   Pointer to a recycled bin, usually the last one
+     */
+    void reclaim(Bin* bin) {
+        auto it = std::find(spare_.rbegin(), spare_.rend(), bin);
+        spare_.erase(std::next(it).base());
+    }
+
+
+    /**
+     * Forget all bins, keeping the chunks for reuse.
+     *
+     * @private
+     */
+    void clear() {
+        spare_.clear();
+        chunk_ = used_ = 0;
+    }
+
+
+    /**
+     * Make sure there is room for `count` more bins without allocating.
+     *
+     * @private
+     * @param    {size_t}   count   Number of bins
+     */
+    void reserve(std::size_t count) {
+        std::size_t room = spare_.size();
+        for (std::size_t i = chunk_; i < chunks_.size(); i++) {
+            room += chunks_[i].capacity - (i == chunk_ ? used_ : 0);
+        }
+        if (room < count) {
+            std::size_t capacity = std::max(count - room, std::size_t(kFirstChunk));
+            void* p = allocator_ ? allocator_->allocate(capacity * sizeof(Bin))
+                                 : ::operator new(capacity * sizeof(Bin));
+            chunks_.push_back(Chunk{ static_cast<Bin*>(p), capacity });
+        }
+    }
+
+
+    /**
+     * Give back the chunks that hold no bins.
+     *
+     * @private
+     */
+    void shrinkToFit() {
+        std::size_t keep = (chunk_ == 0 && used_ == 0) ? 0 : chunk_ + 1;
+        if (keep == 0) {
+            spare_.clear();
+        }
+        for (std::size_t i = keep; i < chunks_.size(); i++) {
+            deallocate(chunks_[i]);
+        }
+        chunks_.resize(std::min(keep, chunks_.size()));
+        chunks_.shrink_to_fit();
+        spare_.shrink_to_fit();
+    }
+
+
+    std::size_t memoryUsage() const {
+        std::size_t bytes = heapBytes(chunks_) + heapBytes(spare_);
+        for (const auto& chunk : chunks_) {
+            bytes += chunk.capacity * sizeof(Bin);
+        }
+        return bytes;
+    }
 
 private:
+    static_assert(std::is_trivially_destructible<Bin>::value, "bins are released without destruction");
 
-    int32_t refcount_;
+    // chunks double in size from 256 bins up to 65536 bins
+    enum : std::size_t { kFirstChunk = 256, kGrowChunks = 8 };
+
+    struct Chunk {
+        Bin* bins;
+        std::size_t capacity;
+    };
+
+    void deallocate(const Chunk& chunk) {
+        if (allocator_) {
+            allocator_->deallocate(chunk.bins, chunk.capacity * sizeof(Bin));
+        } else {
+            ::operator delete(chunk.bins);
+        }
+    }
+
+    void release() {
+        for (const auto& chunk : chunks_) {
+            deallocate(chunk);
+        }
+        chunks_.clear();
+        spare_.clear();
+        chunk_ = used_ = 0;
+    }
+
+    BinAllocator* allocator_;
+    std::vector<Chunk> chunks_;
+    std::vector<Bin*> spare_;
+    std::size_t chunk_;
+    std::size_t used_;
 };
 
+}  // namespace detail
+
+
+
+template <typename Coord>
+class BasicShelf {
+    using Bin = BasicBin<Coord>;
 
-class Shelf {
 public:
     /**
      * Create a new Shelf.
@@ -80,14 +418,42 @@ public:
      * @example
      * Shelf shelf(64, 512, 24);
      */
-    explicit Shelf(int32_t y1, int32_t w1, int32_t h1) :
-        x_(0), y_(y1), w_(w1), h_(h1), wfree_(w1) { }
+    explicit BasicShelf(int32_t y1, int32_t w1, int32_t h1) :
+        x_(0), y_(y1), w_(w1), h_(h1),
+        ownPool_(new detail::BinPool<Bin>()), pool_(ownPool_.get()) { }
+
+
+    /**
+     * Create a new Shelf that stores its bins in a shared pool.
+     *
+     * @private
+     * @param  {int32_t}  y1     Top coordinate of the new shelf
+     * @param  {int32_t}  w1     Width of the new shelf
+     * @param  {int32_t}  h1     Height of the new shelf
+     * @param  {BinPool&} pool   Pool to allocate bins from, must outlive the shelf
+     */
+    explicit BasicShelf(int32_t y1, int32_t w1, int32_t h1, detail::BinPool<Bin>& pool) :
+        x_(0), y_(y1), w_(w1), h_(h1), pool_(&pool) { }
+
+
+    /**
+     * Create a new Shelf that stores its bins in a shared pool, and takes its width from a sprite.
+     * Resizing the sprite resizes the shelf without touching it.
+     *
+     * @private
+     * @param  {int32_t}  y1      Top coordinate of the new shelf
+     * @param  {int32_t*} width   Width of the sprite, must outlive the shelf
+     * @param  {int32_t}  h1      Height of the new shelf
+     * @param  {BinPool&} pool    Pool to allocate bins from, must outlive the shelf
+     */
+    explicit BasicShelf(int32_t y1, const int32_t* width, int32_t h1, detail::BinPool<Bin>& pool) :
+        x_(0), y_(y1), w_(*width), h_(h1), width_(width), pool_(&pool) { }
 
 
     /**
      * Allocate a single bin into the shelf.
-     * Bin is stored in a `bins_` container.
-     * Returned pointer is stable until the shelf is destroyed.
+     * Bin is stored in the shelf's bin pool (owned by the `ShelfPack`, if any).
+     * Returned pointer is stable until the shelf is destroyed, or its `ShelfPack` is cleared.
      *
      * @param    {int32_t}  id    Unique bin identifier, pass -1 to generate a new one
      * @param    {int32_t}  w1     Width of the bin to allocate
@@ -98,19 +464,18 @@ public:
      * Bin* result = shelf.alloc(-1, 12, 16);
      */
     Bin* alloc(int32_t id, int32_t w1, int32_t h1) {
-        if (w1 > wfree_ || h1 > h_) {
+        if (w1 > wfree() || h1 > h_) {
             return nullptr;
         }
         int32_t x1 = x_;
         x_ += w1;
-        wfree_ -= w1;
-        bins_.emplace_back(id, w1, h1, w1, h_, x1, y_);
-        return &bins_.back();
+        return pool_->create(id, w1, h1, w1, h_, x1, y_);
     }
 
 
     /**
      * Resize the shelf.
+     * Shelves of a `ShelfPack` take the sprite's width, and are resized with the sprite instead.
      *
      * @param    {int32_t}  w1  Requested new width of the shelf
      * @returns  {bool}     `true` if resize succeeded, `false` if failed
@@ -119,355 +484,3469 @@ public:
      * shelf.resize(512);
      */
     bool resize(int32_t w1) {
-        wfree_ += (w1 - w_);
+        if (width_) {
+            return false;
+        }
         w_ = w1;
         return true;
     }
 
     int32_t x() const { return x_; }
     int32_t y() const { return y_; }
-    int32_t w() const { return w_; }
+    int32_t w() const { return width_ ? *width_ : w_; }
     int32_t h() const { return h_; }
-    int32_t wfree() const { return wfree_; }
+    int32_t wfree() const { return w() - x_; }
 
 private:
+    template <typename, typename> friend class BasicShelfPack;
+    friend class ConcurrentShelfPack;
+
     int32_t x_;
     int32_t y_;
     int32_t w_;
     int32_t h_;
-    int32_t wfree_;
+    const int32_t* width_ = nullptr;   // width of the sprite the shelf belongs to, if any
+    std::size_t slot_ = 0;
 
-    std::deque<Bin> bins_;
+    std::unique_ptr<detail::BinPool<Bin>> ownPool_;
+    detail::BinPool<Bin>* pool_;
 };
 
+using Shelf = BasicShelf<int32_t>;
 
 
-class ShelfPack {
-public:
 
-    struct ShelfPackOptions {
-        inline ShelfPackOptions() : autoResize(false) { };
-        bool autoResize;
-    };
+namespace detail {
 
-    struct PackOptions {
-        inline PackOptions() : inPlace(false) { };
-        bool inPlace;
-    };
+/**
+ * Return the index of the first of `n` values that is at most `limit`, or `n` if none is.
+ * This is the scalar version of `findAtMost()`.
+ *
+ * @private
+ * @param    {int32_t*}  values  Array of values
+ * @param    {size_t}    n       Number of values
+ * @param    {int32_t}   limit   Largest acceptable value
+ * @returns  {size_t}    Index of the first acceptable value
+ */
+inline std::size_t findAtMostScalar(const int32_t* values, std::size_t n, int32_t limit) {
+    std::size_t i = 0;
+    while (i < n && values[i] > limit) {
+        i++;
+    }
+    return i;
+}
+
+
+/**
+ * Return the index of the first of `n` values that is at most `limit`, or `n` if none is.
+ * Skips 16 values per step with SSE2, AVX2 or NEON compares when the compiler targets them,
+ * then finishes the last few values, or the block holding the match, with the scalar loop.
+ *
+ * @private
+ * @param    {int32_t*}  values  Array of values
+ * @param    {size_t}    n       Number of values
+ * @param    {int32_t}   limit   Largest acceptable value
+ * @returns  {size_t}    Index of the first acceptable value
+ */
+inline std::size_t findAtMost(const int32_t* values, std::size_t n, int32_t limit) {
+    std::size_t i = 0;
+#if defined(SHELF_PACK_AVX2)
+    const __m256i l = _mm256_set1_epi32(limit);
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_cmpgt_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i)), l);
+        __m256i b = _mm256_cmpgt_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i + 8)), l);
+        if (_mm256_movemask_epi8(_mm256_and_si256(a, b)) != -1) {
+            break;
+        }
+    }
+#elif defined(SHELF_PACK_SSE2)
+    const __m128i l = _mm_set1_epi32(limit);
+    for (; i + 16 <= n; i += 16) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(values + i);
+        __m128i a = _mm_and_si128(_mm_cmpgt_epi32(_mm_loadu_si128(p), l), _mm_cmpgt_epi32(_mm_loadu_si128(p + 1), l));
+        __m128i b = _mm_and_si128(_mm_cmpgt_epi32(_mm_loadu_si128(p + 2), l), _mm_cmpgt_epi32(_mm_loadu_si128(p + 3), l));
+        if (_mm_movemask_epi8(_mm_and_si128(a, b)) != 0xffff) {
+            break;
+        }
+    }
+#elif defined(SHELF_PACK_NEON)
+    const int32x4_t l = vdupq_n_s32(limit);
+    for (; i + 16 <= n; i += 16) {
+        uint32x4_t a = vandq_u32(vcgtq_s32(vld1q_s32(values + i), l), vcgtq_s32(vld1q_s32(values + i + 4), l));
+        uint32x4_t b = vandq_u32(vcgtq_s32(vld1q_s32(values + i + 8), l), vcgtq_s32(vld1q_s32(values + i + 12), l));
+        uint32x4_t all = vandq_u32(a, b);
+        uint32x2_t half = vand_u32(vget_low_u32(all), vget_high_u32(all));
+        if ((vget_lane_u32(half, 0) & vget_lane_u32(half, 1)) != 0xffffffffu) {
+            break;
+        }
+    }
+#endif
+    return i + findAtMostScalar(values + i, n - i, limit);
+}
 
 
+/**
+ * Return the smallest of `n` values, or INT32_MAX if `n` is 0.
+ * Reduces 16 values per step with AVX2, or 8 with NEON, when the compiler targets them.
+ * SSE2 has no 32-bit min, so there the plain loop is left to the compiler.
+ *
+ * @private
+ * @param    {int32_t*}  values  Array of values
+ * @param    {size_t}    n       Number of values
+ * @returns  {int32_t}   Smallest value
+ */
+inline int32_t minOf(const int32_t* values, std::size_t n) {
+    int32_t result = std::numeric_limits<int32_t>::max();
+    std::size_t i = 0;
+#if defined(SHELF_PACK_AVX2)
+    __m256i a = _mm256_set1_epi32(result), b = a;
+    for (; i + 16 <= n; i += 16) {
+        a = _mm256_min_epi32(a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i)));
+        b = _mm256_min_epi32(b, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i + 8)));
+    }
+    alignas(32) int32_t lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_min_epi32(a, b));
+    result = *std::min_element(lanes, lanes + 8);
+#elif defined(SHELF_PACK_NEON)
+    int32x4_t a = vdupq_n_s32(result), b = a;
+    for (; i + 8 <= n; i += 8) {
+        a = vminq_s32(a, vld1q_s32(values + i));
+        b = vminq_s32(b, vld1q_s32(values + i + 4));
+    }
+    int32_t lanes[4];
+    vst1q_s32(lanes, vminq_s32(a, b));
+    result = *std::min_element(lanes, lanes + 4);
+#endif
+    for (; i < n; i++) {
+        result = std::min(values[i], result);
+    }
+    return result;
+}
+
+template <typename Shelf>
+class ShelfBucket {
+public:
     /**
-     * Create a new ShelfPack bin allocator.
-     *
-     * Uses the Shelf Best Height Fit algorithm from
-     * http://clb.demon.fi/files/RectangleBinPack.pdf
-     *
-     * @class  ShelfPack
-     * @param  {int32_t}  [w=64]  Initial width of the sprite
-     * @param  {int32_t}  [h=64]  Initial width of the sprite
-     * @param  {ShelfPackOptions}  [options]
-     * @param  {bool} [options.autoResize=false]  If `true`, the sprite will automatically grow
+     * Index of all shelves sharing a single height.
+     * Shelves are kept in top-to-bottom order, and a min-tree over their `x`
+     * coordinates finds the topmost shelf with enough room in O(log n).
      *
-     * @example
-     * ShelfPack::ShelfPackOptions options;
-     * options.autoResize = false;
-     * ShelfPack sprite = new ShelfPack(64, 64, options);
+     * @private
+     * @class  ShelfBucket
+     * @param  {int32_t}  h1   Height of the shelves in this bucket
      */
-    explicit ShelfPack(int32_t w = 0, int32_t h = 0, const ShelfPackOptions &options = ShelfPackOptions{}) {
-        width_ = w > 0 ? w : 64;
-        height_ = h > 0 ? h : 64;
-        autoResize_ = options.autoResize;
-        maxId_ = 0;
-    }
+    explicit ShelfBucket(int32_t h1) : h_(h1) { }
 
 
     /**
-     * Batch pack multiple bins into the sprite.
-     *
-     * @param   {vector<Bin>}   bins   Array of requested bins - each object should have `w`, `h` values
-     * @param   {PackOptions}   [options]
-     * @param   {bool} [options.inPlace=false] If `true`, the supplied bin objects will be updated inplace with `x` and `y` values
-     * @returns {vector<Bin*>}   Array of Bin pointers - each bin is a struct with `x`, `y`, `w`, `h` values
-     *
-     * @example
-     * std::vector<Bin> moreBins;
-     * moreBins.emplace_back(-1, 12, 24);
-     * moreBins.emplace_back(-1, 12, 12);
-     * moreBins.emplace_back(-1, 10, 10);
+     * Append a shelf to the bucket.  It must be below all shelves already in it.
      *
-     * ShelfPack::PackOptions options;
-     * options.inPlace = true;
-     * std::vector<Bin*> results = sprite.pack(moreBins, options);
+     * @private
+     * @param    {Shelf*}   shelf  Pointer to the shelf, must have height `h()`
+     * @returns  {size_t}   Slot of the shelf in the bucket, used by `update()`
      */
-    std::vector<Bin*> pack(std::vector<Bin> &bins, const PackOptions &options = PackOptions{}) {
-        std::vector<Bin*> results;
-
-        for (auto& bin : bins) {
-            if (bin.w > 0 && bin.h > 0) {
-                Bin* allocation = packOne(bin.id, bin.w, bin.h);
-                if (!allocation) {
-                    continue;
-                }
-                if (options.inPlace) {
-                    bin.id = allocation->id;
-                    bin.x = allocation->x;
-                    bin.y = allocation->y;
-                }
-                results.push_back(allocation);
+    std::size_t push(Shelf* shelf) {
+        std::size_t slot = shelves_.size();
+        if (slot == leaves_) {
+            leaves_ = leaves_ ? leaves_ * 2 : 4;
+            tree_.assign(leaves_ * 2, std::numeric_limits<int32_t>::max());
+            for (std::size_t i = 0; i < slot; i++) {
+                tree_[leaves_ + i] = shelves_[i]->x();
+            }
+            for (std::size_t i = leaves_ - 1; i > 0; i--) {
+                tree_[i] = std::min(tree_[i * 2], tree_[i * 2 + 1]);
             }
         }
-
-        shrink();
-
-        return results;
+        shelves_.push_back(shelf);
+        update(slot);
+        return slot;
     }
 
 
     /**
-     * Pack a single bin into the sprite.
+     * Remove the last shelf from the bucket, i.e. the bottom one.
      *
-     * @param   {int32_t}  id     Unique bin identifier, pass -1 to generate a new one
-     * @param   {int32_t}  w      Width of the bin to allocate
-     * @param   {int32_t}  h      Height of the bin to allocate
-     * @returns {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members
-     *
-     * @example
-     * Bin* result = sprite.packOne(-1, 12, 16);
+     * @private
      */
-    Bin* packOne(int32_t id, int32_t w, int32_t h) {
-        int32_t y = 0;
-        int32_t waste = 0;
-        struct {
-            Shelf* pshelf = nullptr;
-            Bin* pfreebin = nullptr;
-            int32_t waste = std::numeric_limits<std::int32_t>::max();
-        } best;
-
-        // if id was supplied, attempt a lookup..
-        if (id != -1) {
-            Bin* pbin = getBin(id);
-            if (pbin) {   // we packed this bin already
-                ref(*pbin);
-                return pbin;
-            }
-            maxId_ = std::max(id, maxId_);
-        } else {
-            id = ++maxId_;
+    void pop() {
+        shelves_.pop_back();
+        std::size_t i = leaves_ + shelves_.size();
+        tree_[i] = std::numeric_limits<int32_t>::max();
+        for (i /= 2; i > 0; i /= 2) {
+            tree_[i] = std::min(tree_[i * 2], tree_[i * 2 + 1]);
         }
+    }
 
-        // First try to reuse a free bin..
-        for (auto& freebin : freebins_) {
-            // exactly the right height and width, use it..
-            if (h == freebin->maxh && w == freebin->maxw) {
-                return allocFreebin(freebin, id, w, h);
-            }
-            // not enough height or width, skip it..
-            if (h > freebin->maxh || w > freebin->maxw) {
-                continue;
-            }
-            // extra height or width, minimize wasted area..
-            if (h <= freebin->maxh && w <= freebin->maxw) {
-                waste = (freebin->maxw * freebin->maxh) - (w * h);
-                if (waste < best.waste) {
-                    best.waste = waste;
-                    best.pfreebin = freebin;
-                }
-            }
+
+    /**
+     * Refresh the index after the shelf in `slot` has allocated a bin.
+     *
+     * @private
+     * @param    {size_t}   slot   Slot returned by `push()`
+     */
+    void update(std::size_t slot) {
+        std::size_t i = leaves_ + slot;
+        tree_[i] = shelves_[slot]->x();
+        for (i /= 2; i > 0; i /= 2) {
+            tree_[i] = std::min(tree_[i * 2], tree_[i * 2 + 1]);
         }
+    }
 
-        // Next find the best shelf
-        for (auto& shelf : shelves_) {
-            y += shelf.h();
 
-            // not enough width on this shelf, skip it..
-            if (w > shelf.wfree()) {
-                continue;
-            }
-            // exactly the right height, pack it..
-            if (h == shelf.h()) {
-                return allocShelf(shelf, id, w, h);
-            }
-            // not enough height, skip it..
-            if (h > shelf.h()) {
-                continue;
+    /**
+     * Find the topmost shelf whose `x` is at most `maxx`.
+     *
+     * @private
+     * @param    {int32_t}  maxx   Largest acceptable `x`, i.e. `width - w`
+     * @returns  {Shelf*}   Pointer to the shelf, or nullptr if none has room
+     */
+    Shelf* find(int32_t maxx) const {
+        if (shelves_.empty() || tree_[1] > maxx) {
+            return nullptr;
+        }
+        std::size_t i = 1;
+        while (i < leaves_) {
+            i = (tree_[i * 2] <= maxx) ? i * 2 : i * 2 + 1;
+        }
+        return shelves_[i - leaves_];
+    }
+
+
+    /**
+     * Return the smallest `x` of the shelves in the bucket, i.e. the most room left.
+     *
+     * @private
+     * @returns  {int32_t}  Smallest `x`, or INT32_MAX if the bucket is empty
+     */
+    int32_t minx() const {
+        return shelves_.empty() ? std::numeric_limits<int32_t>::max() : tree_[1];
+    }
+
+    int32_t h() const { return h_; }
+    bool empty() const { return shelves_.empty(); }
+
+    void shrinkToFit() {
+        shelves_.shrink_to_fit();
+        tree_.shrink_to_fit();
+    }
+
+    std::size_t memoryUsage() const { return heapBytes(shelves_) + heapBytes(tree_); }
+
+private:
+    int32_t h_;
+    std::size_t leaves_ = 0;
+    std::vector<Shelf*> shelves_;
+    std::vector<int32_t> tree_;
+};
+
+
+
+template <typename Shelf>
+class ShelfBuckets {
+public:
+    /**
+     * Index of all shelves of a sprite, as one `ShelfBucket` per shelf height.
+     * The bucket heights, and the smallest `x` in each bucket, are also kept in
+     * parallel arrays ordered by height.  Searching for the shortest bucket with
+     * room streams through those arrays, and only visits the bucket it picks.
+     *
+     * Buckets whose shelves all have `x` above `limit()`, so that none has room for
+     * the narrowest bin, are retired from the arrays into a hash map, and are not searched.
+     * They come back once a shelf's `x` drops, or the limit is raised.
+     *
+     * @private
+     * @class  ShelfBuckets
+     */
+    ShelfBuckets() { }
+
+
+    /**
+     * Add a shelf to the bucket for its height.  It must be below all shelves of that height.
+     *
+     * @private
+     * @param    {Shelf*}   shelf  Pointer to the shelf
+     * @returns  {size_t}   Slot of the shelf in its bucket, used by `update()`
+     */
+    std::size_t push(Shelf* shelf) {
+        std::size_t i = lowerBound(shelf->h());
+        if (i == heights_.size() || heights_[i] != shelf->h()) {
+            auto it = retired_.find(shelf->h());
+            if (it != retired_.end()) {
+                restore(i, it);
+            } else {
+                insert(i, ShelfBucket<Shelf>(shelf->h()));
+            }
+        }
+        std::size_t slot = buckets_[i].push(shelf);
+        minx_[i] = buckets_[i].minx();
+        return slot;
+    }
+
+
+    /**
+     * Refresh the index after a shelf's `x` has changed.
+     *
+     * @private
+     * @param    {int32_t}  h      Height of the shelf
+     * @param    {size_t}   slot   Slot returned by `push()`
+     */
+    void update(int32_t h, std::size_t slot) {
+        std::size_t i = lowerBound(h);
+        if (i < heights_.size() && heights_[i] == h) {
+            buckets_[i].update(slot);
+            minx_[i] = buckets_[i].minx();
+            if (minx_[i] > limit_) {
+                retire(i);
+            }
+        } else {
+            auto it = retired_.find(h);
+            it->second.update(slot);
+            if (it->second.minx() <= limit_) {
+                restore(i, it);
+            }
+        }
+    }
+
+
+    /**
+     * Remove the bottom shelf of height `h`.  Its bucket is removed once empty.
+     *
+     * @private
+     * @param    {int32_t}  h      Height of the shelf
+     */
+    void pop(int32_t h) {
+        std::size_t i = lowerBound(h);
+        if (i < heights_.size() && heights_[i] == h) {
+            buckets_[i].pop();
+            minx_[i] = buckets_[i].minx();
+            if (buckets_[i].empty()) {
+                erase(i);
+            } else if (minx_[i] > limit_) {
+                retire(i);
+            }
+        } else {
+            auto it = retired_.find(h);
+            it->second.pop();
+            if (it->second.empty()) {
+                retired_.erase(it);
+            }
+        }
+    }
+
+
+    /**
+     * Find the topmost shelf with `x` at most `maxx`, either among the shelves of
+     * height `h`, or among the shelves of the shortest taller height that has one.
+     * Retired buckets are skipped, so `maxx` must not be above `limit()`.
+     *
+     * @private
+     * @param    {int32_t}  h        Height of the bin
+     * @param    {int32_t}  maxx     Largest acceptable `x`, i.e. `width - w`
+     * @param    {bool}     exact    If `true` only look at height `h`, otherwise only taller ones
+     * @param    {size_t*}  [scanned=nullptr]  If set, incremented by the number of buckets visited
+     * @returns  {Shelf*}   Pointer to the shelf, or nullptr if none has room
+     */
+    Shelf* find(int32_t h, int32_t maxx, bool exact, std::size_t* scanned = nullptr) const {
+        std::size_t i = lowerBound(h);
+        std::size_t n = heights_.size();
+        if (exact) {
+            if (i == n || heights_[i] != h) {
+                return nullptr;
+            }
+            n = i + 1;
+        } else if (i < n && heights_[i] == h) {
+            i++;
+        }
+
+        std::size_t first = i;
+        i += findAtMost(minx_.data() + i, n - i, maxx);
+        if (scanned) {
+            *scanned += std::min(i + 1, n) - first;
+        }
+        return (i < n) ? buckets_[i].find(maxx) : nullptr;
+    }
+
+
+    /**
+     * Return the smallest `x` among the shelves of height `h` or taller, retired or not.
+     *
+     * @private
+     * @param    {int32_t}  h      Height of the bin
+     * @returns  {int32_t}  Smallest `x`, or INT32_MAX if there are no such shelves
+     */
+    int32_t minx(int32_t h) const {
+        std::size_t i = lowerBound(h);
+        int32_t result = minOf(minx_.data() + i, minx_.size() - i);
+        for (const auto& retired : retired_) {
+            if (retired.first >= h) {
+                result = std::min(retired.second.minx(), result);
+            }
+        }
+        return result;
+    }
+
+
+    /**
+     * Set the largest `x` a shelf can have and still be searched.  Raising the limit
+     * brings back the retired buckets that are now in reach, lowering it retires
+     * the buckets that are out of reach.
+     *
+     * @private
+     * @param    {int32_t}  maxx   Largest useful `x`, i.e. `width - narrowest bin`
+     */
+    void limit(int32_t maxx) {
+        if (maxx > limit_) {
+            for (auto it = retired_.begin(); it != retired_.end(); ) {
+                auto next = std::next(it);
+                if (it->second.minx() <= maxx) {
+                    restore(lowerBound(it->first), it);
+                }
+                it = next;
+            }
+        } else if (maxx < limit_) {
+            // one pass over the arrays, rather than an erase per retired bucket..
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < heights_.size(); i++) {
+                if (minx_[i] > maxx) {
+                    retired_.emplace(heights_[i], std::move(buckets_[i]));
+                } else {
+                    if (kept != i) {
+                        heights_[kept] = heights_[i];
+                        minx_[kept] = minx_[i];
+                        buckets_[kept] = std::move(buckets_[i]);
+                    }
+                    kept++;
+                }
+            }
+            heights_.resize(kept);
+            minx_.resize(kept);
+            buckets_.erase(buckets_.begin() + std::ptrdiff_t(kept), buckets_.end());
+        }
+        limit_ = maxx;
+    }
+
+    int32_t limit() const { return limit_; }
+    std::size_t retired() const { return retired_.size(); }
+
+    void clear() {
+        heights_.clear();
+        minx_.clear();
+        buckets_.clear();
+        retired_.clear();
+    }
+
+    void reserve(std::size_t heights) {
+        heights_.reserve(heights);
+        minx_.reserve(heights);
+        buckets_.reserve(heights);
+    }
+
+    void shrinkToFit() {
+        heights_.shrink_to_fit();
+        minx_.shrink_to_fit();
+        buckets_.shrink_to_fit();
+        for (auto& bucket : buckets_) {
+            bucket.shrinkToFit();
+        }
+        for (auto& retired : retired_) {
+            retired.second.shrinkToFit();
+        }
+        retired_.rehash(0);
+    }
+
+    std::size_t memoryUsage() const {
+        std::size_t bytes = heapBytes(heights_) + heapBytes(minx_) + heapBytes(buckets_) + heapBytes(retired_);
+        for (const auto& bucket : buckets_) {
+            bytes += bucket.memoryUsage();
+        }
+        for (const auto& retired : retired_) {
+            bytes += retired.second.memoryUsage();
+        }
+        return bytes;
+    }
+
+private:
+    std::size_t lowerBound(int32_t h) const {
+        return std::size_t(std::lower_bound(heights_.begin(), heights_.end(), h) - heights_.begin());
+    }
+
+    void insert(std::size_t i, ShelfBucket<Shelf> bucket) {
+        heights_.insert(heights_.begin() + std::ptrdiff_t(i), bucket.h());
+        minx_.insert(minx_.begin() + std::ptrdiff_t(i), bucket.minx());
+        buckets_.insert(buckets_.begin() + std::ptrdiff_t(i), std::move(bucket));
+    }
+
+    void erase(std::size_t i) {
+        heights_.erase(heights_.begin() + std::ptrdiff_t(i));
+        minx_.erase(minx_.begin() + std::ptrdiff_t(i));
+        buckets_.erase(buckets_.begin() + std::ptrdiff_t(i));
+    }
+
+    void retire(std::size_t i) {
+        retired_.emplace(heights_[i], std::move(buckets_[i]));
+        erase(i);
+    }
+
+    void restore(std::size_t i, typename std::unordered_map<int32_t, ShelfBucket<Shelf>>::iterator it) {
+        insert(i, std::move(it->second));
+        retired_.erase(it);
+    }
+
+    std::vector<int32_t> heights_;
+    std::vector<int32_t> minx_;
+    std::vector<ShelfBucket<Shelf>> buckets_;
+    std::unordered_map<int32_t, ShelfBucket<Shelf>> retired_;
+    int32_t limit_ = std::numeric_limits<int32_t>::max();
+};
+
+
+
+template <typename Bin>
+class FreebinIndex {
+public:
+    /**
+     * Index of the free bins, bucketed by size class (`maxw` x `maxh`).
+     * Each size class is an intrusive list of bins, oldest first, so exact size
+     * matches and removals are O(1).  Non-empty size classes are also kept in rows
+     * ordered by `maxh` then `maxw`, so the least wasteful fit only visits one
+     * size class per row, and stops as soon as a row cannot beat the best area.
+     * Row heights and each row's widths are plain arrays, so the binary searches
+     * stream through contiguous memory rather than size classes.
+     *
+     * Ties between equally wasteful bins go to the bin that was freed first.
+     *
+     * @private
+     * @class  FreebinIndex
+     */
+    FreebinIndex() : size_(0), stamp_(0) { }
+
+
+    /**
+     * Add a bin to the index.
+     *
+     * @private
+     * @param    {Bin*}   bin   Pointer to a bin with a refcount of 0
+     */
+    void push(Bin* bin) {
+        SizeClass& sc = classFor(bin->maxw, bin->maxh);
+        bin->freeStamp_ = stamp_++;
+        bin->prevFree_ = sc.tail;
+        bin->nextFree_ = nullptr;
+        if (sc.tail) {
+            sc.tail->nextFree_ = bin;
+        } else {
+            sc.head = bin;
+            link(sc);
+        }
+        sc.tail = bin;
+        size_++;
+    }
+
+
+    /**
+     * Remove a bin from the index.
+     *
+     * @private
+     * @param    {Bin*}   bin   Pointer to a bin previously added with `push()`
+     */
+    void erase(Bin* bin) {
+        SizeClass& sc = classes_[lookup_.find(key(bin->maxw, bin->maxh))->second];
+        if (bin->prevFree_) {
+            bin->prevFree_->nextFree_ = bin->nextFree_;
+        } else {
+            sc.head = bin->nextFree_;
+        }
+        if (bin->nextFree_) {
+            bin->nextFree_->prevFree_ = bin->prevFree_;
+        } else {
+            sc.tail = bin->prevFree_;
+        }
+        bin->prevFree_ = bin->nextFree_ = nullptr;
+        if (!sc.head) {
+            unlink(sc);
+        }
+        size_--;
+    }
+
+
+    /**
+     * Put an erased bin back where it was, to undo `erase()`.
+     * Only valid while the bins around it are as they were when it was erased.
+     *
+     * @private
+     * @param    {Bin*}      bin     Pointer to the bin, with its `maxw` and `maxh` as they were
+     * @param    {Bin*}      prev    Bin before it in its size class, or nullptr
+     * @param    {Bin*}      next    Bin after it in its size class, or nullptr
+     * @param    {uint32_t}  stamp1  Its stamp as it was
+     */
+    void restore(Bin* bin, Bin* prev, Bin* next, uint32_t stamp1) {
+        SizeClass& sc = classFor(bin->maxw, bin->maxh);
+        bool relink = !sc.head;
+        bin->freeStamp_ = stamp1;
+        bin->prevFree_ = prev;
+        bin->nextFree_ = next;
+        if (prev) {
+            prev->nextFree_ = bin;
+        } else {
+            sc.head = bin;
+        }
+        if (next) {
+            next->prevFree_ = bin;
+        } else {
+            sc.tail = bin;
+        }
+        if (relink) {
+            link(sc);
+        }
+        size_++;
+    }
+
+
+    /**
+     * Find the free bin that fits `w` x `h` with the least wasted area.
+     * An exact size match, if any, is always the least wasteful.
+     *
+     * @private
+     * @param    {int32_t}  w   Width of the bin to allocate
+     * @param    {int32_t}  h   Height of the bin to allocate
+     * @param    {size_t*}  [scanned=nullptr]  If set, incremented by the number of size classes visited
+     * @returns  {Bin*}     Pointer to the free bin, or nullptr if none fits
+     */
+    Bin* find(int32_t w, int32_t h, std::size_t* scanned = nullptr) const {
+        Bin* best = nullptr;
+        int64_t bestArea = std::numeric_limits<int64_t>::max();
+
+        std::size_t r = rowFor(h);
+        for (; r < rowHeights_.size(); r++) {
+            // every bin in this row and beyond is at least `maxh * w`..
+            if (int64_t(rowHeights_[r]) * w > bestArea) {
+                break;
+            }
+            const Row& row = rows_[r];
+            std::size_t k = std::size_t(std::lower_bound(row.widths.begin(), row.widths.end(), w) - row.widths.begin());
+            if (k == row.widths.size()) {
+                continue;
+            }
+            if (scanned) {
+                (*scanned)++;
+            }
+            const SizeClass& sc = classes_[row.classes[k]];
+            int64_t area = int64_t(sc.maxw) * sc.maxh;
+            if (area < bestArea || (area == bestArea && older(sc.head, best))) {
+                bestArea = area;
+                best = sc.head;
+            }
+        }
+
+        return best;
+    }
+
+
+    /**
+     * Find the oldest bin of at least `w` x `h`, whatever the waste.
+     * Visits every non-empty size class that fits, and compares the oldest bin of each.
+     *
+     * @private
+     * @param    {int32_t}  w   Smallest `maxw`
+     * @param    {int32_t}  h   Smallest `maxh`
+     * @returns  {Bin*}     Pointer to the bin, or nullptr if none fits
+     */
+    Bin* oldest(int32_t w, int32_t h) const {
+        Bin* best = nullptr;
+        for (std::size_t r = rowFor(h); r < rowHeights_.size(); r++) {
+            const Row& row = rows_[r];
+            std::size_t k = std::size_t(std::lower_bound(row.widths.begin(), row.widths.end(), w) - row.widths.begin());
+            for (; k < row.classes.size(); k++) {
+                Bin* head = classes_[row.classes[k]].head;
+                if (!best || older(head, best)) {
+                    best = head;
+                }
+            }
+        }
+        return best;
+    }
+
+
+    /**
+     * Sort free bins of this index oldest first, the order `find()` prefers them in.
+     * Pushing them in this order into an empty index keeps that order.
+     *
+     * @private
+     * @param    {vector<Bin*>}   bins   Free bins in this index
+     */
+    void sortByAge(std::vector<Bin*> &bins) const {
+        std::sort(bins.begin(), bins.end(), [this](const Bin* a, const Bin* b) {
+            return uint32_t(stamp_ - a->freeStamp_) > uint32_t(stamp_ - b->freeStamp_);
+        });
+    }
+
+
+    /**
+     * Call `fn(Bin*)` for every free bin.  `fn` must not modify the index.
+     *
+     * @private
+     * @param    {function}   fn   Called with a pointer to each free bin
+     */
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (const auto& sc : classes_) {
+            for (Bin* bin = sc.head; bin; bin = bin->nextFree_) {
+                fn(bin);
+            }
+        }
+    }
+
+
+    /**
+     * Remove all bins from the index.
+     *
+     * @private
+     */
+    void clear() {
+        classes_.clear();
+        lookup_.clear();
+        rowHeights_.clear();
+        rows_.clear();
+        size_ = 0;
+        stamp_ = 0;
+    }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // the stamp of the next pushed bin, which can be set back to undo pushes..
+    uint32_t stamp() const { return stamp_; }
+    void rewind(uint32_t stamp1) { stamp_ = stamp1; }
+
+    void shrinkToFit() {
+        classes_.shrink_to_fit();
+        lookup_.rehash(0);
+        rowHeights_.shrink_to_fit();
+        rows_.shrink_to_fit();
+        for (auto& row : rows_) {
+            row.widths.shrink_to_fit();
+            row.classes.shrink_to_fit();
+        }
+    }
+
+    std::size_t memoryUsage() const {
+        std::size_t bytes = heapBytes(classes_) + heapBytes(lookup_) + heapBytes(rowHeights_) + heapBytes(rows_);
+        for (const auto& row : rows_) {
+            bytes += heapBytes(row.widths) + heapBytes(row.classes);
+        }
+        return bytes;
+    }
+
+private:
+    struct SizeClass {
+        int32_t maxw;
+        int32_t maxh;
+        Bin* head;
+        Bin* tail;
+    };
+
+    // non-empty size classes of one `maxh`, ordered by `maxw`
+    struct Row {
+        std::vector<int32_t> widths;    // `maxw` of each size class
+        std::vector<int32_t> classes;   // index of each size class in `classes_`
+    };
+
+    static uint64_t key(int32_t maxw, int32_t maxh) {
+        return (uint64_t(uint32_t(maxw)) << 32) | uint32_t(maxh);
+    }
+
+    // stamps wrap around, compare them as serial numbers..
+    static bool older(const Bin* a, const Bin* b) {
+        return int32_t(a->freeStamp_ - b->freeStamp_) < 0;
+    }
+
+    SizeClass& classFor(int32_t maxw, int32_t maxh) {
+        auto inserted = lookup_.emplace(key(maxw, maxh), int32_t(classes_.size()));
+        if (inserted.second) {
+            classes_.push_back(SizeClass{ maxw, maxh, nullptr, nullptr });
+        }
+        return classes_[inserted.first->second];
+    }
+
+    std::size_t rowFor(int32_t maxh) const {
+        return std::size_t(std::lower_bound(rowHeights_.begin(), rowHeights_.end(), maxh) - rowHeights_.begin());
+    }
+
+    void link(const SizeClass& sc) {
+        std::size_t r = rowFor(sc.maxh);
+        if (r == rowHeights_.size() || rowHeights_[r] != sc.maxh) {
+            rowHeights_.insert(rowHeights_.begin() + std::ptrdiff_t(r), sc.maxh);
+            rows_.insert(rows_.begin() + std::ptrdiff_t(r), Row{});
+        }
+        Row& row = rows_[r];
+        auto it = std::lower_bound(row.widths.begin(), row.widths.end(), sc.maxw);
+        row.classes.insert(row.classes.begin() + (it - row.widths.begin()), lookup_.find(key(sc.maxw, sc.maxh))->second);
+        row.widths.insert(it, sc.maxw);
+    }
+
+    void unlink(const SizeClass& sc) {
+        std::size_t r = rowFor(sc.maxh);
+        Row& row = rows_[r];
+        auto it = std::lower_bound(row.widths.begin(), row.widths.end(), sc.maxw);
+        row.classes.erase(row.classes.begin() + (it - row.widths.begin()));
+        row.widths.erase(it);
+        if (row.widths.empty()) {
+            rowHeights_.erase(rowHeights_.begin() + std::ptrdiff_t(r));
+            rows_.erase(rows_.begin() + std::ptrdiff_t(r));
+        }
+    }
+
+    std::vector<SizeClass> classes_;
+    std::unordered_map<uint64_t, int32_t> lookup_;
+    std::vector<int32_t> rowHeights_;
+    std::vector<Row> rows_;
+    std::size_t size_;
+    uint32_t stamp_;
+};
+
+
+
+template <typename Bin>
+class BinLru {
+public:
+    /**
+     * Index of the bins that are still packed but no longer referenced, least recently
+     * used first.  Kept in a `FreebinIndex` by size class, each class oldest first, and
+     * linked through the bins' free bin links, which packed bins do not use.  Finding the
+     * least recently used bin of at least some size only visits the size classes that fit,
+     * rather than every unused bin.
+     *
+     * @private
+     * @class  BinLru
+     */
+    BinLru() { }
+
+
+    void push(Bin* bin) {
+        index_.push(bin);
+    }
+
+
+    void erase(Bin* bin) {
+        index_.erase(bin);
+    }
+
+
+    /**
+     * Put an erased bin back where it was, to undo `erase()`.
+     *
+     * @private
+     * @param    {Bin*}      bin     Pointer to the bin
+     * @param    {Bin*}      prev    Bin before it in its size class, or nullptr
+     * @param    {Bin*}      next    Bin after it in its size class, or nullptr
+     * @param    {uint32_t}  stamp1  Its stamp as it was
+     */
+    void restore(Bin* bin, Bin* prev, Bin* next, uint32_t stamp1) {
+        index_.restore(bin, prev, next, stamp1);
+    }
+
+
+    /**
+     * Return the least recently used bin of at least `w` x `h`, or nullptr.
+     *
+     * @private
+     * @param    {int32_t}  w   Smallest `maxw`
+     * @param    {int32_t}  h   Smallest `maxh`
+     * @returns  {Bin*}     Pointer to the bin
+     */
+    Bin* find(int32_t w, int32_t h) const {
+        return index_.oldest(w, h);
+    }
+
+
+    /**
+     * Call `fn(const Bin*)` for every bin, least recently used first.
+     *
+     * @private
+     * @param    {function}   fn   Called with a pointer to each bin
+     */
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        std::vector<Bin*> bins;
+        bins.reserve(index_.size());
+        index_.forEach([&bins](Bin* bin) { bins.push_back(bin); });
+        index_.sortByAge(bins);
+        for (const Bin* bin : bins) {
+            fn(bin);
+        }
+    }
+
+    Bin* front() const { return index_.oldest(0, 0); }
+    std::size_t size() const { return index_.size(); }
+    bool empty() const { return index_.empty(); }
+
+    void clear() { index_.clear(); }
+    void shrinkToFit() { index_.shrinkToFit(); }
+    std::size_t memoryUsage() const { return index_.memoryUsage(); }
+
+private:
+    FreebinIndex<Bin> index_;
+};
+
+
+
+template <typename Bin>
+class FreebinEdges {
+public:
+    /**
+     * Index of the free bins by their left and right edges, so that a bin being freed
+     * can find the free bins next to it on the same shelf.
+     *
+     * @private
+     * @class  FreebinEdges
+     */
+    FreebinEdges() { }
+
+
+    /**
+     * Add a free bin to the index.
+     *
+     * @private
+     * @param    {Bin*}   bin   Pointer to a free bin
+     */
+    void insert(Bin* bin) {
+        starts_[key(bin->x, bin->y)] = bin;
+        ends_[key(bin->x + bin->maxw, bin->y)] = bin;
+    }
+
+
+    /**
+     * Remove a free bin from the index.
+     *
+     * @private
+     * @param    {Bin*}   bin   Pointer to a free bin previously added with `insert()`
+     */
+    void erase(Bin* bin) {
+        starts_.erase(key(bin->x, bin->y));
+        ends_.erase(key(bin->x + bin->maxw, bin->y));
+    }
+
+
+    /**
+     * Return the free bin whose left edge is at `x`, on the shelf at `y`.
+     *
+     * @private
+     * @param    {int32_t}  x   Left edge
+     * @param    {int32_t}  y   Top coordinate of the shelf
+     * @returns  {Bin*}     Pointer to the free bin, or nullptr if none
+     */
+    Bin* startingAt(int32_t x, int32_t y) const {
+        auto it = starts_.find(key(x, y));
+        return it == starts_.end() ? nullptr : it->second;
+    }
+
+
+    /**
+     * Return the free bin whose right edge is at `x`, on the shelf at `y`.
+     *
+     * @private
+     * @param    {int32_t}  x   Right edge, i.e. `x + maxw` of the free bin
+     * @param    {int32_t}  y   Top coordinate of the shelf
+     * @returns  {Bin*}     Pointer to the free bin, or nullptr if none
+     */
+    Bin* endingAt(int32_t x, int32_t y) const {
+        auto it = ends_.find(key(x, y));
+        return it == ends_.end() ? nullptr : it->second;
+    }
+
+    void clear() {
+        starts_.clear();
+        ends_.clear();
+    }
+
+    void shrinkToFit() {
+        starts_.rehash(0);
+        ends_.rehash(0);
+    }
+
+    std::size_t memoryUsage() const { return heapBytes(starts_) + heapBytes(ends_); }
+
+private:
+    static uint64_t key(int32_t x, int32_t y) {
+        return (uint64_t(uint32_t(x)) << 32) | uint32_t(y);
+    }
+
+    std::unordered_map<uint64_t, Bin*> starts_;
+    std::unordered_map<uint64_t, Bin*> ends_;
+};
+
+
+
+template <typename Bin>
+class BinIdIndex {
+public:
+    /**
+     * Index of the used bins by id.
+     * Ids are kept in an open-addressing hash table with linear probing.
+     * In dense mode, small non-negative ids (like those generated by `packOne()`)
+     * are kept in a vector indexed directly by id instead, and only ids outside
+     * of that range fall back to the hash table.
+     *
+     * @private
+     * @class  BinIdIndex
+     * @param  {bool}  [dense=false]  If `true`, use a dense table for small ids
+     */
+    explicit BinIdIndex(bool dense = false) : dense_(dense), denseSize_(0), size_(0), mask_(0) { }
+
+
+    /**
+     * Return the bin for `id`, or nullptr if the id is not found.
+     *
+     * @private
+     * @param    {int32_t}  id   Bin identifier
+     * @returns  {Bin*}     Pointer to the bin
+     */
+    Bin* find(int32_t id) const {
+        if (id >= 0 && std::size_t(id) < table_.size()) {
+            Bin* bin = table_[id];
+            if (bin || size_ == denseSize_) {
+                return bin;
+            }
+        }
+        if (slots_.empty()) {
+            return nullptr;
+        }
+        for (std::size_t i = hash(id); ; i = (i + 1) & mask_) {
+            if (!slots_[i].bin || slots_[i].id == id) {
+                return slots_[i].bin;
+            }
+        }
+    }
+
+
+    /**
+     * Insert or replace the bin for `id`.
+     *
+     * @private
+     * @param    {int32_t}  id    Bin identifier
+     * @param    {Bin*}     bin   Pointer to the bin
+     */
+    void insert(int32_t id, Bin* bin) {
+        if (dense_ && id >= 0 && std::size_t(id) < denseLimit()) {
+            if (std::size_t(id) >= table_.size()) {
+                table_.resize(std::max(std::size_t(id) + 1, table_.size() * 2), nullptr);
+            }
+            // the id may have been hashed before the table grew to cover it..
+            if (!table_[id]) {
+                if (!slots_.empty() && find(id)) {
+                    erase(id);
+                }
+                denseSize_++;
+                size_++;
+            }
+            table_[id] = bin;
+            return;
+        }
+
+        if ((size_ - denseSize_ + 1) * 4 > slots_.size() * 3) {
+            rehash(slots_.empty() ? 16 : slots_.size() * 2);
+        }
+        for (std::size_t i = hash(id); ; i = (i + 1) & mask_) {
+            if (!slots_[i].bin) {
+                slots_[i].id = id;
+                slots_[i].bin = bin;
+                size_++;
+                return;
+            }
+            if (slots_[i].id == id) {
+                slots_[i].bin = bin;
+                return;
+            }
+        }
+    }
+
+
+    /**
+     * Make room for `count` bins, so inserting them does not rehash.
+     *
+     * @private
+     * @param    {size_t}   count   Expected number of bins
+     */
+    void reserve(std::size_t count) {
+        std::size_t capacity = 16;
+        while (capacity * 3 < count * 4) {
+            capacity *= 2;
+        }
+        if (capacity > slots_.size()) {
+            rehash(capacity);
+        }
+    }
+
+
+    /**
+     * Remove the bin for `id`, if any.
+     *
+     * @private
+     * @param    {int32_t}  id    Bin identifier
+     */
+    void erase(int32_t id) {
+        if (id >= 0 && std::size_t(id) < table_.size() && table_[id]) {
+            table_[id] = nullptr;
+            denseSize_--;
+            size_--;
+            return;
+        }
+        if (slots_.empty()) {
+            return;
+        }
+
+        std::size_t i = hash(id);
+        while (slots_[i].id != id) {
+            if (!slots_[i].bin) {
+                return;
+            }
+            i = (i + 1) & mask_;
+        }
+        if (!slots_[i].bin) {
+            return;
+        }
+
+        // backward shift deletion, so lookups never need tombstones..
+        for (std::size_t j = (i + 1) & mask_; slots_[j].bin; j = (j + 1) & mask_) {
+            std::size_t home = hash(slots_[j].id);
+            if (((j - home) & mask_) >= ((j - i) & mask_)) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i].bin = nullptr;
+        size_--;
+    }
+
+
+    /**
+     * Call `fn(Bin*)` for every bin in the index.  `fn` must not modify the index.
+     *
+     * @private
+     * @param    {function}   fn   Called with a pointer to each bin
+     */
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (Bin* bin : table_) {
+            if (bin) {
+                fn(bin);
+            }
+        }
+        for (const auto& slot : slots_) {
+            if (slot.bin) {
+                fn(slot.bin);
+            }
+        }
+    }
+
+
+    /**
+     * Remove all bins from the index.
+     *
+     * @private
+     */
+    void clear() {
+        table_.clear();
+        slots_.clear();
+        denseSize_ = size_ = mask_ = 0;
+    }
+
+
+    /**
+     * Give back memory: the dense table stops at the largest id in it, and the hash table
+     * is made as small as its load allows.
+     *
+     * @private
+     */
+    void shrinkToFit() {
+        std::size_t used = table_.size();
+        while (used > 0 && !table_[used - 1]) {
+            used--;
+        }
+        table_.resize(used);
+        table_.shrink_to_fit();
+
+        std::size_t hashed = size_ - denseSize_;
+        if (hashed == 0) {
+            slots_.clear();
+            slots_.shrink_to_fit();
+            mask_ = 0;
+        } else {
+            std::size_t capacity = 16;
+            while (capacity * 3 < hashed * 4) {
+                capacity *= 2;
+            }
+            if (capacity < slots_.size()) {
+                rehash(capacity);
+            }
+        }
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t memoryUsage() const { return heapBytes(table_) + heapBytes(slots_); }
+
+private:
+    struct Slot {
+        int32_t id;
+        Bin* bin;
+    };
+
+    std::size_t hash(int32_t id) const {
+        // fibonacci hashing spreads sequential ids across the table
+        return std::size_t((uint64_t(uint32_t(id)) * 0x9E3779B97F4A7C15ull) >> 32) & mask_;
+    }
+
+    // let the dense table grow, but not so far ahead of its contents that huge ids waste memory
+    std::size_t denseLimit() const {
+        return std::max(table_.size() * 2, denseSize_ * 4 + 1024);
+    }
+
+    void rehash(std::size_t capacity) {
+        std::vector<Slot> old(capacity, Slot{ 0, nullptr });
+        old.swap(slots_);
+        mask_ = capacity - 1;
+        for (const auto& slot : old) {
+            if (slot.bin) {
+                std::size_t i = hash(slot.id);
+                while (slots_[i].bin) {
+                    i = (i + 1) & mask_;
+                }
+                slots_[i] = slot;
+            }
+        }
+    }
+
+    bool dense_;
+    std::size_t denseSize_;
+    std::size_t size_;
+    std::size_t mask_;
+    std::vector<Bin*> table_;
+    std::vector<Slot> slots_;
+};
+
+
+
+template <typename Bin>
+class BinHandles {
+public:
+    /**
+     * Table of the slots that `BinHandle`s index.  Freed slots are reused oldest first,
+     * with their generation advanced, so old handles to them no longer resolve, and a
+     * generation only wraps after as many frees as there are free slots, times 1023.
+     *
+     * @private
+     * @class  BinHandles
+     */
+    BinHandles() { }
+
+
+    /**
+     * Give a bin a slot, and return its handle.
+     *
+     * @private
+     * @param    {Bin*}      bin   Pointer to the bin
+     * @returns  {uint32_t}  Handle value, or 0 if all `2^22` slots are taken, see `full()`
+     */
+    uint32_t acquire(Bin* bin) {
+        uint32_t index;
+        if (!free_.empty()) {
+            index = free_.front();
+            free_.pop_front();
+        } else if (slots_.size() <= BinHandle::kIndexMask) {
+            index = uint32_t(slots_.size());
+            slots_.push_back(Slot{ nullptr, 1 });
+        } else {
+            return 0;
+        }
+        slots_[index].bin = bin;
+        return (slots_[index].generation << BinHandle::kIndexBits) | index;
+    }
+
+
+    /**
+     * Free a bin's slot, so that its handle no longer resolves.
+     *
+     * @private
+     * @param    {uint32_t}  handle   Handle value returned by `acquire()`, 0 does nothing
+     */
+    void release(uint32_t handle) {
+        if (!handle) {
+            return;
+        }
+        uint32_t index = handle & BinHandle::kIndexMask;
+        advance(index);
+        free_.push_back(index);
+    }
+
+
+    /**
+     * Undo the latest `acquire()`.  The slot is reused next, but its old handle does not resolve.
+     *
+     * @private
+     * @param    {uint32_t}  handle   Handle value that was acquired
+     */
+    void unacquire(uint32_t handle) {
+        if (!handle) {
+            return;
+        }
+        uint32_t index = handle & BinHandle::kIndexMask;
+        advance(index);
+        free_.push_front(index);
+    }
+
+
+    /**
+     * Undo the latest `release()`, so that the handle resolves to the bin again.
+     * Undoing the acquisitions since then puts their slots back, so the slot is
+     * at the end of the free slots, other than new slots that were acquired and undone.
+     *
+     * @private
+     * @param    {uint32_t}  handle   Handle value that was released
+     * @param    {Bin*}      bin      Pointer to the bin
+     */
+    void unrelease(uint32_t handle, Bin* bin) {
+        if (!handle) {
+            return;
+        }
+        uint32_t index = handle & BinHandle::kIndexMask;
+        auto it = std::find(free_.rbegin(), free_.rend(), index);
+        free_.erase(std::next(it).base());
+        Slot& slot = slots_[index];
+        slot.bin = bin;
+        slot.generation = handle >> BinHandle::kIndexBits;
+    }
+
+
+    Bin* find(uint32_t handle) const {
+        uint32_t index = handle & BinHandle::kIndexMask;
+        if (index >= slots_.size() || slots_[index].generation != handle >> BinHandle::kIndexBits) {
+            return nullptr;
+        }
+        return slots_[index].bin;
+    }
+
+
+    void reserve(std::size_t count) {
+        slots_.reserve(count);
+    }
+
+    // all `2^22` slots hold a bin, so `acquire()` would fail..
+    bool full() const { return free_.empty() && slots_.size() > BinHandle::kIndexMask; }
+
+    std::size_t memoryUsage() const { return heapBytes(slots_) + heapBytes(free_); }
+
+
+    /**
+     * Free all slots.  Slots are kept, so that handles from before still do not resolve.
+     *
+     * @private
+     */
+    void clear() {
+        free_.clear();
+        for (std::size_t i = 0; i < slots_.size(); i++) {
+            if (slots_[i].bin) {
+                release((slots_[i].generation << BinHandle::kIndexBits) | uint32_t(i));
+            } else {
+                free_.push_back(uint32_t(i));
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        Bin* bin;
+        uint32_t generation;   // 1 to `kMaxGeneration`, so that no handle is 0
+    };
+
+    void advance(uint32_t index) {
+        Slot& slot = slots_[index];
+        slot.bin = nullptr;
+        slot.generation = slot.generation == BinHandle::kMaxGeneration ? 1 : slot.generation + 1;
+    }
+
+    std::vector<Slot> slots_;
+    std::deque<uint32_t> free_;
+};
+
+
+/**
+ * Called by pack() to order the requested bins by a sort strategy
+ * Equal bins keep their relative order.
+ *
+ * @private
+ * @param    {vector<size_t>}  order   Filled with indices of the bins, in packing order
+ * @param    {size_t}          count   Number of requested bins
+ * @param    {SortStrategy}    sort    Sort strategy, other than `None`
+ * @param    {function}        width   Returns the width of the bin at an index
+ * @param    {function}        height  Returns the height of the bin at an index
+ */
+template <typename SortStrategy, typename Width, typename Height>
+void sortOrder(std::vector<std::size_t> &order, std::size_t count, SortStrategy sort, Width width, Height height) {
+    auto key = [&](std::size_t i) -> int64_t {
+        switch (sort) {
+            case SortStrategy::HeightDesc:  return height(i);
+            case SortStrategy::AreaDesc:    return int64_t(width(i)) * height(i);
+            case SortStrategy::MaxSideDesc: return std::max(width(i), height(i));
+            case SortStrategy::None:        break;
+        }
+        return 0;
+    };
+
+    order.resize(count);
+    for (std::size_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    // break ties by index, a stable sort without stable_sort's temporary buffer..
+    std::sort(order.begin(), order.end(), [&key](std::size_t a, std::size_t b) {
+        int64_t ka = key(a), kb = key(b);
+        return ka > kb || (ka == kb && a < b);
+    });
+}
+
+}  // namespace detail
+
+
+
+struct DoublingGrowth {
+    /**
+     * Growth policy used by `autoResize`, called until the sprite is big enough:
+     *  * double whichever sprite dimension is smaller (`w` or `h`)
+     *  * if sprite dimensions are equal, grow width before height
+     *  * accomodate very large bin requests (big `binw` or `binh`)
+     *
+     * Policies are plain structs with the same static `grow()` function.
+     *
+     * @param    {int64_t&}   w      Sprite width to grow
+     * @param    {int64_t&}   h      Sprite height to grow
+     * @param    {int32_t}    binw   Width of the bin to accomodate
+     * @param    {int32_t}    binh   Height of the bin to accomodate
+     */
+    static void grow(int64_t& w, int64_t& h, int32_t binw, int32_t binh) {
+        int64_t w1 = w, h1 = h;
+        if (w1 <= h1 || binw > w1) {   // grow width..
+            w = std::max(int64_t(binw), w1) * 2;
+        }
+        if (h1 < w1 || binh > h1) {    // grow height..
+            h = std::max(int64_t(binh), h1) * 2;
+        }
+    }
+};
+
+
+
+template <typename Coord, typename Growth>
+class BasicShelfPack {
+public:
+    using Bin = BasicBin<Coord>;
+    using Shelf = BasicShelf<Coord>;
+
+    enum class IdIndex {
+        Hash,    // open-addressing hash table, suits any ids
+        Dense    // vector indexed by id, suits small ids like the generated ones
+    };
+
+    struct ShelfPackOptions {
+        inline ShelfPackOptions() : autoResize(false), idIndex(IdIndex::Hash), allocator(nullptr),
+            splitFreebins(false), mergeFreebins(false), minBinWidth(0), trackDirty(false), handles(false),
+            evictUnused(false), alignment(1), gutter(0) { };
+        bool autoResize;
+        IdIndex idIndex;
+        BinAllocator* allocator;
+        bool splitFreebins;
+        bool mergeFreebins;
+        int32_t minBinWidth;
+        bool trackDirty;
+        bool handles;
+        bool evictUnused;
+        int32_t alignment;
+        int32_t gutter;
+    };
+
+    enum class SortStrategy {
+        None,         // pack in input order
+        HeightDesc,   // tallest bins first
+        AreaDesc,     // largest bins first
+        MaxSideDesc   // bins with the longest side first
+    };
+
+    struct PackOptions {
+        inline PackOptions() : inPlace(false), sort(SortStrategy::None), presize(false), shrink(true), atomic(false) { };
+        bool inPlace;
+        SortStrategy sort;
+        bool presize;
+        bool shrink;
+        bool atomic;
+    };
+
+    enum class PackStatus : uint8_t {
+        Packed,       // the bin was packed (or an existing bin with its id was ref'd)
+        Skipped,      // the bin has no width or no height
+        OutOfSpace,   // there was no room for the bin
+        RolledBack    // not packed, as the `atomic` batch was rolled back
+    };
+
+    struct CompactOptions {
+        inline CompactOptions() : maxMoves(0), maxTime(0) { };
+        std::size_t maxMoves;                // 0 for no limit
+        std::chrono::microseconds maxTime;   // 0 for no limit
+    };
+
+    enum class VisitOrder {
+        Any,       // fastest, in no particular order
+        Spatial    // shelf by shelf from the top, then left to right
+    };
+
+    struct Move {
+        int32_t id;
+        int32_t w;
+        int32_t h;
+        int32_t fromX;
+        int32_t fromY;
+        int32_t toX;
+        int32_t toY;
+    };
+
+    struct DirtyRegion {
+        int32_t x;
+        int32_t y;
+        int32_t w;
+        int32_t h;
+    };
+
+#ifdef SHELF_PACK_STATS
+    struct ShelfPackStats {
+        // packOne() calls, by the way the bin was placed..
+        uint64_t refs = 0;             // id was already packed, the bin was ref'd
+        uint64_t exactFreebins = 0;    // reused a free bin of exactly the right size
+        uint64_t exactShelves = 0;     // packed on a shelf of exactly the right height
+        uint64_t bestFreebins = 0;     // reused the least wasteful larger free bin
+        uint64_t tallerShelves = 0;    // packed on the shortest taller shelf
+        uint64_t newShelves = 0;       // opened a new shelf
+        uint64_t outOfSpace = 0;       // no room, returned nullptr
+
+        uint64_t autoResizes = 0;      // times `autoResize` grew the sprite
+        uint64_t bucketsScanned = 0;   // shelf heights searched for room
+        uint64_t freebinsScanned = 0;  // free bin size classes searched for a fit
+        uint64_t evictions = 0;        // unused bins freed by `evictUnused` to make room
+        uint64_t shelfUpdates = 0;     // times a shelf's `x` changed, resizing the sprite changes none
+
+        int64_t usedArea = 0;          // `w * h` of the referenced bins
+        int64_t slackArea = 0;         // unused `maxw * maxh` area inside the referenced bins
+        int64_t freebinArea = 0;       // `maxw * maxh` of the free bins
+        int64_t shelfTailArea = 0;     // room left at the end of the shelves
+        int64_t spriteArea = 0;        // `width * height` of the sprite
+        std::size_t retiredHeights = 0;   // shelf heights left out of the search, as all their shelves are full
+
+        uint64_t packs() const {
+            return refs + exactFreebins + exactShelves + bestFreebins + tallerShelves + newShelves + outOfSpace;
+        }
+
+        // share of the sprite covered by referenced bins
+        double occupancy() const {
+            return spriteArea ? double(usedArea) / double(spriteArea) : 0.0;
+        }
+
+        // share of the area handed out to bins that is not in use
+        double fragmentation() const {
+            int64_t binArea = usedArea + slackArea + freebinArea;
+            return binArea ? double(slackArea + freebinArea) / double(binArea) : 0.0;
+        }
+    };
+#endif
+
+
+    /**
+     * Create a new ShelfPack bin allocator.
+     *
+     * Uses the Shelf Best Height Fit algorithm from
+     * http://clb.demon.fi/files/RectangleBinPack.pdf
+     *
+     * @class  ShelfPack
+     * @param  {int32_t}  [w=64]  Initial width of the sprite
+     * @param  {int32_t}  [h=64]  Initial width of the sprite
+     * @param  {ShelfPackOptions}  [options]
+     * @param  {bool} [options.autoResize=false]  If `true`, the sprite will automatically grow
+     * @param  {IdIndex} [options.idIndex=IdIndex::Hash]  How bins are indexed by id.
+     *   `IdIndex::Dense` is faster when ids are mostly generated by `packOne()`
+     * @param  {BinAllocator*} [options.allocator=nullptr]  Memory source for bin storage,
+     *   must outlive the sprite.  Uses `operator new` if null
+     * @param  {bool} [options.splitFreebins=false]  If `true`, a free bin reused for a narrower bin
+     *   is split, and the leftover width is returned to the free bins
+     * @param  {bool} [options.mergeFreebins=false]  If `true`, a freed bin is merged with the free bins
+     *   next to it on its shelf, and free space at the end of a shelf is given back to the shelf.
+     *   Empty shelves at the bottom of the sprite are removed.  Splitting and merging work best together
+     * @param  {int32_t} [options.minBinWidth=0]  Shelves with less room left than this are full, and are
+     *   not searched again until `unref()` gives them back some room.  Narrower bins only go to free bins
+     *   and shelves with room.  0 to use the narrowest bin packed so far, which does not change where
+     *   bins are placed
+     * @param  {bool} [options.trackDirty=false]  If `true`, remember where bins are packed, for `takeDirtyRegions()`
+     * @param  {bool} [options.handles=false]  If `true`, give packed bins a `BinHandle`, for `getBin(handle)`.
+     *   At most `2^22` (4194304) packed bins, unused ones kept by `evictUnused` included, can have a handle
+     *   at a time.  Past that `packOne()` packs no new bins, and returns nullptr
+     * @param  {bool} [options.evictUnused=false]  If `true`, bins unref'd to 0 stay packed, and `packOne()`
+     *   with their id refs them again.  They are evicted, least recently used first, when a new bin
+     *   would not fit otherwise, before `autoResize` grows the sprite
+     * @param  {int32_t} [options.alignment=1]  Bins are placed at multiples of this, rounded up to a power of 2,
+     *   and their sizes rounded up to it, so shelf heights are too.  With an alignment of 2^k,
+     *   placements stay exact at mip levels 0 to k: shift `x`, `y`, `w`, `h` right by the level
+     * @param  {int32_t} [options.gutter=0]  Border added around each bin before aligning, so that
+     *   filtering does not bleed between bins.  Each bin's image goes at `x + gutter`, `y + gutter`
+     *
+     * @example
+     * ShelfPack::ShelfPackOptions options;
+     * options.autoResize = false;
+     * ShelfPack sprite = new ShelfPack(64, 64, options);
+     */
+    explicit BasicShelfPack(int32_t w = 0, int32_t h = 0, const ShelfPackOptions &options = ShelfPackOptions{}) :
+        pool_(options.allocator), usedbins_(options.idIndex == IdIndex::Dense) {
+        width_ = w > 0 ? w : 64;
+        height_ = h > 0 ? h : 64;
+        autoResize_ = options.autoResize;
+        splitFreebins_ = options.splitFreebins;
+        mergeFreebins_ = options.mergeFreebins;
+        minBinWidth_ = std::max(0, options.minBinWidth);
+        trackDirty_ = options.trackDirty;
+        handles_ = options.handles;
+        evictUnused_ = options.evictUnused;
+        alignment_ = 1;
+        while (alignment_ < options.alignment && alignment_ <= std::numeric_limits<int32_t>::max() / 2) {
+            alignment_ *= 2;
+        }
+        gutter_ = std::max(0, options.gutter);
+        maxId_ = 0;
+        nextShelfY_ = 0;
+        usedWidth_ = 0;
+        buckets_.limit(width_ - (minBinWidth_ ? minBinWidth_ : narrowest_));
+    }
+
+    // copying would leave the copy's shelves and indexes pointing at the original's bins..
+    BasicShelfPack(const BasicShelfPack&) = delete;
+    BasicShelfPack& operator=(const BasicShelfPack&) = delete;
+
+
+    /**
+     * Move a sprite.  Bin pointers stay valid, and now belong to the new sprite.
+     * The moved-from sprite is left empty, with its size and options.
+     *
+     * @example
+     * std::vector<ShelfPack> sprites;
+     * sprites.push_back(std::move(sprite));
+     */
+    BasicShelfPack(BasicShelfPack&& other) : pool_(nullptr) {
+        moveFrom(other);
+    }
+
+    BasicShelfPack& operator=(BasicShelfPack&& other) {
+        if (this != &other) {
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+
+    /**
+     * Batch pack multiple bins into the sprite.
+     *
+     * @param   {vector<Bin>}   bins   Array of requested bins - each object should have `w`, `h` values
+     * @param   {PackOptions}   [options]
+     * @param   {bool} [options.inPlace=false] If `true`, the supplied bin objects will be updated inplace with `x` and `y` values
+     * @param   {SortStrategy} [options.sort=SortStrategy::None] Order to pack the bins in.
+     *   Packing taller bins first usually needs fewer shelves. The `bins` vector is not reordered,
+     *   and results are still returned in the order of `bins`
+     * @param   {bool} [options.presize=false] If `true` and the sprite has `autoResize` set,
+     *   grow the sprite up front to hold the total area of the bins, instead of one bin at a time
+     * @param   {bool} [options.shrink=true] If `true`, `shrink()` the sprite after packing.
+     *   Pass `false` when packing many batches, and shrink once at the end
+     * @param   {bool} [options.atomic=false] If `true`, pack all bins or none.  If a bin does not fit,
+     *   the batch is rolled back, as if `pack()` had not been called, and no results are returned
+     * @returns {vector<Bin*>}   Array of Bin pointers - each bin is a struct with `x`, `y`, `w`, `h` values
+     *
+     * @example
+     * std::vector<Bin> moreBins;
+     * moreBins.emplace_back(-1, 12, 24);
+     * moreBins.emplace_back(-1, 12, 12);
+     * moreBins.emplace_back(-1, 10, 10);
+     *
+     * ShelfPack::PackOptions options;
+     * options.inPlace = true;
+     * std::vector<Bin*> results = sprite.pack(moreBins, options);
+     */
+    std::vector<Bin*> pack(std::vector<Bin> &bins, const PackOptions &options = PackOptions{}) {
+        std::vector<Bin*> results;
+        if (options.atomic) {
+            begin();
+        }
+
+        if (options.presize) {
+            presize(bins.size(),
+                [&bins](std::size_t i) { return bins[i].w; },
+                [&bins](std::size_t i) { return bins[i].h; });
+        }
+
+        // pack in sorted order, but return results in the caller's order..
+        std::vector<Bin*> allocations(bins.size(), nullptr);
+        bool failed = false;
+        auto packAt = [&](std::size_t i) {
+            allocations[i] = packBin(bins[i]);
+            failed = options.atomic && !allocations[i] && bins[i].w > 0 && bins[i].h > 0;
+        };
+
+        if (options.sort == SortStrategy::None) {
+            for (std::size_t i = 0; i < bins.size() && !failed; i++) {
+                packAt(i);
+            }
+        } else {
+            detail::sortOrder(order_, bins.size(), options.sort,
+                [&bins](std::size_t i) { return bins[i].w; },
+                [&bins](std::size_t i) { return bins[i].h; });
+            for (std::size_t k = 0; k < order_.size() && !failed; k++) {
+                packAt(order_[k]);
+            }
+        }
+
+        if (options.atomic) {
+            if (failed) {
+                rollback();
+                return results;
+            }
+            commit();
+        }
+
+        for (std::size_t i = 0; i < bins.size(); i++) {
+            Bin* allocation = allocations[i];
+            if (allocation) {
+                if (options.inPlace) {
+                    bins[i].id = allocation->id;
+                    bins[i].x = allocation->x;
+                    bins[i].y = allocation->y;
+                }
+                results.push_back(allocation);
+            }
+        }
+
+        if (options.shrink) {
+            shrink();
+        }
+
+        return results;
+    }
+
+
+    /**
+     * Batch pack multiple bins into the sprite, from and into caller-provided arrays.
+     * Does not allocate, other than growing the sprite's own storage as it fills,
+     * and a sort buffer that is kept for later calls.
+     *
+     * @param   {size_t}         count      Number of requested bins
+     * @param   {int32_t*}       widths     Array of `count` widths
+     * @param   {int32_t*}       heights    Array of `count` heights
+     * @param   {int32_t*}       ids        Array of `count` ids (`-1` to generate one), or nullptr to generate all ids
+     * @param   {Bin**}          results    Array of `count` Bin pointers to fill in, nullptr where not packed.  May be nullptr
+     * @param   {PackStatus*}    statuses   Array of `count` statuses to fill in.  May be nullptr
+     * @param   {PackOptions}    [options]  `options.sort`, `options.presize`, `options.shrink` and
+     *   `options.atomic` are honored, `options.inPlace` has no effect.  If an `atomic` batch is rolled back,
+     *   every result is nullptr, and the bins that did fit have a status of `PackStatus::RolledBack`
+     * @returns {size_t}         Number of bins packed
+     *
+     * @example
+     * int32_t widths[] = { 12, 12, 10 };
+     * int32_t heights[] = { 24, 12, 10 };
+     * Bin* results[3];
+     * ShelfPack::PackStatus statuses[3];
+     * std::size_t packed = sprite.pack(3, widths, heights, nullptr, results, statuses);
+     */
+    std::size_t pack(std::size_t count, const int32_t* widths, const int32_t* heights, const int32_t* ids,
+                     Bin** results, PackStatus* statuses, const PackOptions &options = PackOptions{}) {
+        std::size_t packed = 0;
+        if (options.atomic) {
+            begin();
+            for (std::size_t i = 0; i < count; i++) {
+                if (results) {
+                    results[i] = nullptr;
+                }
+                if (statuses) {
+                    statuses[i] = PackStatus::RolledBack;
+                }
+            }
+        }
+
+        if (options.presize) {
+            presize(count,
+                [widths](std::size_t i) { return widths[i]; },
+                [heights](std::size_t i) { return heights[i]; });
+        }
+
+        bool failed = false;
+        auto packAt = [&](std::size_t i) {
+            PackStatus status = PackStatus::Skipped;
+            Bin* allocation = nullptr;
+            if (widths[i] > 0 && heights[i] > 0) {
+                allocation = packOne(ids ? ids[i] : -1, widths[i], heights[i]);
+                status = allocation ? PackStatus::Packed : PackStatus::OutOfSpace;
+                packed += allocation ? 1 : 0;
+                failed = options.atomic && !allocation;
+            }
+            if (results) {
+                results[i] = allocation;
+            }
+            if (statuses) {
+                statuses[i] = status;
+            }
+        };
+
+        if (options.sort == SortStrategy::None) {
+            for (std::size_t i = 0; i < count && !failed; i++) {
+                packAt(i);
+            }
+        } else {
+            detail::sortOrder(order_, count, options.sort,
+                [widths](std::size_t i) { return widths[i]; },
+                [heights](std::size_t i) { return heights[i]; });
+            for (std::size_t k = 0; k < order_.size() && !failed; k++) {
+                packAt(order_[k]);
+            }
+        }
+
+        if (options.atomic) {
+            if (failed) {
+                rollback();
+                for (std::size_t i = 0; i < count; i++) {
+                    if (results) {
+                        results[i] = nullptr;
+                    }
+                    if (statuses && statuses[i] == PackStatus::Packed) {
+                        statuses[i] = PackStatus::RolledBack;
+                    }
+                }
+                return 0;
+            }
+            commit();
+        }
+
+        if (options.shrink) {
+            shrink();
+        }
+
+        return packed;
+    }
+
+
+    /**
+     * Pack a single bin into the sprite.
+     * With the `alignment` and `gutter` options, the packed bin is the size with the gutter
+     * on both sides, rounded up to the alignment.
+     *
+     * @param   {int32_t}  id     Unique bin identifier, pass -1 to generate a new one
+     * @param   {int32_t}  w      Width of the bin to allocate
+     * @param   {int32_t}  h      Height of the bin to allocate
+     * @returns {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members
+     *
+     * @example
+     * Bin* result = sprite.packOne(-1, 12, 16);
+     */
+    Bin* packOne(int32_t id, int32_t w, int32_t h) {
+        // if id was supplied, attempt a lookup..
+        if (id != -1) {
+            Bin* pbin = getBin(id);
+            if (pbin) {   // we packed this bin already
+                SHELF_PACK_COUNT(refs, 1);
+                ref(*pbin);
+                return pbin;
+            }
+            maxId_ = std::max(id, maxId_);
+        } else {
+            id = ++maxId_;
+        }
+
+        if (alignment_ > 1 || gutter_) {
+            w = padded(w);
+            h = padded(h);
+        }
+
+        // every packed bin gets a handle, so none can be packed without one..
+        if (handles_ && handleSlots_.full()) {
+            SHELF_PACK_COUNT(outOfSpace, 1);
+            return nullptr;
+        }
+
+        Bin* pbin = place(id, w, h);
+        if (pbin) {
+            return pbin;
+        }
+
+        // No room, make some by evicting unused bins..
+        if (evictUnused_ && !unused_.empty()) {
+            pbin = placeEvicting(id, w, h);
+            if (pbin) {
+                return pbin;
+            }
+        }
+
+        // No room for more shelves..
+        // If `autoResize` option is set, grow the sprite to the first size that fits the bin,
+        // in one step.  See `grow()` for how the sprite grows..
+        if (autoResize_) {
+            // shelves with less room than `minBinWidth` stay out of the search, see `findShelf()`..
+            int32_t minx = buckets_.minx(h);
+            int32_t minw = std::max(w, minBinWidth_);
+
+            int32_t w2 = width_, h2 = height_;
+            bool grew = grow(w2, h2, w, h, [&](int32_t w1, int32_t h1) {
+                return w <= w1 && (minx <= w1 - minw || h <= h1 - nextShelfY_);
+            });
+            if (grew) {
+                SHELF_PACK_COUNT(autoResizes, 1);
+                resize(w2, h2);
+                return packShelf(id, w, h, nullptr);
+            }
+        }
+
+        SHELF_PACK_COUNT(outOfSpace, 1);
+        return nullptr;
+    }
+
+
+    /**
+     *
+     * Shrink the width/height of the sprite to the bare minimum.
+     * Since shelf-pack doubles first width, then height when running out of shelf space
+     * this can result in fairly large unused space both in width and height if that happens
+     * towards the end of bin packing.
+     * The used extent is tracked as bins are packed, and shelves take their width from
+     * the sprite, so this does not visit the shelves.
+     * Shelf space given back by `mergeFreebins` still counts towards the used width.
+     */
+    void shrink() {
+        if (shelves_.size()) {
+            resize(usedWidth_, nextShelfY_);
+        }
+    }
+
+
+    /**
+     * Return a packed bin given its id, or nullptr if the id is not found.
+     * Unused bins kept by `evictUnused` are found, with a refcount of 0.
+     *
+     * @param    {int32_t}  id  Unique identifier for this bin,
+     * @returns  {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members
+     *
+     * @example
+     * Bin* result = sprite.getBin(5);
+     */
+    Bin* getBin(int32_t id) {
+        return usedbins_.find(id);
+    }
+
+
+    /**
+     * Return a packed bin given its handle, or nullptr if the bin has been freed since.
+     * Needs the `handles` option.  Unlike ids, handles are not reused for other bins
+     * until their slot's generation wraps around.
+     *
+     * @param    {BinHandle}  handle  Handle returned by `Bin::handle()`
+     * @returns  {Bin*}       Pointer to the packed Bin
+     *
+     * @example
+     * BinHandle handle = sprite.packOne(-1, 12, 16)->handle();
+     * Bin* result = sprite.getBin(handle);
+     */
+    Bin* getBin(BinHandle handle) const {
+        return handleSlots_.find(handle.value());
+    }
+
+
+    /**
+     * Increment the ref count of a bin and update statistics.
+     *
+     * @param    {Bin&}      bin  Bin reference
+     * @returns  {int32_t}   New refcount of the bin
+     *
+     * @example
+     * Bin* bin = sprite.getBin(5);
+     * if (bin) {
+     *     sprite.ref(*bin);
+     * }
+     */
+    int32_t ref(Bin& bin) {
+        if (bin.refcount_ == 0 && evictUnused_) {
+            // an unused bin kept by `evictUnused`, in use again..
+            record(UndoOp::Unretain, &bin);
+            unused_.erase(&bin);
+        }
+        return addRef(bin);
+    }
+
+
+    /**
+     * Decrement the ref count of a bin and update statistics.
+     * The bin will be automatically marked as free space once the refcount reaches 0,
+     * or with `evictUnused`, kept packed until it is evicted.
+     * Memory for the bin is not freed, as unreferenced bins may be reused later.
+     *
+     * @param    {Bin&}     bin  Bin reference
+     * @returns  {int32_t}  New refcount of the bin
+     *
+     * @example
+     * Bin* bin = sprite.getBin(5);
+     * if (bin) {
+     *     sprite.unref(*bin);
+     * }
+     */
+    int32_t unref(Bin& bin) {
+        if (bin.refcount_ == 0) {
+            return 0;
+        }
+
+        if (dropRef(bin)) {
+            if (evictUnused_) {
+                record(UndoOp::Retain, &bin);
+                unused_.push(&bin);
+            } else {
+                release(bin);
+            }
+        }
+
+        return bin.refcount_;
+    }
+
+
+    /**
+     * Batch unref bins by id.  Ids that are not packed are skipped.
+     * The refs are dropped first, then the bins that reached 0 are freed together: with
+     * `mergeFreebins`, bins side by side on a shelf become one free bin before it is merged
+     * with its neighbours, rather than merging one bin at a time.  With `evictUnused` they
+     * become unused in the order of `ids`.
+     *
+     * @param    {size_t}     count   Number of ids
+     * @param    {int32_t*}   ids     Array of `count` bin ids
+     * @returns  {size_t}     Number of bins whose refcount reached 0
+     *
+     * @example
+     * int32_t ids[] = { 3, 5, 8 };
+     * sprite.unref(3, ids);
+     */
+    std::size_t unref(std::size_t count, const int32_t* ids) {
+        unrefd_.clear();
+        for (std::size_t i = 0; i < count; i++) {
+            Bin* bin = usedbins_.find(ids[i]);
+            if (bin && bin->refcount_ && dropRef(*bin)) {
+                unrefd_.push_back(bin);
+            }
+        }
+
+        if (evictUnused_ || !mergeFreebins_) {
+            for (Bin* bin : unrefd_) {
+                if (evictUnused_) {
+                    record(UndoOp::Retain, bin);
+                    unused_.push(bin);
+                } else {
+                    release(*bin);
+                }
+            }
+            return unrefd_.size();
+        }
+
+        std::sort(unrefd_.begin(), unrefd_.end(), [](const Bin* a, const Bin* b) {
+            return a->y < b->y || (a->y == b->y && a->x < b->x);
+        });
+        for (std::size_t i = 0; i < unrefd_.size(); ) {
+            Bin* first = unrefd_[i++];
+            eraseUsedbin(*first);
+            for (; i < unrefd_.size(); i++) {
+                Bin* next = unrefd_[i];
+                if (next->y != first->y || next->maxh != first->maxh || next->x != first->x + first->maxw) {
+                    break;
+                }
+                eraseUsedbin(*next);
+                record(UndoOp::Fields, first);
+                first->maxw += next->maxw;
+                recycle(next);
+            }
+            mergeFreebin(first);
+        }
+        return unrefd_.size();
+    }
+
+
+    /**
+     * Free the unused bins kept by `evictUnused`, least recently used first, so they
+     * no longer hold space.  Unlike eviction by `packOne()`, this does not wait for
+     * the space to be needed.
+     *
+     * @param    {size_t}     [count=SIZE_MAX]   Largest number of bins to free
+     * @returns  {size_t}     Number of bins freed
+     *
+     * @example
+     * sprite.evict();
+     */
+    std::size_t evict(std::size_t count = std::numeric_limits<std::size_t>::max()) {
+        std::size_t evicted = 0;
+        while (evicted < count && !unused_.empty()) {
+            evictBin(*unused_.front());
+            evicted++;
+        }
+        return evicted;
+    }
+
+    std::size_t unusedBins() const { return unused_.size(); }
+
+
+    /**
+     * Start a transaction.  Until the matching `commit()` or `rollback()`, changes made by
+     * `packOne()`, `pack()`, `ref()`, `unref()`, `resize()` and `shrink()` are recorded, so that
+     * `rollback()` can undo them exactly: shelves, free bins, ids, the height histogram and
+     * `stats()` all go back to how they were.  Transactions nest.
+     *
+     * `clear()`, `compact()` and `deserialize()` end all open transactions, keeping their changes.
+     *
+     * @example
+     * sprite.begin();
+     * Bin* a = sprite.packOne(-1, 12, 16);
+     * Bin* b = sprite.packOne(-1, 12, 16);
+     * if (a && b) {
+     *     sprite.commit();
+     * } else {
+     *     sprite.rollback();
+     * }
+     */
+    void begin() {
+        Savepoint savepoint;
+        savepoint.journal = journal_.size();
+        savepoint.maxId = maxId_;
+        savepoint.width = width_;
+        savepoint.height = height_;
+        savepoint.nextShelfY = nextShelfY_;
+        savepoint.usedWidth = usedWidth_;
+        savepoint.narrowest = narrowest_;
+        savepoint.freeStamp = freebins_.stamp();
+        savepoint.histogram = stats_.size();
+#ifdef SHELF_PACK_STATS
+        savepoint.counters = counters_;
+#endif
+        savepoints_.push_back(savepoint);
+    }
+
+
+    /**
+     * Keep the changes made since the matching `begin()`.
+     *
+     * @returns  {bool}  `true` if a transaction was open
+     *
+     * @example
+     * sprite.commit();
+     */
+    bool commit() {
+        if (savepoints_.empty()) {
+            return false;
+        }
+        savepoints_.pop_back();
+        if (savepoints_.empty()) {
+            journal_.clear();
+        }
+        return true;
+    }
+
+
+    /**
+     * Undo the changes made since the matching `begin()`.
+     * Bins packed since then are gone, and their pointers are no longer valid.
+     *
+     * @returns  {bool}  `true` if a transaction was open
+     *
+     * @example
+     * sprite.rollback();
+     */
+    bool rollback() {
+        if (savepoints_.empty()) {
+            return false;
+        }
+        const Savepoint savepoint = savepoints_.back();
+        savepoints_.pop_back();
+        while (journal_.size() > savepoint.journal) {
+            undo(journal_.back());
+            journal_.pop_back();
+        }
+
+        maxId_ = savepoint.maxId;
+        width_ = savepoint.width;
+        height_ = savepoint.height;
+        nextShelfY_ = savepoint.nextShelfY;
+        usedWidth_ = savepoint.usedWidth;
+        narrowest_ = savepoint.narrowest;
+        buckets_.limit(width_ - (minBinWidth_ ? minBinWidth_ : narrowest_));
+        freebins_.rewind(savepoint.freeStamp);
+        if (stats_.size() > savepoint.histogram) {
+            stats_.resize(savepoint.histogram);
+        }
+#ifdef SHELF_PACK_STATS
+        counters_ = savepoint.counters;
+#endif
+        return true;
+    }
+
+
+    /**
+     * Return the parts of the sprite that bins have been packed into since the last call,
+     * so that only those need uploading to a texture.  Needs the `trackDirty` option.
+     *
+     * Each shelf contributes one row, spanning the bins packed on it.  Rows of adjacent
+     * shelves are merged while at most a quarter of the merged region is outside them.
+     * Regions are clipped to the sprite, and ordered top to bottom.  Bins that are ref'd again,
+     * moved by `compact()` or restored by `deserialize()` are not included.  `rollback()` does
+     * not remove regions, so bins packed and rolled back since the last call are still included.
+     *
+     * @returns  {vector<DirtyRegion>}  Regions with `x`, `y`, `w`, `h` values
+     *
+     * @example
+     * for (const auto& region : sprite.takeDirtyRegions()) {
+     *     glTexSubImage2D(GL_TEXTURE_2D, 0, region.x, region.y, region.w, region.h, format, type, pixels);
+     * }
+     */
+    std::vector<DirtyRegion> takeDirtyRegions() {
+        std::vector<DirtyRegion> regions;
+        std::sort(dirtyRows_.begin(), dirtyRows_.end());
+        for (std::size_t row : dirtyRows_) {
+            DirtySpan& span = dirty_[row];
+            int32_t x1 = std::min(span.x1, width_);
+            int32_t y1 = std::min(span.y + span.h, height_);
+            bool empty = span.x1 <= span.x0 || x1 <= span.x0 || y1 <= span.y;
+            DirtyRegion region{ span.x0, span.y, x1 - span.x0, y1 - span.y };
+            span = DirtySpan{};
+            if (empty) {
+                continue;   // already taken, or no longer in the sprite
+            }
+
+            if (!regions.empty()) {
+                DirtyRegion& last = regions.back();
+                if (last.y + last.h == region.y) {
+                    int32_t x0 = std::min(last.x, region.x);
+                    int32_t w = std::max(last.x + last.w, region.x + region.w) - x0;
+                    int64_t rows = int64_t(last.w) * last.h + int64_t(region.w) * region.h;
+                    int64_t merged = int64_t(w) * (last.h + region.h);
+                    if (merged - rows <= merged / 4) {
+                        last.x = x0;
+                        last.w = w;
+                        last.h += region.h;
+                        continue;
+                    }
+                }
+            }
+            regions.push_back(region);
+        }
+        dirtyRows_.clear();
+        return regions;
+    }
+
+
+    /**
+     * Clear the sprite and reset statistics.
+     *
+     * @example
+     * sprite.clear();
+     */
+    void clear() {
+        savepoints_.clear();
+        journal_.clear();
+        dirty_.clear();
+        dirtyRows_.clear();
+        shelves_.clear();
+        pool_.clear();
+        buckets_.clear();
+        nextShelfY_ = 0;
+        usedWidth_ = 0;
+        freebins_.clear();
+        freeedges_.clear();
+        unused_.clear();
+        usedbins_.clear();
+        handleSlots_.clear();
+        stats_.clear();
+        maxId_ = 0;
+#ifdef SHELF_PACK_STATS
+        counters_ = ShelfPackStats{};
+#endif
+    }
+
+
+    /**
+     * Allocate storage up front for `bins` bins on `shelves` shelves, so packing
+     * that many does not allocate.  See `reserve()` to grow the sprite itself.
+     *
+     * @param   {size_t}  bins     Expected number of bins
+     * @param   {size_t}  shelves  Expected number of shelves
+     *
+     * @example
+     * sprite.reserveBins(10000, 200);
+     */
+    void reserveBins(std::size_t bins, std::size_t shelves) {
+        pool_.reserve(bins > usedbins_.size() ? bins - usedbins_.size() : 0);
+        usedbins_.reserve(bins);
+        if (handles_) {
+            handleSlots_.reserve(bins);
+        }
+        buckets_.reserve(shelves);
+        if (trackDirty_) {
+            dirty_.reserve(shelves);
+        }
+    }
+
+
+    /**
+     * Give back memory the sprite holds but does not use, e.g. after `clear()` or heavy `unref()`.
+     * Unlike `shrink()`, this does not change the size of the sprite.
+     *
+     * @example
+     * sprite.clear();
+     * sprite.shrinkToFit();
+     */
+    void shrinkToFit() {
+        // not `shelves_`, whose elements the shelf index points at, and `shrink_to_fit()` may move..
+        pool_.shrinkToFit();
+        buckets_.shrinkToFit();
+        usedbins_.shrinkToFit();
+        freebins_.shrinkToFit();
+        freeedges_.shrinkToFit();
+        unused_.shrinkToFit();
+        stats_.shrink_to_fit();
+        order_.clear();
+        order_.shrink_to_fit();
+        unrefd_.clear();
+        unrefd_.shrink_to_fit();
+        journal_.shrink_to_fit();
+        savepoints_.shrink_to_fit();
+        dirty_.shrink_to_fit();
+        dirtyRows_.shrink_to_fit();
+    }
+
+
+    /**
+     * Return the heap memory held by the sprite, in bytes, including storage
+     * kept for reuse.  Hash tables are estimated, as their nodes are not visible.
+     *
+     * @returns {size_t}  Number of bytes
+     *
+     * @example
+     * std::size_t bytes = sprite.memoryUsage();
+     */
+    std::size_t memoryUsage() const {
+        return pool_.memoryUsage() + detail::heapBytes(shelves_) + buckets_.memoryUsage() +
+            usedbins_.memoryUsage() + handleSlots_.memoryUsage() + freebins_.memoryUsage() +
+            freeedges_.memoryUsage() + unused_.memoryUsage() + detail::heapBytes(stats_) + detail::heapBytes(order_) +
+            detail::heapBytes(unrefd_) + detail::heapBytes(journal_) + detail::heapBytes(savepoints_) +
+            detail::heapBytes(dirty_) + detail::heapBytes(dirtyRows_);
+    }
+
+
+    /**
+     * Resize the sprite.
+     *
+     * @param   {int32_t}  w  Requested new sprite width
+     * @param   {int32_t}  h  Requested new sprite height
+     * @returns {bool}     `true` if resize succeeded, `false` if failed
+     *
+     * @example
+     * sprite.resize(256, 256);
+     */
+    bool resize(int32_t w, int32_t h) {
+        // shelves take their width from `width_`, so they are not visited..
+        width_ = w;
+        height_ = h;
+        buckets_.limit(width_ - (minBinWidth_ ? minBinWidth_ : narrowest_));
+        return true;
+    }
+
+
+    /**
+     * Grow the sprite to at least `w` x `h`.  Never shrinks the sprite.
+     * Reserving the expected size up front avoids repeated `autoResize` growth.
+     *
+     * @param   {int32_t}  w  Minimum sprite width
+     * @param   {int32_t}  h  Minimum sprite height
+     *
+     * @example
+     * sprite.reserve(1024, 1024);
+     */
+    void reserve(int32_t w, int32_t h) {
+        resize(std::max(w, width_), std::max(h, height_));
+    }
+
+
+    /**
+     * Compact a fragmented sprite by moving referenced bins out of the bottom shelves.
+     * The live bins of the bottom shelf are moved into free bins and shelf space above it,
+     * using the same best fit rules as `packOne()`, and then the shelf is removed.  This
+     * repeats until a bottom shelf cannot be emptied, or the budget runs out.
+     *
+     * Bins keep their ids and `Bin*` pointers, only `x`, `y`, `maxw`, `maxh` change.
+     * Unused bins kept by `evictUnused` are not moved.  They stay where they are on the shelves
+     * that are kept, and are evicted with the shelves that are removed, so `packOne()` with
+     * their id no longer finds them.
+     * Every move goes from a position in use before the call to one that was free before it,
+     * so all moves can be copied from the old texture in one batch, in any order.
+     * Call again to continue after running out of budget, and `shrink()` to reduce the sprite.
+     *
+     * @param    {CompactOptions}   [options]
+     * @param    {size_t} [options.maxMoves=0]  Stop before moving more bins than this, 0 for no limit.
+     *   A shelf is only emptied if all of its bins fit in the budget
+     * @param    {microseconds} [options.maxTime=0]  Stop before emptying another shelf after this long,
+     *   0 for no limit
+     * @returns  {vector<Move>}     One move per moved bin, with its size and old and new positions
+     *
+     * @example
+     * std::vector<ShelfPack::Move> moves = sprite.compact();
+     * for (const auto& move : moves) {
+     *     blit(move.fromX, move.fromY, move.toX, move.toY, move.w, move.h);
+     * }
+     * sprite.shrink();
+     */
+    std::vector<Move> compact(const CompactOptions &options = CompactOptions{}) {
+        std::vector<Move> moves;
+        savepoints_.clear();
+        journal_.clear();
+        if (shelves_.empty()) {
+            return moves;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto outOfTime = [&]() {
+            return options.maxTime.count() > 0 && std::chrono::steady_clock::now() - start >= options.maxTime;
+        };
+
+        // group the live, unused and free bins by shelf..
+        std::vector<std::vector<Bin*>> live(shelves_.size()), unused(shelves_.size()), free(shelves_.size());
+        usedbins_.forEach([&](Bin* bin) { (bin->refcount_ ? live : unused)[shelfIndex(bin->y)].push_back(bin); });
+        freebins_.forEach([&](Bin* bin) { free[shelfIndex(bin->y)].push_back(bin); });
+
+        std::unordered_map<int32_t, std::size_t> moved;   // bin id -> index in `moves`
+        std::vector<Bin*> dead;                           // bins no longer in use, retired with a `y` of -1
+        std::size_t relocated = 0;
+        bool dropped = false;
+
+        while (!shelves_.empty()) {
+            Shelf& shelf = shelves_.back();
+            std::vector<Bin*>& bins = live.back();
+            if (!bins.empty() && ((options.maxMoves && relocated + bins.size() > options.maxMoves) || outOfTime())) {
+                break;
+            }
+
+            // take the shelf and its free bins out of the running..
+            buckets_.pop(shelf.h());
+            for (Bin* bin : free.back()) {
+                if (bin->y == shelf.y()) {
+                    eraseFreebin(bin);
+                }
+            }
+
+            // move the largest bins first, while there is the most room..
+            std::sort(bins.begin(), bins.end(), [](const Bin* a, const Bin* b) {
+                return a->h > b->h || (a->h == b->h && a->w > b->w);
+            });
+
+            std::size_t i = 0;
+            std::vector<Bin> holes;
+            for (; i < bins.size(); i++) {
+                Bin& bin = *bins[i];
+                Bin hole(-1, bin.maxw, bin.maxh, bin.maxw, bin.maxh, bin.x, bin.y);
+                if (!relocate(bin, dead)) {
+                    break;
+                }
+                holes.push_back(hole);
+                live[shelfIndex(bin.y)].push_back(&bin);
+
+                auto inserted = moved.emplace(bin.id, moves.size());
+                if (inserted.second) {
+                    moves.push_back(Move{ bin.id, bin.w, bin.h, hole.x, hole.y, bin.x, bin.y });
+                } else {
+                    moves[inserted.first->second].toX = bin.x;
+                    moves[inserted.first->second].toY = bin.y;
+                }
+                relocated++;
+            }
+
+            if (i < bins.size()) {
+                // no room for the rest, put the shelf back with the moved bins' slots free..
+                shelf.slot_ = buckets_.push(&shelf);
+                for (Bin* bin : free.back()) {
+                    if (bin->y == shelf.y()) {
+                        pushFreebin(bin);
+                    }
+                }
+                for (const Bin& hole : holes) {
+                    pushFreebin(pool_.create(hole));
+                }
+                break;
+            }
+
+            // the shelf has no live bins now, drop it and the unused bins on it..
+            for (Bin* bin : unused.back()) {
+                unused_.erase(bin);
+                eraseUsedbin(*bin);
+                SHELF_PACK_COUNT(evictions, 1);
+                bin->y = -1;
+                dead.push_back(bin);
+            }
+            for (Bin* bin : free.back()) {
+                if (bin->y == shelf.y()) {
+                    bin->y = -1;
+                    dead.push_back(bin);
+                }
+            }
+            nextShelfY_ = shelf.y();
+            shelves_.pop_back();
+            live.pop_back();
+            unused.pop_back();
+            free.pop_back();
+            dropped = true;
+        }
+
+        for (Bin* bin : dead) {
+            pool_.recycle(bin);
+        }
+        if (dropped) {
+            usedWidth_ = 0;
+            for (const auto& shelf : shelves_) {
+                usedWidth_ = std::max(shelf.x(), usedWidth_);
+            }
+        }
+
+        return moves;
+    }
+
+    int32_t width() const { return width_; }
+    int32_t height() const { return height_; }
+    int32_t alignment() const { return alignment_; }
+    int32_t gutter() const { return gutter_; }
+
+
+    /**
+     * Call `fn(const Shelf&)` for every shelf, from the top of the sprite down.
+     * `fn` must not modify the sprite.
+     *
+     * @param    {function}   fn   Called with each shelf
+     *
+     * @example
+     * sprite.forEachShelf([](const Shelf& shelf) {
+     *     std::cout << shelf.y() << " " << shelf.h() << " " << shelf.wfree() << std::endl;
+     * });
+     */
+    template <typename Fn>
+    void forEachShelf(Fn fn) const {
+        for (const auto& shelf : shelves_) {
+            fn(shelf);
+        }
+    }
+
+
+    /**
+     * Call `fn(const Bin&)` for every referenced bin, and the unused bins kept by `evictUnused`.
+     * `fn` must not modify the sprite.
+     * Nothing is allocated, except that `VisitOrder::Spatial` sorts the bins in a buffer of its own.
+     *
+     * @param    {function}     fn      Called with each bin
+     * @param    {VisitOrder}   [order=VisitOrder::Any]  Order to visit the bins in
+     *
+     * @example
+     * sprite.forEachBin([&](const Bin& bin) {
+     *     upload(bin.x, bin.y, bin.w, bin.h, images[bin.id]);
+     * }, ShelfPack::VisitOrder::Spatial);
+     */
+    template <typename Fn>
+    void forEachBin(Fn fn, VisitOrder order = VisitOrder::Any) const {
+        visit([this](auto each) { usedbins_.forEach(each); }, fn, order);
+    }
+
+
+    /**
+     * Call `fn(const Bin&)` for every free bin, i.e. space that `packOne()` can reuse.
+     * Free bins have a refcount of 0, and only their `x`, `y`, `maxw`, `maxh` are meaningful.
+     * `fn` must not modify the sprite.  Allocates like `forEachBin()`.
+     *
+     * @param    {function}     fn      Called with each free bin
+     * @param    {VisitOrder}   [order=VisitOrder::Any]  Order to visit the bins in
+     *
+     * @example
+     * sprite.forEachFreebin([&](const Bin& bin) {
+     *     clear(bin.x, bin.y, bin.maxw, bin.maxh);
+     * });
+     */
+    template <typename Fn>
+    void forEachFreebin(Fn fn, VisitOrder order = VisitOrder::Any) const {
+        visit([this](auto each) { freebins_.forEach(each); }, fn, order);
+    }
+
+
+    /**
+     * Return the histogram of bin heights.
+     * Entry `h` holds the number of referenced bins that have height `h`.
+     * The vector may have trailing zero entries, and is empty after `clear()`.
+     *
+     * @returns  {const vector<int32_t>&}   Bin counts indexed by height
+     *
+     * @example
+     * const std::vector<int32_t>& histogram = sprite.heightHistogram();
+     * int32_t count = (16 < histogram.size()) ? histogram[16] : 0;
+     */
+    const std::vector<int32_t>& heightHistogram() const { return stats_; }
+
+
+#ifdef SHELF_PACK_STATS
+    /**
+     * Return counters of how `packOne()` placed bins, and how the sprite's area is used.
+     * Only available if `SHELF_PACK_STATS` is defined before including this header.
+     * Counters are reset by `clear()`.
+     *
+     * @returns  {ShelfPackStats}   Snapshot of the counters
+     *
+     * @example
+     * ShelfPack::ShelfPackStats stats = sprite.stats();
+     * double newShelfRate = double(stats.newShelves) / double(stats.packs());
+     */
+    ShelfPackStats stats() const {
+        ShelfPackStats result = counters_;
+        int64_t binArea = result.usedArea + result.slackArea + result.freebinArea;
+        result.shelfTailArea = int64_t(width_) * nextShelfY_ - binArea;
+        result.spriteArea = int64_t(width_) * height_;
+        result.retiredHeights = buckets_.retired();
+        return result;
+    }
+#endif
+
+
+    /**
+     * Save the whole state of the sprite as a snapshot, so it can be restored with `deserialize()`
+     * instead of replaying every `packOne()`.  The snapshot holds the sprite size, options,
+     * shelves, referenced bins with their refcounts, free bins in reuse order, and counters.
+     * Unused bins kept by `evictUnused` are stored with the referenced ones, with a refcount
+     * of -1 for the least recently used, -2 for the next, and so on.
+     *
+     * The format is a fixed header followed by flat arrays of 32-bit records, in native byte order.
+     * It can be written to a file and mapped back in by any process on the same architecture.
+     *
+     * @returns  {vector<uint8_t>}   Snapshot bytes
+     *
+     * @example
+     * std::vector<uint8_t> snapshot = sprite.serialize();
+     * file.write(reinterpret_cast<const char*>(snapshot.data()), snapshot.size());
+     */
+    std::vector<uint8_t> serialize() const {
+        std::vector<Bin*> free;
+        free.reserve(freebins_.size());
+        freebins_.forEach([&](Bin* bin) { free.push_back(bin); });
+        freebins_.sortByAge(free);
+
+        std::vector<uint8_t> data(kSnapshotHeader + kSnapshotShelf * shelves_.size() +
+            kSnapshotBin * (usedbins_.size() + free.size()));
+        uint8_t* p = data.data();
+        auto put = [&p](const void* v, std::size_t n) { std::memcpy(p, v, n); p += n; };
+        auto put32 = [&put](int32_t v) { put(&v, sizeof(v)); };
+
+        char version[16] = { 0 };
+        std::strncpy(version, SHELF_PACK_VERSION, sizeof(version) - 1);
+        put("SHPK", 4);
+        put32(kSnapshotFormat);
+        put(version, sizeof(version));
+        put32(width_);
+        put32(height_);
+        put32(maxId_);
+        put32(nextShelfY_);
+        put32(usedWidth_);
+        put32((autoResize_ ? 1 : 0) | (splitFreebins_ ? 2 : 0) | (mergeFreebins_ ? 4 : 0));
+        put32(int32_t(shelves_.size()));
+        put32(int32_t(usedbins_.size()));
+        put32(int32_t(free.size()));
+        put32(alignment_);
+        put32(gutter_);
+        put32(minBinWidth_);
+        put32(0);
+
+        uint64_t counters[kSnapshotCounters] = { 0 };
+#ifdef SHELF_PACK_STATS
+        const ShelfPackStats& c = counters_;
+        uint64_t values[kSnapshotCounters] = { c.refs, c.exactFreebins, c.exactShelves, c.bestFreebins,
+            c.tallerShelves, c.newShelves, c.outOfSpace, c.autoResizes, c.bucketsScanned, c.freebinsScanned,
+            c.evictions, c.shelfUpdates };
+        std::copy(values, values + kSnapshotCounters, counters);
+#endif
+        put(counters, sizeof(counters));
+
+        for (const auto& shelf : shelves_) {
+            put32(shelf.y());
+            put32(shelf.h());
+            put32(shelf.x());
+        }
+        std::unordered_map<const Bin*, int32_t> unused;
+        int32_t rank = 0;
+        unused_.forEach([&](const Bin* bin) { unused.emplace(bin, --rank); });
+        auto putBin = [&](const Bin& bin) {
+            int32_t refcount = bin.refcount_ ? bin.refcount_ : unused[&bin];
+            int32_t fields[8] = { bin.id, refcount, bin.w, bin.h, bin.maxw, bin.maxh, bin.x, bin.y };
+            for (int32_t v : fields) {
+                put32(v);
+            }
+        };
+        // referenced bins shelf by shelf, so `deserialize()` can check them in one pass..
+        forEachBin(putBin, VisitOrder::Spatial);
+        for (const Bin* bin : free) {
+            putBin(*bin);
+        }
+        return data;
+    }
+
+
+    /**
+     * Replace the state of the sprite with a snapshot made by `serialize()`.
+     * The snapshot is checked before anything is changed, and rejected if it was written by
+     * another snapshot format or shelf-pack version, by a sprite with another `alignment`, `gutter` or `minBinWidth`,
+     * has more bins than `handles` allows, or does not describe a consistent sprite.  `autoResize`,
+     * `splitFreebins` and `mergeFreebins` come from the snapshot, the sprite's other options are kept.
+     * Bins are rebuilt in the sprite's own pool, so `data` can be released afterwards.
+     *
+     * @param    {void*}    data   Snapshot bytes, needs no alignment, e.g. part of a mapped file
+     * @param    {size_t}   size   Number of snapshot bytes
+     * @returns  {bool}     `true` if the snapshot was restored, `false` if it was rejected
+     *
+     * @example
+     * if (!sprite.deserialize(snapshot.data(), snapshot.size())) {
+     *     rebuild(sprite);
+     * }
+     */
+    bool deserialize(const void* data, std::size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        auto get32 = [&p]() { int32_t v; std::memcpy(&v, p, sizeof(v)); p += sizeof(v); return v; };
+
+        if (size < kSnapshotHeader || std::memcmp(p, "SHPK", 4) != 0) {
+            return false;
+        }
+        p += 4;
+        if (get32() != kSnapshotFormat) {
+            return false;
+        }
+        char version[16] = { 0 };
+        std::strncpy(version, SHELF_PACK_VERSION, sizeof(version) - 1);
+        if (std::memcmp(p, version, sizeof(version)) != 0) {
+            return false;
+        }
+        p += sizeof(version);
+
+        int32_t header[13];
+        for (auto& v : header) {
+            v = get32();
+        }
+        int32_t width = header[0], height = header[1], maxId = header[2], nextShelfY = header[3];
+        uint32_t shelfCount = uint32_t(header[6]), usedCount = uint32_t(header[7]), freeCount = uint32_t(header[8]);
+        if (uint64_t(size) != kSnapshotHeader + uint64_t(kSnapshotShelf) * shelfCount +
+                uint64_t(kSnapshotBin) * (uint64_t(usedCount) + freeCount)) {
+            return false;
+        }
+        // more bins than there are handles for..
+        if (handles_ && uint64_t(usedCount) > uint64_t(BinHandle::kIndexMask) + 1) {
+            return false;
+        }
+        uint64_t counters[kSnapshotCounters];
+        std::memcpy(counters, p, sizeof(counters));
+        p += sizeof(counters);
+
+        // check the shelves and bins before touching the sprite..
+        const uint8_t* records = p;
+        auto fits = [](int32_t v) { return v >= 0 && int64_t(v) <= int64_t(std::numeric_limits<Coord>::max()); };
+        if (width <= 0 || height <= 0 || maxId < 0) {
+            return false;
+        }
+        // bins are padded and placed for the grid of the sprite that wrote them..
+        if (header[9] != alignment_ || header[10] != gutter_ || header[11] != minBinWidth_) {
+            return false;
+        }
+        std::vector<int32_t> shelfYs;
+        std::vector<std::array<int32_t, 3>> shelves(shelfCount);
+        int32_t y = 0, usedWidth = 0;
+        for (auto& shelf : shelves) {
+            for (auto& v : shelf) {
+                v = get32();
+            }
+            if (shelf[0] != y || shelf[1] <= 0 || !fits(shelf[2]) ||
+                    int64_t(y) + shelf[1] > std::numeric_limits<int32_t>::max()) {
+                return false;
+            }
+            y += shelf[1];
+            usedWidth = std::max(shelf[2], usedWidth);
+            shelfYs.push_back(shelf[0]);
+        }
+        // `usedWidth_` can stay above the widest shelf after shelf space is given back..
+        if (y != nextShelfY || header[4] < usedWidth) {
+            return false;
+        }
+        // ids up to `maxId` are checked for duplicates in a bitmap, others in a set..
+        std::vector<bool> seen(maxId <= int64_t(usedCount) * 8 ? std::size_t(maxId) + 1 : 0);
+        std::unordered_set<int32_t> ids;
+        std::vector<bool> ranks(usedCount);
+        std::size_t unusedCount = 0;
+        std::size_t cursor = 0;
+        auto unique = [&](int32_t id) {
+            if (id >= 0 && std::size_t(id) < seen.size()) {
+                bool dup = seen[std::size_t(id)];
+                seen[std::size_t(id)] = true;
+                return !dup;
+            }
+            return ids.insert(id).second;
+        };
+        for (uint32_t i = 0; i < usedCount + freeCount; i++) {
+            int32_t bin[8];
+            for (auto& v : bin) {
+                v = get32();
+            }
+            // referenced bins are stored shelf by shelf, free bins in reuse order..
+            bool used = i < usedCount;
+            if (used) {
+                while (cursor + 1 < shelfYs.size() && shelfYs[cursor + 1] <= bin[7]) {
+                    cursor++;
+                }
+            } else {
+                cursor = std::size_t(std::upper_bound(shelfYs.begin(), shelfYs.end(), bin[7]) - shelfYs.begin());
+                cursor = cursor ? cursor - 1 : 0;
+            }
+            if (shelves.empty() || shelves[cursor][0] != bin[7]) {
+                return false;
+            }
+            const auto& s1 = shelves[cursor];
+            if (used && bin[1] < 0) {
+                // an unused bin, and its place in the least recently used order..
+                if (int64_t(bin[1]) < -int64_t(usedCount) || ranks[std::size_t(-int64_t(bin[1]) - 1)]) {
+                    return false;
+                }
+                ranks[std::size_t(-int64_t(bin[1]) - 1)] = true;
+                unusedCount++;
+            }
+            if ((used ? bin[1] == 0 : bin[1] != 0) || (used && !unique(bin[0])) ||
+                    !fits(bin[2]) || !fits(bin[3]) || !fits(bin[4]) || !fits(bin[5]) || !fits(bin[6]) ||
+                    bin[4] <= 0 || bin[5] != s1[1] || int64_t(bin[6]) + bin[4] > s1[2]) {
+                return false;
             }
-            // extra height, minimize wasted area..
-            if (h < shelf.h()) {
-                waste = (shelf.h() - h) * w;
-                if (waste < best.waste) {
-                    best.waste = waste;
-                    best.pshelf = &shelf;
+        }
+        // with unique ranks, none past the number of unused bins means none are missing..
+        if (std::find(ranks.begin() + std::ptrdiff_t(unusedCount), ranks.end(), true) != ranks.end()) {
+            return false;
+        }
+
+        clear();
+        width_ = width;
+        height_ = height;
+        maxId_ = maxId;
+        nextShelfY_ = nextShelfY;
+        usedWidth_ = header[4];
+        autoResize_ = (header[5] & 1) != 0;
+        splitFreebins_ = (header[5] & 2) != 0;
+        mergeFreebins_ = (header[5] & 4) != 0;
+        buckets_.limit(width_ - (minBinWidth_ ? minBinWidth_ : narrowest_));
+#ifdef SHELF_PACK_STATS
+        ShelfPackStats& c = counters_;
+        uint64_t* values[kSnapshotCounters] = { &c.refs, &c.exactFreebins, &c.exactShelves, &c.bestFreebins,
+            &c.tallerShelves, &c.newShelves, &c.outOfSpace, &c.autoResizes, &c.bucketsScanned, &c.freebinsScanned,
+            &c.evictions, &c.shelfUpdates };
+        for (std::size_t i = 0; i < kSnapshotCounters; i++) {
+            *values[i] = counters[i];
+        }
+#endif
+
+        usedbins_.reserve(usedCount);
+        std::vector<Bin*> unused(unusedCount);
+        p = records + kSnapshotShelf * shelfCount;
+        for (const auto& s1 : shelves) {
+            shelves_.emplace_back(s1[0], &width_, s1[1], pool_);
+            Shelf& shelf = shelves_.back();
+            shelf.x_ = s1[2];
+            shelf.slot_ = buckets_.push(&shelf);
+        }
+        for (uint32_t i = 0; i < usedCount + freeCount; i++) {
+            int32_t bin[8];
+            for (auto& v : bin) {
+                v = get32();
+            }
+            Bin* pbin = pool_.create(bin[0], bin[2], bin[3], bin[4], bin[5], bin[6], bin[7]);
+            if (i < usedCount) {
+                usedbins_.insert(bin[0], pbin);
+                acquireHandle(pbin);
+                if (bin[1] > 0) {
+                    addRef(*pbin);
+                    pbin->refcount_ = bin[1];
+                } else {
+                    unused[std::size_t(-int64_t(bin[1]) - 1)] = pbin;
                 }
+            } else {
+                pushFreebin(pbin);
             }
         }
+        // unused bins kept by `evictUnused`, free space for a sprite without it..
+        for (Bin* pbin : unused) {
+            if (evictUnused_) {
+                unused_.push(pbin);
+            } else {
+                release(*pbin);
+            }
+        }
+        return true;
+    }
+
+
+private:
+
+    /**
+     * Called by forEachBin() and forEachFreebin() to visit bins in `order`
+     *
+     * @private
+     * @param    {function}     each    Calls its argument with a pointer to each bin
+     * @param    {function}     fn      Called with each bin
+     * @param    {VisitOrder}   order   Order to visit the bins in
+     */
+    template <typename Each, typename Fn>
+    void visit(Each each, Fn& fn, VisitOrder order) const {
+        if (order == VisitOrder::Any) {
+            each([&fn](const Bin* bin) { fn(*bin); });
+            return;
+        }
+        // sorted in a buffer of this call, so visits may nest, or run on several threads..
+        std::vector<std::pair<uint64_t, const Bin*>> visited;
+        each([&visited](const Bin* bin) {
+            visited.emplace_back((uint64_t(uint32_t(bin->y)) << 32) | uint32_t(bin->x), bin);
+        });
+        std::sort(visited.begin(), visited.end());
+        for (const auto& bin : visited) {
+            fn(*bin.second);
+        }
+    }
+
+    // snapshot layout, see `serialize()`..
+    enum : int32_t { kSnapshotFormat = 4 };
+    enum : std::size_t {
+        kSnapshotCounters = 12,
+        kSnapshotHeader = 76 + kSnapshotCounters * sizeof(uint64_t),   // magic, format, version, sizes, counts, grid
+        kSnapshotShelf = 3 * sizeof(int32_t),                          // y, h, x
+        kSnapshotBin = 8 * sizeof(int32_t)                             // id, refcount, w, h, maxw, maxh, x, y
+    };
+
+    // changes recorded while a transaction is open, see `undo()`..
+    enum class UndoOp : uint8_t {
+        Ref,            // bin's refcount was incremented
+        Unref,          // bin's refcount was decremented
+        Insert,         // bin was added to the used bins
+        Erase,          // bin was removed from the used bins
+        PushFreebin,    // bin was added to the free bins
+        EraseFreebin,   // bin was removed from the free bins, `saved` has its links
+        Create,         // bin was created in the pool
+        Recycle,        // bin was given back to the pool, `saved` has its fields
+        Fields,         // bin's fields are about to change, `saved` has them
+        ShelfFields,    // shelf's `x` is about to change, `shelf` has it
+        AddShelf,       // shelf was added at the bottom
+        PopShelf,       // bottom shelf is about to be removed, `shelf` has it
+        Retain,         // bin was added to the unused bins
+        Unretain        // bin was removed from the unused bins, `saved` has its links
+    };
+
+    struct Undo {
+        UndoOp op;
+        Bin* bin;
+        Bin saved;
+        std::size_t index;
+        int32_t shelf[3];   // y, h, x
+    };
+
+    struct DirtySpan {
+        int32_t x0 = 0;
+        int32_t y = 0;
+        int32_t h = 0;
+        int32_t x1 = 0;   // empty if not past `x0`
+    };
+
+    struct Savepoint {
+        std::size_t journal;
+        int32_t maxId;
+        int32_t width;
+        int32_t height;
+        int32_t nextShelfY;
+        int32_t usedWidth;
+        int32_t narrowest;
+        uint32_t freeStamp;
+        std::size_t histogram;
+#ifdef SHELF_PACK_STATS
+        ShelfPackStats counters;
+#endif
+    };
 
-        if (best.pfreebin) {
-            return allocFreebin(best.pfreebin, id, w, h);
-        }
 
-        if (best.pshelf) {
-            return allocShelf(*best.pshelf, id, w, h);
+    void record(UndoOp op, Bin* bin) {
+        if (!savepoints_.empty()) {
+            journal_.push_back(Undo{ op, bin, *bin, 0, { 0, 0, 0 } });
         }
+    }
 
-        // No free bins or shelves.. add shelf..
-        if (h <= (height_ - y) && w <= width_) {
-            shelves_.emplace_back(y, width_, h);
-            return allocShelf(shelves_.back(), id, w, h);
+    void recordShelf(UndoOp op, std::size_t index) {
+        if (!savepoints_.empty()) {
+            const Shelf& shelf = shelves_[index];
+            journal_.push_back(Undo{ op, nullptr, Bin(), index,
+                { shelf.y_, shelf.h_, shelf.x_ } });
         }
+    }
 
-        // No room for more shelves..
-        // If `autoResize` option is set, grow the sprite as follows:
-        //  * double whichever sprite dimension is smaller (`w1` or `h1`)
-        //  * if sprite dimensions are equal, grow width before height
-        //  * accomodate very large bin requests (big `w` or `h`)
-        if (autoResize_) {
-            int32_t h1, h2, w1, w2;
+    void recycle(Bin* bin) {
+        record(UndoOp::Recycle, bin);
+        pool_.recycle(bin);
+    }
 
-            h1 = h2 = height_;
-            w1 = w2 = width_;
 
-            if (w1 <= h1 || w > w1) {   // grow width..
-                w2 = std::max(w, w1) * 2;
+    /**
+     * Called by rollback() to revert one recorded change.  Changes are reverted newest first,
+     * so everything a change touched is as it was right after the change.
+     *
+     * @private
+     * @param    {Undo}   change   Recorded change
+     */
+    void undo(const Undo& change) {
+        Bin* bin = change.bin;
+        auto restoreFields = [bin](const Bin& saved) {
+            bin->id = saved.id;
+            bin->w = saved.w;
+            bin->h = saved.h;
+            bin->maxw = saved.maxw;
+            bin->maxh = saved.maxh;
+            bin->x = saved.x;
+            bin->y = saved.y;
+            bin->refcount_ = saved.refcount_;
+            bin->handle_ = saved.handle_;
+        };
+
+        switch (change.op) {
+            case UndoOp::Ref:
+                if (--bin->refcount_ == 0 && bin->h >= 0) {
+                    stats_[std::size_t(bin->h)]--;
+                }
+                break;
+            case UndoOp::Unref:
+                if (bin->refcount_++ == 0 && bin->h >= 0 && std::size_t(bin->h) < stats_.size()) {
+                    stats_[std::size_t(bin->h)]++;
+                }
+                break;
+            case UndoOp::Insert:
+                usedbins_.erase(bin->id);
+                handleSlots_.unacquire(bin->handle_);   // handles given out since `begin()` do not come back
+                break;
+            case UndoOp::Erase:
+                usedbins_.insert(bin->id, bin);
+                handleSlots_.unrelease(bin->handle_, bin);
+                break;
+            case UndoOp::PushFreebin:
+                freebins_.erase(bin);
+                if (mergeFreebins_) {
+                    freeedges_.erase(bin);
+                }
+                break;
+            case UndoOp::EraseFreebin:
+                freebins_.restore(bin, change.saved.prevFree_, change.saved.nextFree_, change.saved.freeStamp_);
+                if (mergeFreebins_) {
+                    freeedges_.insert(bin);
+                }
+                break;
+            case UndoOp::Create:
+                pool_.recycle(bin);
+                break;
+            case UndoOp::Recycle:
+                pool_.reclaim(bin);
+                restoreFields(change.saved);
+                break;
+            case UndoOp::Fields:
+                restoreFields(change.saved);
+                break;
+            case UndoOp::ShelfFields: {
+                Shelf& shelf = shelves_[change.index];
+                shelf.x_ = change.shelf[2];
+                buckets_.update(shelf.h(), shelf.slot_);
+                break;
             }
-            if (h1 < w1 || h > h1) {    // grow height..
-                h2 = std::max(h, h1) * 2;
+            case UndoOp::AddShelf:
+                buckets_.pop(shelves_.back().h());
+                shelves_.pop_back();
+                break;
+            case UndoOp::PopShelf: {
+                shelves_.emplace_back(change.shelf[0], &width_, change.shelf[1], pool_);
+                Shelf& shelf = shelves_.back();
+                shelf.x_ = change.shelf[2];
+                shelf.slot_ = buckets_.push(&shelf);
+                break;
             }
+            case UndoOp::Retain:
+                unused_.erase(bin);
+                break;
+            case UndoOp::Unretain:
+                unused_.restore(bin, change.saved.prevFree_, change.saved.nextFree_, change.saved.freeStamp_);
+                break;
+        }
+    }
 
-            resize(w2, h2);
-            return packOne(id, w, h);  // retry
+
+    /**
+     * Called by pack() to pack a single requested bin
+     *
+     * @private
+     * @param    {Bin&}          bin      Requested bin with `id`, `w`, `h` values
+     * @returns  {Bin*}          Pointer to the packed Bin, or nullptr if skipped or out of space
+     */
+    Bin* packBin(const Bin& bin) {
+        if (bin.w <= 0 || bin.h <= 0) {
+            return nullptr;
         }
+        return packOne(bin.id, bin.w, bin.h);
+    }
 
-        return nullptr;
+
+    /**
+     * Called by ref() and when packing, to increment the ref count of a bin that is not
+     * an unused bin kept by `evictUnused`.
+     *
+     * @private
+     * @param    {Bin&}      bin  Bin reference
+     * @returns  {int32_t}   New refcount of the bin
+     */
+    int32_t addRef(Bin& bin) {
+        record(UndoOp::Ref, &bin);
+        if (++bin.refcount_ == 1) {   // a new Bin.. record height in stats historgram..
+            int32_t h = bin.h;
+            if (h >= 0) {
+                if (std::size_t(h) >= stats_.size()) {
+                    stats_.resize(std::max(std::size_t(h) + 1, stats_.size() * 2), 0);
+                }
+                stats_[h]++;
+            }
+            SHELF_PACK_COUNT(usedArea, int64_t(bin.w) * bin.h);
+            SHELF_PACK_COUNT(slackArea, int64_t(bin.maxw) * bin.maxh - int64_t(bin.w) * bin.h);
+        }
+
+        return bin.refcount_;
     }
 
 
+
     /**
+     * Called by unref() to decrement the ref count of a referenced bin.
      *
-     * Shrink the width/height of the sprite to the bare minimum.
-     * Since shelf-pack doubles first width, then height when running out of shelf space
-     * this can result in fairly large unused space both in width and height if that happens
-     * towards the end of bin packing.
+     * @private
+     * @param    {Bin&}   bin  Bin reference, with a refcount above 0
+     * @returns  {bool}   `true` if the refcount reached 0
      */
-    void shrink() {
-        if (shelves_.size()) {
-            int32_t w2 = 0;
-            int32_t h2 = 0;
+    bool dropRef(Bin& bin) {
+        record(UndoOp::Unref, &bin);
+        if (--bin.refcount_ > 0) {
+            return false;
+        }
+        int32_t h = bin.h;
+        if (h >= 0 && std::size_t(h) < stats_.size()) {
+            stats_[h]--;
+        }
+        SHELF_PACK_COUNT(usedArea, -int64_t(bin.w) * bin.h);
+        SHELF_PACK_COUNT(slackArea, int64_t(bin.w) * bin.h - int64_t(bin.maxw) * bin.maxh);
+        return true;
+    }
 
-            for (auto& shelf : shelves_) {
-                h2 += shelf.h();
-                w2 = std::max(shelf.w() - shelf.wfree(), w2);
-            }
 
-            resize(w2, h2);
+    /**
+     * Called by unref() and evictions to mark a bin that is no longer referenced as free space
+     *
+     * @private
+     * @param    {Bin&}   bin  Bin reference, with a refcount of 0
+     */
+    void release(Bin& bin) {
+        eraseUsedbin(bin);
+        if (mergeFreebins_) {
+            mergeFreebin(&bin);
+        } else {
+            pushFreebin(&bin);
         }
     }
 
 
     /**
-     * Return a packed bin given its id, or nullptr if the id is not found
+     * Called by packOne() to add the gutter to a bin size and round it up to the alignment
      *
-     * @param    {int32_t}  id  Unique identifier for this bin,
-     * @returns  {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members
+     * @private
+     * @param    {int32_t}    v   Width or height of the bin
+     * @returns  {int32_t}    Padded size, or the largest aligned size if that would overflow
+     */
+    int32_t padded(int32_t v) const {
+        int64_t mask = int64_t(alignment_) - 1;
+        int64_t size = std::min((int64_t(v) + 2 * int64_t(gutter_) + mask) & ~mask,
+            int64_t(std::numeric_limits<int32_t>::max()) & ~mask);
+        return int32_t(size);
+    }
+
+
+    void eraseUsedbin(Bin& bin) {
+        record(UndoOp::Erase, &bin);
+        usedbins_.erase(bin.id);
+        handleSlots_.release(bin.handle_);
+    }
+
+
+    void evictBin(Bin& bin) {
+        record(UndoOp::Unretain, &bin);
+        unused_.erase(&bin);
+        release(bin);
+        SHELF_PACK_COUNT(evictions, 1);
+    }
+
+
+    /**
+     * Called by packOne() to pack a bin on a free bin or a shelf, without growing the sprite
      *
-     * @example
-     * Bin* result = sprite.getBin(5);
+     * @private
+     * @param    {int32_t}    id        Unique identifier for this bin
+     * @param    {int32_t}    w         Width of the bin to allocate
+     * @param    {int32_t}    h         Height of the bin to allocate
+     * @returns  {Bin*}       Pointer to the packed Bin, or nullptr if there is no room
      */
-    Bin* getBin(int32_t id) {
-        std::map<int32_t, Bin*>::iterator it = usedbins_.find(id);
-        return (it == usedbins_.end()) ? nullptr : it->second;
+    Bin* place(int32_t id, int32_t w, int32_t h) {
+        // First try to reuse a free bin..
+#ifdef SHELF_PACK_STATS
+        std::size_t scanned = 0;
+        Bin* pfreebin = freebins_.find(w, h, &scanned);
+        counters_.freebinsScanned += scanned;
+#else
+        Bin* pfreebin = freebins_.find(w, h);
+#endif
+        if (pfreebin && pfreebin->maxw == w && pfreebin->maxh == h) {
+            // exactly the right height and width, use it..
+            SHELF_PACK_COUNT(exactFreebins, 1);
+            return allocFreebin(pfreebin, id, w, h);
+        }
+
+        return packShelf(id, w, h, pfreebin);
     }
 
 
     /**
-     * Increment the ref count of a bin and update statistics.
+     * Called by packOne() when there is no room, to evict unused bins until the bin fits.
+     * The least recently used bin that is large enough is evicted first.  Failing that,
+     * with `mergeFreebins` the least recently used bins are evicted one by one, as their
+     * space can merge into a large enough free bin, until the bin fits or none are left.
      *
-     * @param    {Bin&}      bin  Bin reference
-     * @returns  {int32_t}   New refcount of the bin
+     * @private
+     * @param    {int32_t}    id        Unique identifier for this bin
+     * @param    {int32_t}    w         Width of the bin to allocate
+     * @param    {int32_t}    h         Height of the bin to allocate
+     * @returns  {Bin*}       Pointer to the packed Bin, or nullptr if there is no room
+     */
+    Bin* placeEvicting(int32_t id, int32_t w, int32_t h) {
+        Bin* victim = unused_.find(w, h);
+        if (victim) {
+            evictBin(*victim);
+            return place(id, w, h);
+        }
+
+        if (mergeFreebins_) {
+            while (!unused_.empty()) {
+                evictBin(*unused_.front());
+                Bin* pbin = place(id, w, h);
+                if (pbin) {
+                    return pbin;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+
+    /**
+     * Called by packOne() to pack a bin on the best shelf, or on a free bin
+     * that fits with extra width or height.  Opens a new shelf if needed.
      *
-     * @example
-     * Bin* bin = sprite.getBin(5);
-     * if (bin) {
-     *     sprite.ref(*bin);
-     * }
+     * @private
+     * @param    {int32_t}    id        Unique identifier for this bin
+     * @param    {int32_t}    w         Width of the bin to allocate
+     * @param    {int32_t}    h         Height of the bin to allocate
+     * @param    {Bin*}       pfreebin  Least wasteful free bin that fits, or nullptr
+     * @returns  {Bin*}       Pointer to the packed Bin, or nullptr if there is no room
      */
-    int32_t ref(Bin& bin) {
-        if (++bin.refcount_ == 1) {   // a new Bin.. record height in stats historgram..
-            int32_t h = bin.h;
-            stats_[h] = (stats_[h] | 0) + 1;
+    Bin* packShelf(int32_t id, int32_t w, int32_t h, Bin* pfreebin) {
+        // exactly the right height, pack it..
+        Shelf* pshelf = findShelf(w, h, true);
+        if (pshelf) {
+            SHELF_PACK_COUNT(exactShelves, 1);
+            return allocShelf(*pshelf, id, w, h);
         }
 
-        return bin.refcount_;
-    };
+        // extra height or width, a fitting free bin is preferred over a taller shelf..
+        if (pfreebin) {
+            SHELF_PACK_COUNT(bestFreebins, 1);
+            return allocFreebin(pfreebin, id, w, h);
+        }
+
+        // extra height, minimize wasted area..
+        pshelf = findShelf(w, h, false);
+        if (pshelf) {
+            SHELF_PACK_COUNT(tallerShelves, 1);
+            return allocShelf(*pshelf, id, w, h);
+        }
+
+        // No free bins or shelves.. add shelf..
+        if (h <= (height_ - nextShelfY_) && w <= width_) {
+            SHELF_PACK_COUNT(newShelves, 1);
+            return allocShelf(addShelf(h), id, w, h);
+        }
+
+        return nullptr;
+    }
 
 
     /**
-     * Decrement the ref count of a bin and update statistics.
-     * The bin will be automatically marked as free space once the refcount reaches 0.
-     * Memory for the bin is not freed, as unreferenced bins may be reused later.
+     * Called by packShelf() and compact() to find the topmost shelf with room for a bin,
+     * either among the shelves of exactly the bin's height, or among the shortest taller
+     * shelves that have room.
+     * Buckets are ordered by height, so the first taller bucket with any room holds the
+     * best fit, and within each bucket the topmost shelf wins.
      *
-     * @param    {Bin&}     bin  Bin reference
-     * @returns  {int32_t}  New refcount of the bin
+     * @private
+     * @param    {int32_t}    w       Width of the bin
+     * @param    {int32_t}    h       Height of the bin
+     * @param    {bool}       exact   If `true` only look at shelves of height `h`, otherwise only taller ones
+     * @returns  {Shelf*}     Pointer to the shelf, or nullptr if none has room
+     */
+    Shelf* findShelf(int32_t w, int32_t h, bool exact) {
+        if (w < narrowest_ && !minBinWidth_) {
+            // shelves retired for having no room for any earlier bin may have room for this one..
+            narrowest_ = w;
+            buckets_.limit(width_ - w);
+        }
+#ifdef SHELF_PACK_STATS
+        std::size_t scanned = 0;
+        Shelf* pshelf = buckets_.find(h, width_ - w, exact, &scanned);
+        counters_.bucketsScanned += scanned;
+        return pshelf;
+#else
+        return buckets_.find(h, width_ - w, exact);
+#endif
+    }
+
+
+    /**
+     * Called by compact() to move a live bin to the best free bin or shelf for it,
+     * following the same rules as `packOne()`, but without opening new shelves.
      *
-     * @example
-     * Bin* bin = sprite.getBin(5);
-     * if (bin) {
-     *     sprite.unref(*bin);
-     * }
+     * @private
+     * @param    {Bin&}            bin    Bin to move, on a shelf that is out of the running
+     * @param    {vector<Bin*>}    dead   Collects the bins that are no longer used
+     * @returns  {bool}            `true` if the bin was moved, `false` if there is no room for it
      */
-    int32_t unref(Bin& bin) {
-        if (bin.refcount_ == 0) {
-            return 0;
+    bool relocate(Bin& bin, std::vector<Bin*> &dead) {
+        auto takeShelf = [&](Shelf& shelf) {
+            Bin* slot = shelf.alloc(bin.id, bin.w, bin.h);
+            SHELF_PACK_COUNT(shelfUpdates, 1);
+            buckets_.update(shelf.h(), shelf.slot_);
+            usedWidth_ = std::max(shelf.x(), usedWidth_);
+            return slot;
+        };
+
+        Bin* target = nullptr;
+        Bin* pfreebin = freebins_.find(bin.w, bin.h);
+        Shelf* pshelf = nullptr;
+        if (pfreebin && pfreebin->maxw == bin.w && pfreebin->maxh == bin.h) {
+            target = pfreebin;
+        } else if ((pshelf = findShelf(bin.w, bin.h, true))) {
+            target = takeShelf(*pshelf);
+        } else if (pfreebin) {
+            target = pfreebin;
+        } else if ((pshelf = findShelf(bin.w, bin.h, false))) {
+            target = takeShelf(*pshelf);
+        } else {
+            return false;
         }
 
-        if (--bin.refcount_ == 0) {
-            stats_[bin.h]--;
-            usedbins_.erase(bin.id);
-            freebins_.push_back(&bin);
+        if (target == pfreebin) {
+            eraseFreebin(target);
         }
+        SHELF_PACK_COUNT(slackArea, int64_t(target->maxw) * target->maxh - int64_t(bin.maxw) * bin.maxh);
 
-        return bin.refcount_;
+        bin.x = target->x;
+        bin.y = target->y;
+        bin.maxw = target->maxw;
+        bin.maxh = target->maxh;
+        target->y = -1;
+        dead.push_back(target);
+        return true;
     }
 
 
     /**
-     * Clear the sprite and reset statistics.
+     * Called by compact() to find the index of the shelf at `y`
      *
-     * @example
-     * sprite.clear();
+     * @private
+     * @param    {int32_t}   y   Top coordinate of a bin
+     * @returns  {size_t}    Index of the shelf in `shelves_`
      */
-    void clear() {
-        shelves_.clear();
-        freebins_.clear();
-        usedbins_.clear();
-        stats_.clear();
-        maxId_ = 0;
+    std::size_t shelfIndex(int32_t y) const {
+        auto shelf = std::upper_bound(shelves_.begin(), shelves_.end(), y,
+            [](int32_t y1, const Shelf& s) { return y1 < s.y(); });
+        return std::size_t(shelf - shelves_.begin()) - 1;
     }
 
 
     /**
-     * Resize the sprite.
-     *
-     * @param   {int32_t}  w  Requested new sprite width
-     * @param   {int32_t}  h  Requested new sprite height
-     * @returns {bool}     `true` if resize succeeded, `false` if failed
+     * Grow `w1` x `h1` with the `Growth` policy, until `fits(w1, h1)`.
      *
-     * @example
-     * sprite.resize(256, 256);
+     * @private
+     * @param    {int32_t&}   w1     Width to grow
+     * @param    {int32_t&}   h1     Height to grow
+     * @param    {int32_t}    w      Width of the largest bin to accomodate
+     * @param    {int32_t}    h      Height of the largest bin to accomodate
+     * @param    {function}   fits   Returns `true` once a size is big enough
+     * @returns  {bool}       `true` if a big enough size was found, `false` if it would not fit `Coord`
      */
-    bool resize(int32_t w, int32_t h) {
-        width_ = w;
-        height_ = h;
-        for (auto& shelf : shelves_) {
-            shelf.resize(width_);
-        }
+    template <typename Fits>
+    static bool grow(int32_t& w1, int32_t& h1, int32_t w, int32_t h, Fits fits) {
+        const int64_t limit = std::min<int64_t>(std::numeric_limits<Coord>::max(), std::numeric_limits<int32_t>::max());
+        int64_t w2 = w1, h2 = h1;
+        do {
+            int64_t w3 = w2, h3 = h2;
+            Growth::grow(w2, h2, w, h);
+            if (w2 > limit || h2 > limit || (w2 <= w3 && h2 <= h3)) {
+                return false;
+            }
+        } while (!fits(int32_t(w2), int32_t(h2)));
+
+        w1 = int32_t(w2);
+        h1 = int32_t(h2);
         return true;
     }
 
-    int32_t width() const { return width_; }
-    int32_t height() const { return height_; }
 
+    /**
+     * Called by pack() to grow an `autoResize` sprite up front, so that it can
+     * hold the area already in use plus the total area of the requested bins.
+     *
+     * @private
+     * @param    {size_t}     count   Number of requested bins
+     * @param    {function}   width   Returns the width of the bin at an index
+     * @param    {function}   height  Returns the height of the bin at an index
+     */
+    template <typename Width, typename Height>
+    void presize(std::size_t count, Width width, Height height) {
+        if (!autoResize_) {
+            return;
+        }
+        int64_t area = int64_t(width_) * nextShelfY_;
+        int32_t maxw = 0, maxh = 0;
+        for (std::size_t i = 0; i < count; i++) {
+            int32_t w = width(i), h = height(i);
+            if (w > 0 && h > 0) {
+                area += int64_t(w) * h;
+                maxw = std::max(w, maxw);
+                maxh = std::max(h, maxh);
+            }
+        }
+
+        int32_t w2 = width_, h2 = height_;
+        auto fits = [&](int32_t w1, int32_t h1) {
+            return maxw <= w1 && maxh <= h1 && area <= int64_t(w1) * h1;
+        };
+        if (!fits(w2, h2) && grow(w2, h2, maxw, maxh, fits)) {
+            resize(w2, h2);
+        }
+    }
 
-private:
 
     /**
      * Called by packOne() to allocate a bin by reusing an existing freebin
@@ -483,20 +3962,204 @@ private:
      * Bin* bin = sprite.allocFreebin(pfreebin, 12, 16, 5);
      */
     Bin* allocFreebin(Bin* bin, int32_t id, int32_t w, int32_t h) {
-        freebins_.erase(std::remove(freebins_.begin(), freebins_.end(), bin), freebins_.end());
+        eraseFreebin(bin);
+        record(UndoOp::Fields, bin);
+        if (splitFreebins_ && bin->maxw > w) {
+            // give the leftover width back as a free bin of its own..
+            Bin* rest = pool_.create(-1, bin->maxw - w, bin->maxh, bin->maxw - w, bin->maxh, bin->x + w, bin->y);
+            record(UndoOp::Create, rest);
+            bin->maxw = w;
+            if (mergeFreebins_) {
+                mergeFreebin(rest);
+            } else {
+                pushFreebin(rest);
+            }
+        }
         bin->id = id;
         bin->w = w;
         bin->h = h;
         bin->refcount_ = 0;
-        usedbins_[id] = bin;
-        ref(*bin);
+        record(UndoOp::Insert, bin);
+        usedbins_.insert(id, bin);
+        acquireHandle(bin);
+        addRef(*bin);
+        if (trackDirty_) {
+            markDirty(shelfIndex(bin->y), *bin);
+        }
         return bin;
     }
 
 
+    /**
+     * Called by allocShelf() and allocFreebin() to add a packed bin to the dirty row of its shelf
+     *
+     * @private
+     * @param    {size_t}     row    Index of the bin's shelf
+     * @param    {Bin&}       bin    The packed bin
+     */
+    void markDirty(std::size_t row, const Bin& bin) {
+        if (dirty_.size() <= row) {
+            dirty_.resize(row + 1);
+        }
+        DirtySpan& span = dirty_[row];
+        if (span.x1 <= span.x0 || span.y != bin.y) {
+            // a rolled back shelf may have left a row at this index behind..
+            if (span.x1 <= span.x0) {
+                dirtyRows_.push_back(row);
+            }
+            span = DirtySpan{ int32_t(bin.x), int32_t(bin.y), int32_t(bin.h), int32_t(bin.x + bin.w) };
+            return;
+        }
+        span.x0 = std::min(span.x0, int32_t(bin.x));
+        span.x1 = std::max(span.x1, int32_t(bin.x + bin.w));
+        span.h = std::max(span.h, int32_t(bin.h));
+    }
+
+
+    /**
+     * Called by the move constructor and move assignment to take over `other`'s state.
+     * Shelves point at the pool they allocate from and the width they take,
+     * so they are pointed at this sprite's.
+     *
+     * @private
+     * @param    {BasicShelfPack&}   other   Sprite to move from, left empty
+     */
+    void moveFrom(BasicShelfPack& other) {
+        width_ = other.width_;
+        height_ = other.height_;
+        maxId_ = other.maxId_;
+        nextShelfY_ = other.nextShelfY_;
+        usedWidth_ = other.usedWidth_;
+        autoResize_ = other.autoResize_;
+        splitFreebins_ = other.splitFreebins_;
+        mergeFreebins_ = other.mergeFreebins_;
+        minBinWidth_ = other.minBinWidth_;
+        narrowest_ = other.narrowest_;
+        savepoints_ = std::move(other.savepoints_);
+        journal_ = std::move(other.journal_);
+        trackDirty_ = other.trackDirty_;
+        handles_ = other.handles_;
+        evictUnused_ = other.evictUnused_;
+        alignment_ = other.alignment_;
+        gutter_ = other.gutter_;
+        dirty_ = std::move(other.dirty_);
+        dirtyRows_ = std::move(other.dirtyRows_);
+        pool_ = std::move(other.pool_);
+        shelves_ = std::move(other.shelves_);
+        buckets_ = std::move(other.buckets_);
+        usedbins_ = std::move(other.usedbins_);
+        handleSlots_ = std::move(other.handleSlots_);
+        freebins_ = std::move(other.freebins_);
+        freeedges_ = std::move(other.freeedges_);
+        unused_ = std::move(other.unused_);
+        stats_ = std::move(other.stats_);
+        order_ = std::move(other.order_);
+        unrefd_ = std::move(other.unrefd_);
+#ifdef SHELF_PACK_STATS
+        counters_ = other.counters_;
+#endif
+        for (auto& shelf : shelves_) {
+            shelf.pool_ = &pool_;
+            shelf.width_ = &width_;
+        }
+
+        other.clear();
+        other.narrowest_ = std::numeric_limits<int32_t>::max();
+        other.buckets_.limit(other.width_ - (other.minBinWidth_ ? other.minBinWidth_ : other.narrowest_));
+    }
+
+
+    void acquireHandle(Bin* bin) {
+        bin->handle_ = handles_ ? handleSlots_.acquire(bin) : 0;
+    }
+
+
+    /**
+     * Add a bin to the free bins
+     *
+     * @private
+     * @param    {Bin*}       bin    Pointer to a bin with a refcount of 0
+     */
+    void pushFreebin(Bin* bin) {
+        record(UndoOp::PushFreebin, bin);
+        freebins_.push(bin);
+        if (mergeFreebins_) {
+            freeedges_.insert(bin);
+        }
+        SHELF_PACK_COUNT(freebinArea, int64_t(bin->maxw) * bin->maxh);
+    }
+
+
+    /**
+     * Remove a bin from the free bins
+     *
+     * @private
+     * @param    {Bin*}       bin    Pointer to a bin added with `pushFreebin()`
+     */
+    void eraseFreebin(Bin* bin) {
+        record(UndoOp::EraseFreebin, bin);
+        freebins_.erase(bin);
+        if (mergeFreebins_) {
+            freeedges_.erase(bin);
+        }
+        SHELF_PACK_COUNT(freebinArea, -int64_t(bin->maxw) * bin->maxh);
+    }
+
+
+    /**
+     * Called by unref() to free a bin, merging it with the free bins on either side of it.
+     * If the merged bin reaches the end of its shelf, the space goes back to the shelf
+     * instead, and the shelf is removed if it is empty and the bottom one.
+     *
+     * @private
+     * @param    {Bin*}       bin    Pointer to a bin with a refcount of 0
+     */
+    void mergeFreebin(Bin* bin) {
+        record(UndoOp::Fields, bin);
+        Bin* left = freeedges_.endingAt(bin->x, bin->y);
+        if (left && left->maxh == bin->maxh) {
+            eraseFreebin(left);
+            bin->x = left->x;
+            bin->maxw += left->maxw;
+            recycle(left);
+        }
+        Bin* right = freeedges_.startingAt(bin->x + bin->maxw, bin->y);
+        if (right && right->maxh == bin->maxh) {
+            eraseFreebin(right);
+            bin->maxw += right->maxw;
+            recycle(right);
+        }
+
+        std::size_t index = shelfIndex(bin->y);
+        Shelf& shelf = shelves_[index];
+        if (bin->x + bin->maxw != shelf.x_) {
+            pushFreebin(bin);
+            return;
+        }
+
+        // the end of the shelf is free, give it back..
+        recordShelf(UndoOp::ShelfFields, index);
+        shelf.x_ = bin->x;
+        SHELF_PACK_COUNT(shelfUpdates, 1);
+        buckets_.update(shelf.h(), shelf.slot_);
+        recycle(bin);
+
+        while (!shelves_.empty() && shelves_.back().x() == 0) {
+            Shelf& last = shelves_.back();
+            recordShelf(UndoOp::PopShelf, shelves_.size() - 1);
+            if (shelves_.size() <= dirty_.size()) {
+                dirty_[shelves_.size() - 1] = DirtySpan{};   // nothing left to upload
+            }
+            buckets_.pop(last.h());
+            nextShelfY_ = last.y();
+            shelves_.pop_back();
+        }
+    }
+
+
     /**
      * Called by `packOne() to allocate bin on an existing shelf
-     * Memory for the bin is allocated on the heap by `shelf.alloc()`
+     * Memory for the bin is allocated from the sprite's bin pool by `shelf.alloc()`
      *
      * @private
      * @param    {Shelf&}    shelf  Reference to the shelf to allocate the bin on
@@ -509,27 +4172,89 @@ private:
      * Bin* bin = sprite.allocShelf(shelf, 12, 16, 5);
      */
     Bin* allocShelf(Shelf& shelf, int32_t id, int32_t w, int32_t h) {
+        if (!savepoints_.empty()) {
+            recordShelf(UndoOp::ShelfFields, shelfIndex(shelf.y()));
+        }
         Bin* pbin = shelf.alloc(id, w, h);
         if (pbin) {
-            usedbins_[id] = pbin;
-            ref(*pbin);
+            SHELF_PACK_COUNT(shelfUpdates, 1);
+            record(UndoOp::Create, pbin);
+            record(UndoOp::Insert, pbin);
+            buckets_.update(shelf.h(), shelf.slot_);
+            usedWidth_ = std::max(shelf.x(), usedWidth_);
+            usedbins_.insert(id, pbin);
+            acquireHandle(pbin);
+            addRef(*pbin);
+            if (trackDirty_) {
+                markDirty(shelfIndex(shelf.y()), *pbin);
+            }
         }
         return pbin;
     }
 
 
+    /**
+     * Called by `packOne()` to open a new shelf below the existing ones
+     *
+     * @private
+     * @param    {int32_t}   h      Height of the new shelf
+     * @returns  {Shelf&}    Reference to the new shelf
+     */
+    Shelf& addShelf(int32_t h) {
+        shelves_.emplace_back(nextShelfY_, &width_, h, pool_);
+        nextShelfY_ += h;
+
+        Shelf& shelf = shelves_.back();
+        shelf.slot_ = buckets_.push(&shelf);
+        recordShelf(UndoOp::AddShelf, shelves_.size() - 1);
+        return shelf;
+    }
+
+
     int32_t width_;
     int32_t height_;
     int32_t maxId_;
+    int32_t nextShelfY_;
+    int32_t usedWidth_;   // widest shelf, i.e. max `x` over all shelves
     bool autoResize_;
+    bool splitFreebins_;
+    bool mergeFreebins_;
+    int32_t minBinWidth_;
+    int32_t narrowest_ = std::numeric_limits<int32_t>::max();   // narrowest bin searched for, if `minBinWidth_` is 0
+    std::vector<Savepoint> savepoints_;                           // open transactions, innermost last
+    std::vector<Undo> journal_;                                   // changes since the outermost `begin()`
+    bool trackDirty_;
+    bool handles_;
+    bool evictUnused_;
+    int32_t alignment_;                                           // power of 2
+    int32_t gutter_;
+    std::vector<DirtySpan> dirty_;                                // per shelf, bins packed since `takeDirtyRegions()`
+    std::vector<std::size_t> dirtyRows_;                          // shelves with a dirty row
 
+    detail::BinPool<Bin> pool_;
     std::deque<Shelf> shelves_;
-    std::map<int32_t, Bin*> usedbins_;
-    std::vector<Bin*> freebins_;
-    std::map<int32_t, int32_t> stats_;
+    detail::ShelfBuckets<Shelf> buckets_;
+    detail::BinIdIndex<Bin> usedbins_;
+    detail::BinHandles<Bin> handleSlots_;
+    detail::FreebinIndex<Bin> freebins_;
+    detail::FreebinEdges<Bin> freeedges_;
+    detail::BinLru<Bin> unused_;                                  // packed bins with a refcount of 0, see `evictUnused`
+    std::vector<int32_t> stats_;
+    std::vector<std::size_t> order_;
+    std::vector<Bin*> unrefd_;                                    // scratch space of the batch `unref()`
+#ifdef SHELF_PACK_STATS
+    ShelfPackStats counters_;
+#endif
 };
 
+using ShelfPack = BasicShelfPack<>;
+
 
 }  // namespace mapbox
 
+#undef SHELF_PACK_COUNT
+#undef SHELF_PACK_AVX2
+#undef SHELF_PACK_SSE2
+#undef SHELF_PACK_NEON
+
 #endif
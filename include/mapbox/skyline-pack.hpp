@@ -0,0 +1,477 @@
+#ifndef SKYLINE_PACK_HPP
+#define SKYLINE_PACK_HPP
+
+#include <mapbox/shelf-pack.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace mapbox {
+
+
+class SkylinePack {
+public:
+
+    using PackOptions = ShelfPack::PackOptions;
+    using SortStrategy = ShelfPack::SortStrategy;
+
+
+    /**
+     * Create a new Skyline bin allocator.
+     *
+     * Uses the Skyline Bottom-Left algorithm from
+     * http://clb.demon.fi/files/RectangleBinPack.pdf
+     *
+     * The sprite keeps the top edge of the packed bins as a skyline, and places each bin
+     * where its top is lowest, leftmost first.  Gaps left below the skyline, and bins freed
+     * by `unref()`, become free bins.  Free bins are reused first, least wasteful first, and
+     * are split so that the leftover width and height stay free.  A bin freed by `unref()`
+     * merges back with the free bins next to it that share a whole edge, so the pieces of a
+     * split free bin end up whole again.
+     * This packs mixed heights denser than `ShelfPack`, at some cost in speed.
+     *
+     * Shares `Bin`, `packOne()`, `pack()`, `getBin()`, `ref()`, `unref()` with `ShelfPack`.
+     * The sprite never grows by itself, see `resize()`.
+     *
+     * @class  SkylinePack
+     * @param  {int32_t}  [w=64]  Width of the sprite
+     * @param  {int32_t}  [h=64]  Height of the sprite
+     *
+     * @example
+     * SkylinePack sprite(1024, 1024);
+     * Bin* bin = sprite.packOne(-1, 12, 16);
+     */
+    explicit SkylinePack(int32_t w = 0, int32_t h = 0) :
+        width_(w > 0 ? w : 64),
+        height_(h > 0 ? h : 64),
+        maxId_(0),
+        usedWidth_(0),
+        usedHeight_(0) {
+        skyline_.push_back(Segment{ 0, 0, width_ });
+    }
+
+
+    /**
+     * Batch pack multiple bins into the sprite.
+     *
+     * @param   {vector<Bin>}   bins   Array of requested bins - each object should have `w`, `h` values
+     * @param   {PackOptions}   [options]  Same as `ShelfPack::pack()`, `presize` has no effect
+     * @returns {vector<Bin*>}   Array of Bin pointers - each bin is a struct with `x`, `y`, `w`, `h` values
+     *
+     * @example
+     * SkylinePack::PackOptions options;
+     * options.sort = SkylinePack::SortStrategy::HeightDesc;
+     * std::vector<Bin*> results = sprite.pack(bins, options);
+     */
+    std::vector<Bin*> pack(std::vector<Bin> &bins, const PackOptions &options = PackOptions{}) {
+        std::vector<Bin*> allocations(bins.size(), nullptr);
+        if (options.sort == SortStrategy::None) {
+            for (std::size_t i = 0; i < bins.size(); i++) {
+                allocations[i] = packBin(bins[i], options);
+            }
+        } else {
+            detail::sortOrder(order_, bins.size(), options.sort,
+                [&bins](std::size_t i) { return bins[i].w; },
+                [&bins](std::size_t i) { return bins[i].h; });
+            for (std::size_t i : order_) {
+                allocations[i] = packBin(bins[i], options);
+            }
+        }
+
+        std::vector<Bin*> results;
+        for (Bin* allocation : allocations) {
+            if (allocation) {
+                results.push_back(allocation);
+            }
+        }
+        if (options.shrink) {
+            shrink();
+        }
+        return results;
+    }
+
+
+    /**
+     * Pack a single bin into the sprite.
+     *
+     * @param   {int32_t}  id     Unique bin identifier, pass -1 to generate a new one
+     * @param   {int32_t}  w      Width of the bin to allocate
+     * @param   {int32_t}  h      Height of the bin to allocate
+     * @returns {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members,
+     *   or nullptr if there is no room
+     *
+     * @example
+     * Bin* result = sprite.packOne(-1, 12, 16);
+     */
+    Bin* packOne(int32_t id, int32_t w, int32_t h) {
+        // if id was supplied, attempt a lookup..
+        if (id != -1) {
+            Bin* pbin = getBin(id);
+            if (pbin) {   // we packed this bin already
+                ref(*pbin);
+                return pbin;
+            }
+            maxId_ = std::max(id, maxId_);
+        } else {
+            id = ++maxId_;
+        }
+
+        // First try to reuse a free bin..
+        Bin* pfreebin = freebins_.find(w, h);
+        if (pfreebin) {
+            return allocFreebin(pfreebin, id, w, h);
+        }
+
+        // Otherwise place it on the skyline, where its top ends up lowest..
+        std::size_t best = skyline_.size();
+        int32_t bestY = 0;
+        int64_t bestTop = std::numeric_limits<int64_t>::max();
+        for (std::size_t i = 0; i < skyline_.size() && int64_t(skyline_[i].x) + w <= width_; i++) {
+            int32_t y;
+            if (fits(i, w, h, y) && int64_t(y) + h < bestTop) {
+                best = i;
+                bestY = y;
+                bestTop = int64_t(y) + h;
+            }
+        }
+        if (best == skyline_.size()) {
+            return nullptr;
+        }
+        return allocSkyline(best, bestY, id, w, h);
+    }
+
+
+    /**
+     * Shrink the width/height of the sprite to the bare minimum.
+     *
+     * @example
+     * sprite.shrink();
+     */
+    void shrink() {
+        resize(usedWidth_, usedHeight_);
+    }
+
+
+    /**
+     * Return a packed bin given its id, or nullptr if the id is not found
+     *
+     * @param    {int32_t}  id  Unique identifier for this bin,
+     * @returns  {Bin*}     Pointer to a packed Bin with `id`, `x`, `y`, `w`, `h` members
+     *
+     * @example
+     * Bin* result = sprite.getBin(5);
+     */
+    Bin* getBin(int32_t id) {
+        return usedbins_.find(id);
+    }
+
+
+    /**
+     * Increment the ref count of a bin.
+     *
+     * @param    {Bin&}      bin  Bin reference
+     * @returns  {int32_t}   New refcount of the bin
+     *
+     * @example
+     * Bin* bin = sprite.getBin(5);
+     * if (bin) {
+     *     sprite.ref(*bin);
+     * }
+     */
+    int32_t ref(Bin& bin) {
+        return ++bin.refcount_;
+    }
+
+
+    /**
+     * Decrement the ref count of a bin.
+     * The bin will be automatically marked as free space once the refcount reaches 0.
+     *
+     * @param    {Bin&}     bin  Bin reference
+     * @returns  {int32_t}  New refcount of the bin
+     *
+     * @example
+     * Bin* bin = sprite.getBin(5);
+     * if (bin) {
+     *     sprite.unref(*bin);
+     * }
+     */
+    int32_t unref(Bin& bin) {
+        if (bin.refcount_ == 0) {
+            return 0;
+        }
+        if (--bin.refcount_ == 0) {
+            usedbins_.erase(bin.id);
+            pushFreebin(&bin);
+        }
+        return bin.refcount_;
+    }
+
+
+    /**
+     * Clear the sprite.
+     *
+     * @example
+     * sprite.clear();
+     */
+    void clear() {
+        pool_.clear();
+        usedbins_.clear();
+        freebins_.clear();
+        freeedges_.clear();
+        skyline_.assign(1, Segment{ 0, 0, width_ });
+        maxId_ = 0;
+        usedWidth_ = 0;
+        usedHeight_ = 0;
+    }
+
+
+    /**
+     * Resize the sprite.  Shrinking below bins that are already packed leaves them outside.
+     *
+     * @param   {int32_t}  w  Requested new sprite width
+     * @param   {int32_t}  h  Requested new sprite height
+     * @returns {bool}     `true` if resize succeeded, `false` if failed
+     *
+     * @example
+     * sprite.resize(256, 256);
+     */
+    bool resize(int32_t w, int32_t h) {
+        while (!skyline_.empty() && skyline_.back().x >= w) {
+            skyline_.pop_back();
+        }
+        if (!skyline_.empty() && skyline_.back().x + skyline_.back().w > w) {
+            skyline_.back().w = w - skyline_.back().x;
+        }
+        int32_t right = skyline_.empty() ? 0 : skyline_.back().x + skyline_.back().w;
+        if (right < w) {
+            if (!skyline_.empty() && skyline_.back().y == 0) {
+                skyline_.back().w += w - right;
+            } else {
+                skyline_.push_back(Segment{ right, 0, w - right });
+            }
+        }
+        width_ = w;
+        height_ = h;
+        return true;
+    }
+
+    int32_t width() const { return width_; }
+    int32_t height() const { return height_; }
+
+
+private:
+
+    // a horizontal piece of the skyline, the top of the bins below `x` .. `x + w`
+    struct Segment {
+        int32_t x;
+        int32_t y;
+        int32_t w;
+    };
+
+
+    /**
+     * Called by pack() to pack a single requested bin
+     *
+     * @private
+     * @param    {Bin&}          bin      Requested bin with `id`, `w`, `h` values
+     * @param    {PackOptions}   options  Options passed to `pack()`
+     * @returns  {Bin*}          Pointer to the packed Bin, or nullptr if skipped or out of space
+     */
+    Bin* packBin(Bin& bin, const PackOptions &options) {
+        if (bin.w <= 0 || bin.h <= 0) {
+            return nullptr;
+        }
+        Bin* allocation = packOne(bin.id, bin.w, bin.h);
+        if (allocation && options.inPlace) {
+            bin.id = allocation->id;
+            bin.x = allocation->x;
+            bin.y = allocation->y;
+        }
+        return allocation;
+    }
+
+
+    /**
+     * Called by packOne() to check if a bin fits with its left edge on segment `i`
+     *
+     * @private
+     * @param    {size_t}     i    Index of the skyline segment
+     * @param    {int32_t}    w    Width of the bin to allocate
+     * @param    {int32_t}    h    Height of the bin to allocate
+     * @param    {int32_t&}   y    Set to the top of the bin, the highest skyline below it
+     * @returns  {bool}       `true` if the bin fits below the bottom of the sprite
+     */
+    bool fits(std::size_t i, int32_t w, int32_t h, int32_t& y) const {
+        y = 0;
+        int64_t right = int64_t(skyline_[i].x) + w;
+        for (std::size_t j = i; j < skyline_.size() && skyline_[j].x < right; j++) {
+            y = std::max(skyline_[j].y, y);
+            if (int64_t(y) + h > height_) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    /**
+     * Called by packOne() to allocate a bin on the skyline.
+     * Gaps between the bin and the skyline below it become free bins.
+     *
+     * @private
+     * @param    {size_t}     i    Index of the skyline segment the bin starts on
+     * @param    {int32_t}    y    Top of the bin
+     * @param    {int32_t}    id   Unique identifier for this bin
+     * @param    {int32_t}    w    Width of the bin to allocate
+     * @param    {int32_t}    h    Height of the bin to allocate
+     * @returns  {Bin*}       Pointer to a Bin with `id`, `x`, `y`, `w`, `h` properties
+     */
+    Bin* allocSkyline(std::size_t i, int32_t y, int32_t id, int32_t w, int32_t h) {
+        int32_t x = skyline_[i].x;
+        int32_t right = x + w;
+
+        // segments under the bin..
+        std::size_t j = i;
+        for (; j < skyline_.size() && skyline_[j].x < right; j++) {
+            const Segment& segment = skyline_[j];
+            if (segment.y < y) {
+                int32_t gw = std::min(segment.x + segment.w, right) - segment.x;
+                pushFreebin(pool_.create(-1, gw, y - segment.y, gw, y - segment.y, segment.x, segment.y));
+            }
+        }
+        // ..the last one may stick out to the right
+        Segment& last = skyline_[j - 1];
+        if (last.x + last.w > right) {
+            last.w -= right - last.x;
+            last.x = right;
+            j--;
+        }
+        skyline_.erase(skyline_.begin() + std::ptrdiff_t(i), skyline_.begin() + std::ptrdiff_t(j));
+        skyline_.insert(skyline_.begin() + std::ptrdiff_t(i), Segment{ x, y + h, w });
+
+        // merge with neighbours of the same height..
+        if (i + 1 < skyline_.size() && skyline_[i + 1].y == y + h) {
+            skyline_[i].w += skyline_[i + 1].w;
+            skyline_.erase(skyline_.begin() + std::ptrdiff_t(i + 1));
+        }
+        if (i > 0 && skyline_[i - 1].y == y + h) {
+            skyline_[i - 1].w += skyline_[i].w;
+            skyline_.erase(skyline_.begin() + std::ptrdiff_t(i));
+        }
+
+        return allocBin(pool_.create(id, w, h, w, h, x, y), id, w, h);
+    }
+
+
+    /**
+     * Called by packOne() to allocate a bin by reusing a free bin.
+     * The leftover width on the right, and height below, stay free.
+     *
+     * @private
+     * @param    {Bin*}       bin    Pointer to a freebin to reuse
+     * @param    {int32_t}    id     Unique identifier for this bin
+     * @param    {int32_t}    w      Width of the bin to allocate
+     * @param    {int32_t}    h      Height of the bin to allocate
+     * @returns  {Bin*}       Pointer to a Bin with `id`, `x`, `y`, `w`, `h` properties
+     */
+    Bin* allocFreebin(Bin* bin, int32_t id, int32_t w, int32_t h) {
+        eraseFreebin(bin);
+        if (bin->maxw > w) {
+            int32_t rw = bin->maxw - w;
+            insertFreebin(pool_.create(-1, rw, bin->maxh, rw, bin->maxh, bin->x + w, bin->y));
+        }
+        if (bin->maxh > h) {
+            int32_t rh = bin->maxh - h;
+            insertFreebin(pool_.create(-1, w, rh, w, rh, bin->x, bin->y + h));
+        }
+        bin->maxw = w;
+        bin->maxh = h;
+        return allocBin(bin, id, w, h);
+    }
+
+
+    /**
+     * Called by unref() and allocSkyline() to add a free bin, merged with the free bins below it,
+     * to its left and to its right, that share a whole edge with it.
+     * The merged neighbours are recycled.
+     *
+     * @private
+     * @param    {Bin*}   bin    Pointer to the new free bin, not indexed yet
+     */
+    void pushFreebin(Bin* bin) {
+        for (bool merged = true; merged; ) {
+            merged = false;
+            Bin* below = freeedges_.startingAt(bin->x, bin->y + bin->maxh);
+            if (below && below->maxw == bin->maxw) {
+                eraseFreebin(below);
+                bin->maxh += below->maxh;
+                pool_.recycle(below);
+                merged = true;
+            }
+            Bin* left = freeedges_.endingAt(bin->x, bin->y);
+            if (left && left->maxh == bin->maxh) {
+                eraseFreebin(left);
+                bin->x = left->x;
+                bin->maxw += left->maxw;
+                pool_.recycle(left);
+                merged = true;
+            }
+            Bin* right = freeedges_.startingAt(bin->x + bin->maxw, bin->y);
+            if (right && right->maxh == bin->maxh) {
+                eraseFreebin(right);
+                bin->maxw += right->maxw;
+                pool_.recycle(right);
+                merged = true;
+            }
+        }
+        bin->w = bin->maxw;
+        bin->h = bin->maxh;
+        insertFreebin(bin);
+    }
+
+
+    void insertFreebin(Bin* bin) {
+        freebins_.push(bin);
+        freeedges_.insert(bin);
+    }
+
+
+    void eraseFreebin(Bin* bin) {
+        freebins_.erase(bin);
+        freeedges_.erase(bin);
+    }
+
+
+    Bin* allocBin(Bin* bin, int32_t id, int32_t w, int32_t h) {
+        bin->id = id;
+        bin->w = w;
+        bin->h = h;
+        bin->refcount_ = 1;
+        usedbins_.insert(id, bin);
+        usedWidth_ = std::max(bin->x + w, usedWidth_);
+        usedHeight_ = std::max(bin->y + h, usedHeight_);
+        return bin;
+    }
+
+
+    int32_t width_;
+    int32_t height_;
+    int32_t maxId_;
+    int32_t usedWidth_;    // right edge of the bins, max `x + w`
+    int32_t usedHeight_;   // bottom edge of the bins, max `y + h`
+
+    detail::BinPool<Bin> pool_;
+    std::vector<Segment> skyline_;   // ordered by `x`, covering the sprite width
+    detail::BinIdIndex<Bin> usedbins_;
+    detail::FreebinIndex<Bin> freebins_;
+    detail::FreebinEdges<Bin> freeedges_;   // free bins by their edges, to merge them
+    std::vector<std::size_t> order_;
+};
+
+
+}  // namespace mapbox
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef STREAM_PACK_HPP
+#define STREAM_PACK_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace mapbox {
+
+
+class StreamPack {
+public:
+
+    struct StreamPackOptions {
+        inline StreamPackOptions() : maxShelves(64), minWidth(1) { };
+        std::size_t maxShelves;
+        int32_t minWidth;
+        std::function<void(int32_t)> onPage;
+    };
+
+    struct Placement {
+        int32_t page;   // index of the page the bin was packed on, or -1 if not packed
+        int32_t id;
+        int32_t x;
+        int32_t y;
+        int32_t w;
+        int32_t h;
+    };
+
+
+    /**
+     * Create a new streaming bin allocator.
+     *
+     * Bins are placed as they arrive, with the same best height fit as `ShelfPack`, onto
+     * fixed size pages.  A new page is started when the current one has no room left for
+     * another shelf.  No bins are kept: each placement is final once returned, so memory
+     * stays bounded by `maxShelves` however many bins are packed.
+     *
+     * A shelf is finalized, and will take no more bins, once it has less than `minWidth`
+     * room left, or when it is the least recently used one and a new shelf would exceed
+     * `maxShelves`.  `onPage` is called with a page's index once it will take no more bins.
+     * Pages can be finalized out of order, as an old page's shelves stay open until evicted.
+     *
+     * @class  StreamPack
+     * @param  {int32_t}  [w=64]  Width of each page
+     * @param  {int32_t}  [h=64]  Height of each page
+     * @param  {StreamPackOptions}  [options]
+     * @param  {size_t} [options.maxShelves=64]  Number of shelves to keep open across all pages
+     * @param  {int32_t} [options.minWidth=1]  Finalize a shelf once it has less room left than this
+     * @param  {function<void(int32_t)>} [options.onPage]  Called with the index of each finalized page
+     *
+     * @example
+     * StreamPack::StreamPackOptions options;
+     * options.onPage = [&](int32_t page) { flush(page); };
+     * StreamPack stream(1024, 1024, options);
+     * StreamPack::Placement placement = stream.packOne(-1, 12, 16);
+     */
+    explicit StreamPack(int32_t w = 0, int32_t h = 0, const StreamPackOptions &options = StreamPackOptions{}) :
+        width_(w > 0 ? w : 64),
+        height_(h > 0 ? h : 64),
+        options_(options) {
+        options_.maxShelves = std::max(std::size_t(1), options_.maxShelves);
+        options_.minWidth = std::max(1, options_.minWidth);
+        shelves_.reserve(options_.maxShelves);
+    }
+
+
+    /**
+     * Batch pack multiple bins, in the given order, from and into caller-provided arrays.
+     * Call repeatedly with chunks of the input to stream through it.
+     *
+     * @param   {size_t}         count       Number of requested bins
+     * @param   {int32_t*}       widths      Array of `count` widths
+     * @param   {int32_t*}       heights     Array of `count` heights
+     * @param   {int32_t*}       ids         Array of `count` ids (`-1` to generate one), or nullptr to generate all ids
+     * @param   {Placement*}     placements  Array of `count` placements to fill in
+     * @returns {size_t}         Number of bins packed
+     *
+     * @example
+     * StreamPack::Placement placements[3];
+     * std::size_t packed = stream.pack(3, widths, heights, nullptr, placements);
+     */
+    std::size_t pack(std::size_t count, const int32_t* widths, const int32_t* heights, const int32_t* ids,
+                     Placement* placements) {
+        std::size_t packed = 0;
+        for (std::size_t i = 0; i < count; i++) {
+            placements[i] = packOne(ids ? ids[i] : -1, widths[i], heights[i]);
+            packed += placements[i].page != -1;
+        }
+        return packed;
+    }
+
+
+    /**
+     * Pack a single bin.
+     * Unlike `ShelfPack`, ids are not looked up - every call places a new bin.
+     *
+     * @param   {int32_t}    id     Bin identifier, pass -1 to generate a new one
+     * @param   {int32_t}    w      Width of the bin to allocate
+     * @param   {int32_t}    h      Height of the bin to allocate
+     * @returns {Placement}  Placement of the bin, with a `page` of -1 for bins without a size,
+     *   or larger than a page
+     *
+     * @example
+     * StreamPack::Placement placement = stream.packOne(-1, 12, 16);
+     */
+    Placement packOne(int32_t id, int32_t w, int32_t h) {
+        if (id == -1) {
+            id = ++maxId_;
+        } else {
+            maxId_ = std::max(id, maxId_);
+        }
+
+        Placement placement{ -1, id, -1, -1, w, h };
+        if (w <= 0 || h <= 0 || w > width_ || h > height_) {
+            return placement;
+        }
+
+        // shortest open shelf with room, topmost first..
+        std::size_t best = shelves_.size();
+        for (std::size_t i = 0; i < shelves_.size(); i++) {
+            const OpenShelf& shelf = shelves_[i];
+            if (shelf.h < h || width_ - shelf.x < w) {
+                continue;
+            }
+            if (best == shelves_.size() || shelf.h < shelves_[best].h ||
+                (shelf.h == shelves_[best].h && (shelf.page < shelves_[best].page ||
+                    (shelf.page == shelves_[best].page && shelf.y < shelves_[best].y)))) {
+                best = i;
+            }
+        }
+
+        if (best == shelves_.size()) {
+            best = addShelf(h);
+        }
+
+        OpenShelf& shelf = shelves_[best];
+        placement.page = shelf.page;
+        placement.x = shelf.x;
+        placement.y = shelf.y;
+        shelf.x += w;
+        shelf.used = ++clock_;
+        if (width_ - shelf.x < options_.minWidth) {
+            closeShelf(best);
+        }
+        return placement;
+    }
+
+
+    /**
+     * Finalize all open shelves and pages.  Later bins start on a new page.
+     *
+     * @example
+     * stream.finish();
+     */
+    void finish() {
+        while (!shelves_.empty()) {
+            closeShelf(shelves_.size() - 1);
+        }
+        if (nextShelfY_ > 0) {
+            closePage();
+        }
+    }
+
+
+    std::size_t pages() const { return std::size_t(page_) + (nextShelfY_ > 0); }
+    std::size_t openShelves() const { return shelves_.size(); }
+
+    int32_t width() const { return width_; }
+    int32_t height() const { return height_; }
+
+
+private:
+
+    struct OpenShelf {
+        int32_t page;
+        int32_t y;
+        int32_t h;
+        int32_t x;        // left edge of the free space
+        uint64_t used;    // clock of the last placement, for evicting the least recently used
+    };
+
+
+    /**
+     * Called by packOne() to open a new shelf for a bin, starting a new page if the current
+     * one is full, and finalizing the least recently used shelf if there are too many open.
+     *
+     * @private
+     * @param    {int32_t}  h   Height of the bin
+     * @returns  {size_t}   Index of the new shelf
+     */
+    std::size_t addShelf(int32_t h) {
+        if (h > height_ - nextShelfY_) {
+            int32_t full = page_;
+            page_++;
+            nextShelfY_ = 0;
+            if (!pageOpen(full)) {
+                notify(full);
+            }
+        }
+
+        if (shelves_.size() >= options_.maxShelves) {
+            std::size_t lru = 0;
+            for (std::size_t i = 1; i < shelves_.size(); i++) {
+                if (shelves_[i].used < shelves_[lru].used) {
+                    lru = i;
+                }
+            }
+            closeShelf(lru);
+        }
+
+        shelves_.push_back(OpenShelf{ page_, nextShelfY_, h, 0, 0 });
+        nextShelfY_ += h;
+        return shelves_.size() - 1;
+    }
+
+
+    /**
+     * Finalize an open shelf, and its page if that was the page's last open shelf and
+     * the page is full
+     *
+     * @private
+     * @param    {size_t}  i   Index of the shelf
+     */
+    void closeShelf(std::size_t i) {
+        int32_t page = shelves_[i].page;
+        shelves_[i] = shelves_.back();
+        shelves_.pop_back();
+        if (page != page_ && !pageOpen(page)) {
+            notify(page);
+        }
+    }
+
+
+    /**
+     * Called by finish() to finalize the current page
+     *
+     * @private
+     */
+    void closePage() {
+        notify(page_);
+        page_++;
+        nextShelfY_ = 0;
+    }
+
+
+    bool pageOpen(int32_t page) const {
+        return std::any_of(shelves_.begin(), shelves_.end(),
+            [page](const OpenShelf& shelf) { return shelf.page == page; });
+    }
+
+
+    void notify(int32_t page) {
+        if (options_.onPage) {
+            options_.onPage(page);
+        }
+    }
+
+
+    int32_t width_;
+    int32_t height_;
+    StreamPackOptions options_;
+
+    int32_t maxId_ = 0;
+    int32_t page_ = 0;
+    int32_t nextShelfY_ = 0;
+    uint64_t clock_ = 0;
+    std::vector<OpenShelf> shelves_;
+};
+
+
+}  // namespace mapbox
+
+#endif
@@ -1,7 +1,8 @@
 {
   'target_defaults': {
     'default_configuration': 'Release',
-    'cflags_cc': [ '-std=c++1y', '-Wall', '-Wextra', '-Wshadow', '-fno-rtti', '-fexceptions' ],
+    'cflags_cc': [ '-std=c++1y', '-Wall', '-Wextra', '-Wshadow', '-fno-rtti', '-fexceptions', '-pthread' ],
+    'ldflags': [ '-pthread' ],
     'xcode_settings': {
       'CLANG_CXX_LANGUAGE_STANDARD':'c++1y',
       'MACOSX_DEPLOYMENT_TARGET': '10.7',
@@ -43,6 +44,21 @@
       'sources': [
         'test/test.cpp'
       ],
+      'defines': [
+        'SHELF_PACK_STATS'
+      ],
+    },
+    { 'target_name': 'fuzz',
+      'type': 'executable',
+      'include_dirs': [
+        'include',
+      ],
+      'sources': [
+        'test/fuzz.cpp'
+      ],
+      'defines': [
+        'SHELF_PACK_STATS'
+      ],
     },
     { 'target_name': 'bench',
       'type': 'executable',
@@ -53,5 +69,18 @@
         'bench/bench.cpp'
       ],
     },
+    { 'target_name': 'benchmark',
+      'type': 'executable',
+      'include_dirs': [
+        'include',
+      ],
+      'sources': [
+        'bench/benchmark.cpp'
+      ],
+      'libraries': [
+        '-lbenchmark',
+        '-lpthread'
+      ],
+    },
   ],
 }
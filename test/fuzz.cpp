@@ -0,0 +1,367 @@
+/*
+ * Randomized stress test for `ShelfPack`.
+ *
+ * Runs random sequences of packOne(), pack(), ref(), unref(), resize(), shrink() and clear()
+ * with random options, and checks after each step that packed and free bins stay inside the
+ * sprite, never overlap, and have the refcounts a simple model of the sprite expects.
+ * Then checks that the cost of an operation does not grow faster than the size of the sprite,
+ * counted by the `SHELF_PACK_STATS` counters the fuzz target is built with.
+ *
+ *   make fuzz                         runs 200 sequences of 5000 steps, and the scaling check
+ *   build/Release/fuzz 2000           runs 2000 sequences
+ *   build/Release/fuzz --timing       also checks the wall-clock time of the scaling check
+ *
+ * Built with `-DSHELF_PACK_LIBFUZZER -fsanitize=fuzzer`, the input bytes drive one sequence:
+ *
+ *   clang++ -std=c++14 -g -O1 -fsanitize=fuzzer,address -DSHELF_PACK_LIBFUZZER -Iinclude test/fuzz.cpp
+ */
+#include <mapbox/shelf-pack.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace mapbox;
+
+
+// like assert(), but also checked in Release builds..
+#define CHECK(condition) ((condition) ? (void)0 : fail(#condition, __LINE__))
+
+[[noreturn]] void fail(const char* condition, int line) {
+    std::fprintf(stderr, "\nfuzz.cpp:%d: check failed: %s\n", line, condition);
+    std::abort();
+}
+
+
+/*
+ * Reads the steps of a sequence from fuzzer input, as 32-bit values.
+ * Reads 0 once the input runs out.
+ */
+class Input {
+public:
+    Input(const uint8_t* data, std::size_t size) : data_(data), size_(size) { }
+
+    uint32_t next() {
+        uint32_t value = 0;
+        for (int i = 0; i < 4 && pos_ < size_; i++) {
+            value |= uint32_t(data_[pos_++]) << (8 * i);
+        }
+        return value;
+    }
+
+    uint32_t next(uint32_t n) { return next() % n; }
+    bool done() const { return pos_ >= size_; }
+
+private:
+    const uint8_t* data_;
+    std::size_t size_;
+    std::size_t pos_ = 0;
+};
+
+
+struct Rect {
+    int32_t x, y, w, h;
+};
+
+
+/*
+ * Check that no two rectangles overlap, with a sweep down the sprite over the
+ * rectangles spanning each row, kept in an interval map by `x`.
+ * O(n log n) for n rectangles.
+ *
+ * @param    {vector<Rect>}   rects   Rectangles to check
+ * @returns  {bool}           `true` if no two rectangles overlap
+ */
+bool disjoint(const std::vector<Rect>& rects) {
+    // ends of rectangles sort before starts at the same `y`, as touching edges do not overlap..
+    std::vector<std::pair<int64_t, std::size_t>> events;
+    for (std::size_t i = 0; i < rects.size(); i++) {
+        if (rects[i].w <= 0 || rects[i].h <= 0) {
+            continue;
+        }
+        events.emplace_back(int64_t(rects[i].y) * 2 + 1, i);
+        events.emplace_back((int64_t(rects[i].y) + rects[i].h) * 2, i);
+    }
+    std::sort(events.begin(), events.end());
+
+    std::map<int32_t, int32_t> spans;   // x -> right edge, for the rectangles spanning the current row
+    for (const auto& event : events) {
+        const Rect& rect = rects[event.second];
+        if (event.first % 2 == 0) {
+            spans.erase(rect.x);
+            continue;
+        }
+        auto next = spans.lower_bound(rect.x);
+        if (next != spans.end() && next->first < rect.x + rect.w) {
+            return false;
+        }
+        if (next != spans.begin() && std::prev(next)->second > rect.x) {
+            return false;
+        }
+        spans.emplace(rect.x, rect.x + rect.w);
+    }
+    return true;
+}
+
+
+/*
+ * Check the sprite against the refcounts it should have, and check that its shelves,
+ * packed bins and free bins fit the sprite without overlapping.
+ *
+ * @param    {ShelfPack&}                       sprite     Sprite to check
+ * @param    {unordered_map<int32_t, int32_t>}  refcounts  Expected refcount of each referenced id
+ */
+void validate(const ShelfPack& sprite, const std::unordered_map<int32_t, int32_t>& refcounts) {
+    std::vector<Rect> rects;
+    int32_t y = 0;
+    sprite.forEachShelf([&](const Shelf& shelf) {
+        CHECK(shelf.y() == y);
+        CHECK(shelf.h() > 0);
+        CHECK(shelf.x() <= sprite.width());
+        CHECK(shelf.w() == sprite.width() && shelf.wfree() == shelf.w() - shelf.x());
+        y += shelf.h();
+    });
+    CHECK(y <= sprite.height());
+
+    std::size_t referenced = 0;
+    sprite.forEachBin([&](const Bin& bin) {
+        CHECK(bin.w <= bin.maxw && bin.h <= bin.maxh);
+        CHECK(bin.x >= 0 && bin.y >= 0 && bin.x + bin.maxw <= sprite.width() && bin.y + bin.maxh <= y);
+        if (bin.refcount() > 0) {
+            auto expected = refcounts.find(bin.id);
+            CHECK(expected != refcounts.end() && expected->second == bin.refcount());
+            referenced++;
+        }
+        rects.push_back(Rect{ bin.x, bin.y, bin.maxw, bin.maxh });
+    });
+    CHECK(referenced == refcounts.size());
+
+    sprite.forEachFreebin([&](const Bin& bin) {
+        CHECK(bin.refcount() == 0);
+        CHECK(bin.x >= 0 && bin.y >= 0 && bin.x + bin.maxw <= sprite.width() && bin.y + bin.maxh <= y);
+        rects.push_back(Rect{ bin.x, bin.y, bin.maxw, bin.maxh });
+    });
+    CHECK(disjoint(rects));
+}
+
+
+/*
+ * Run one random sequence of steps read from `input`, validating the sprite after each
+ *
+ * @param    {Input&}   input   Options and steps of the sequence
+ */
+void runSequence(Input& input) {
+    ShelfPack::ShelfPackOptions options;
+    uint32_t flags = input.next();
+    options.autoResize = flags & 1;
+    options.splitFreebins = flags & 2;
+    options.mergeFreebins = flags & 4;
+    options.evictUnused = flags & 8;
+    options.handles = flags & 16;
+    options.idIndex = (flags & 32) ? ShelfPack::IdIndex::Dense : ShelfPack::IdIndex::Hash;
+    options.minBinWidth = (flags & 64) ? int32_t(1 + input.next(16)) : 0;
+    options.alignment = (flags & 128) ? int32_t(1 + input.next(8)) : 1;
+    options.gutter = (flags & 256) ? int32_t(input.next(3)) : 0;
+    ShelfPack sprite(int32_t(16 + input.next(240)), int32_t(16 + input.next(240)), options);
+
+    std::unordered_map<int32_t, int32_t> refcounts;
+    std::vector<int32_t> ids;   // one entry per reference, so picking one favors the most referenced
+    auto packed = [&](Bin* bin) {
+        if (bin) {
+            CHECK(++refcounts[bin->id] == bin->refcount());
+            ids.push_back(bin->id);
+        }
+    };
+    auto released = [&](int32_t id) {
+        if (--refcounts[id] == 0) {
+            refcounts.erase(id);
+        }
+    };
+    auto pick = [&]() {
+        std::size_t i = input.next(uint32_t(ids.size()));
+        int32_t id = ids[i];
+        ids[i] = ids.back();
+        ids.pop_back();
+        return id;
+    };
+
+    while (!input.done()) {
+        uint32_t step = input.next(100);
+        int32_t w = int32_t(1 + input.next(32)), h = int32_t(1 + input.next(32));
+        if (step < 40) {
+            // explicit ids collide with earlier ones, to ref them..
+            int32_t id = input.next(4) ? -1 : int32_t(1 + input.next(400));
+            packed(sprite.packOne(id, w, h));
+        } else if (step < 45) {
+            std::vector<Bin> bins;
+            for (uint32_t i = input.next(8); i > 0; i--) {
+                bins.emplace_back(-1, int32_t(1 + input.next(32)), int32_t(1 + input.next(32)));
+            }
+            ShelfPack::PackOptions packOptions;
+            packOptions.shrink = false;
+            packOptions.atomic = input.next(2);
+            for (Bin* bin : sprite.pack(bins, packOptions)) {
+                packed(bin);
+            }
+        } else if (step < 50 && !ids.empty()) {
+            int32_t id = ids[input.next(uint32_t(ids.size()))];
+            Bin* bin = sprite.getBin(id);
+            CHECK(bin);
+            sprite.ref(*bin);
+            refcounts[id]++;
+            ids.push_back(id);
+        } else if (step < 85 && !ids.empty()) {
+            int32_t id = pick();
+            Bin* bin = sprite.getBin(id);
+            CHECK(bin);
+            sprite.unref(*bin);
+            released(id);
+        } else if (step < 90 && !ids.empty()) {
+            std::vector<int32_t> batch;
+            for (uint32_t i = 1 + input.next(8); i > 0 && !ids.empty(); i--) {
+                batch.push_back(pick());
+            }
+            sprite.unref(batch.size(), batch.data());
+            for (int32_t id : batch) {
+                released(id);
+            }
+        } else if (step < 94) {
+            // never below the shelves in use..
+            int32_t usedWidth = 0, usedHeight = 0;
+            sprite.forEachShelf([&](const Shelf& shelf) {
+                usedWidth = std::max(shelf.x(), usedWidth);
+                usedHeight = shelf.y() + shelf.h();
+            });
+            sprite.resize(std::max(usedWidth, int32_t(1 + input.next(300))),
+                          std::max(usedHeight, int32_t(1 + input.next(300))));
+        } else if (step < 98) {
+            sprite.shrink();
+        } else if (step < 99) {
+            sprite.clear();
+            refcounts.clear();
+            ids.clear();
+        } else {
+            sprite.evict();
+        }
+        validate(sprite, refcounts);
+    }
+}
+
+
+#ifdef SHELF_PACK_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size) {
+    Input input(data, size);
+    runSequence(input);
+    return 0;
+}
+
+#else
+
+void testRandomSequences(uint32_t sequences) {
+    std::cout << "random sequences keep bins inside the sprite, apart, and refcounted";
+
+    std::vector<uint8_t> data(5000 * 16);
+    for (uint32_t seed = 1; seed <= sequences; seed++) {
+        std::mt19937 random(seed);
+        for (auto& byte : data) {
+            byte = uint8_t(random());
+        }
+        Input input(data.data(), data.size());
+        runSequence(input);
+    }
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+/*
+ * Run steady churn on a sprite holding `count` bins: unref a random bin, pack a new one.
+ *
+ * @param    {size_t}   count    Number of bins in the sprite
+ * @param    {double&}  scanned  Set to the shelf heights and free bin size classes searched
+ *   per packOne(), from the sprite's stats
+ * @returns  {double}   Fastest of several runs, in nanoseconds per unref and pack
+ */
+double churnCost(std::size_t count, double& scanned) {
+    ShelfPack::ShelfPackOptions options;
+    options.autoResize = true;
+    options.splitFreebins = true;
+    options.mergeFreebins = true;
+    std::mt19937 random(1);
+    auto size = [&random]() { return int32_t(8 + random() % 17); };
+
+    ShelfPack sprite(256, 256, options);
+    std::vector<Bin*> bins;
+    for (std::size_t i = 0; i < count; i++) {
+        bins.push_back(sprite.packOne(-1, size(), size()));
+    }
+
+    const std::size_t steps = 50000;
+    const int runs = 5;
+    ShelfPack::ShelfPackStats before = sprite.stats();
+    double fastest = 0;
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < steps; i++) {
+            Bin*& bin = bins[random() % bins.size()];
+            sprite.unref(*bin);
+            bin = sprite.packOne(-1, size(), size());
+            CHECK(bin);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / steps;
+        fastest = run ? std::min(ns, fastest) : ns;
+    }
+    ShelfPack::ShelfPackStats after = sprite.stats();
+    scanned = double(after.bucketsScanned - before.bucketsScanned + after.freebinsScanned - before.freebinsScanned) /
+        double(steps * runs);
+    return fastest;
+}
+
+
+void testScaling(bool timing) {
+    std::cout << "unref() and packOne() cost grows slower than the sprite";
+
+    // 64 times the bins, allowing for the logarithmic indexes..
+    double smallScanned, largeScanned;
+    double small = churnCost(1000, smallScanned);
+    double large = churnCost(64000, largeScanned);
+    std::cout << " (" << smallScanned << ", " << largeScanned << " scanned per pack";
+    CHECK(largeScanned < smallScanned * 4);
+
+    // ..and for caches, wall-clock time is only checked when asked, as it depends on the machine
+    std::cout << ", " << small << " ns, " << large << " ns)";
+    if (timing) {
+        CHECK(large < small * 8);
+    }
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+    uint32_t sequences = 200;
+    bool timing = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--timing") {
+            timing = true;
+        } else {
+            sequences = uint32_t(std::strtoul(argv[i], nullptr, 10));
+        }
+    }
+
+    std::cout << std::endl << "fuzz" << std::endl << std::string(70, '-') << std::endl;
+    testRandomSequences(sequences);
+    testScaling(timing);
+
+    return 0;
+}
+
+#endif
@@ -1,7 +1,15 @@
 #include <mapbox/shelf-pack.hpp>
+#include <mapbox/concurrent-shelf-pack.hpp>
+#include <mapbox/multi-pack.hpp>
+#include <mapbox/skyline-pack.hpp>
+#include <mapbox/stream-pack.hpp>
+#include <mapbox/maxrects-pack.hpp>
 
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
+#include <thread>
 
 using namespace mapbox;
 
@@ -342,6 +350,131 @@ void testPack6() {
 
     std::cout << " - OK" << std::endl;
 }
+void testPack7() {
+    std::cout << "batch pack() sorts by height but returns results in input order";
+
+    ShelfPack sprite(64, 64);
+    std::vector<Bin> bins;
+    std::vector<Bin*> results;
+
+    bins.emplace_back(-1, 10, 10);
+    bins.emplace_back(-1, 10, 20);
+    bins.emplace_back(-1, 10, 15);
+
+    ShelfPack::PackOptions options;
+    options.inPlace = true;
+    options.sort = ShelfPack::SortStrategy::HeightDesc;
+    results = sprite.pack(bins, options);
+
+    assert(results.size() == 3);
+
+    //  x: 20, y: 0, w: 10, h: 10  (packed last, on the 20px shelf)
+    assert(results[0]->h == 10);
+    assert(results[0]->x == 20);
+    assert(results[0]->y == 0);
+    assert(results[0]->maxh == 20);
+
+    //  x: 0, y: 0, w: 10, h: 20  (packed first)
+    assert(results[1]->h == 20);
+    assert(results[1]->x == 0);
+    assert(results[1]->y == 0);
+
+    //  x: 10, y: 0, w: 10, h: 15
+    assert(results[2]->h == 15);
+    assert(results[2]->x == 10);
+    assert(results[2]->y == 0);
+
+    // `inPlace` updates the bins in their original order
+    assert(bins[0].x == 20 && bins[0].id == results[0]->id);
+    assert(bins[1].x == 0 && bins[1].id == results[1]->id);
+    assert(bins[2].x == 10 && bins[2].id == results[2]->id);
+
+    assert(sprite.width() == 30);
+    assert(sprite.height() == 20);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testPack8() {
+    std::cout << "batch pack() sorts by area or by longest side";
+
+    std::vector<Bin> bins;
+    bins.emplace_back(-1, 4, 4);     // area 16, side 4
+    bins.emplace_back(-1, 30, 2);    // area 60, side 30
+    bins.emplace_back(-1, 8, 8);     // area 64, side 8
+
+    ShelfPack sprite1(64, 64);
+    ShelfPack::PackOptions options;
+    options.sort = ShelfPack::SortStrategy::AreaDesc;
+    std::vector<Bin*> results = sprite1.pack(bins, options);
+
+    assert(results.size() == 3);
+    assert(results[2]->id == 1);   // largest area packed first
+    assert(results[1]->id == 2);
+    assert(results[0]->id == 3);
+
+    ShelfPack sprite2(64, 64);
+    options.sort = ShelfPack::SortStrategy::MaxSideDesc;
+    results = sprite2.pack(bins, options);
+
+    assert(results.size() == 3);
+    assert(results[1]->id == 1);   // longest side packed first
+    assert(results[2]->id == 2);
+    assert(results[0]->id == 3);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testPack9() {
+    std::cout << "batch pack() packs from width and height arrays into caller arrays";
+
+    ShelfPack sprite(30, 30);
+    int32_t widths[]  = { 10, 10,  0, 25, 10 };
+    int32_t heights[] = { 10, 20, 10, 20, 20 };
+    int32_t ids[]     = { -1,  7, -1, -1,  7 };
+    Bin* results[5];
+    ShelfPack::PackStatus statuses[5];
+
+    std::size_t packed = sprite.pack(5, widths, heights, ids, results, statuses);
+
+    assert(packed == 3);
+    assert(statuses[0] == ShelfPack::PackStatus::Packed);
+    assert(statuses[1] == ShelfPack::PackStatus::Packed);
+    assert(statuses[2] == ShelfPack::PackStatus::Skipped);
+    assert(statuses[3] == ShelfPack::PackStatus::OutOfSpace);
+    assert(statuses[4] == ShelfPack::PackStatus::Packed);
+
+    //  x: 0, y: 0, w: 10, h: 10
+    assert(results[0]->id == 1);
+    assert(results[0]->x == 0);
+    assert(results[0]->y == 0);
+
+    //  x: 0, y: 10, w: 10, h: 20
+    assert(results[1]->id == 7);
+    assert(results[1]->x == 0);
+    assert(results[1]->y == 10);
+
+    assert(results[2] == NULL);
+    assert(results[3] == NULL);
+    assert(results[4] == results[1]);   // same id, ref'd again
+    assert(results[4]->refcount() == 2);
+
+    // statuses and ids are optional, and buffers may be reused with sorting
+    ShelfPack sprite2(30, 30);
+    ShelfPack::PackOptions options;
+    options.sort = ShelfPack::SortStrategy::HeightDesc;
+    int32_t widths2[]  = { 5, 5 };
+    int32_t heights2[] = { 5, 10 };
+    packed = sprite2.pack(2, widths2, heights2, nullptr, results, nullptr, options);
+
+    assert(packed == 2);
+    assert(results[0]->h == 5 && results[0]->maxh == 10);
+    assert(results[1]->h == 10 && results[1]->maxh == 10);
+    assert(results[1]->x < results[0]->x);   // taller bin packed first
+
+    std::cout << " - OK" << std::endl;
+}
+
 
 void testPackOne1() {
     std::cout << "packOne() allocates bins with numeric id";
@@ -686,6 +819,251 @@ void testPackOne12() {
     std::cout << " - OK" << std::endl;
 }
 
+void testPackOne13() {
+    std::cout << "packOne() skips full shelves and picks the topmost shortest shelf with room";
+
+    ShelfPack sprite(30, 64);
+    Bin* bin1 = sprite.packOne(-1, 30, 10);
+    Bin* bin2 = sprite.packOne(-1, 20, 12);
+    Bin* bin3 = sprite.packOne(-1, 20, 10);
+    Bin* bin4 = sprite.packOne(-1, 10, 10);
+    Bin* bin5 = sprite.packOne(-1, 10,  9);
+
+    //  x: 0, y: 0, w: 30, h: 10
+    assert(bin1->x == 0);
+    assert(bin1->y == 0);
+
+    //  x: 0, y: 10, w: 20, h: 12
+    assert(bin2->x == 0);
+    assert(bin2->y == 10);
+
+    //  x: 0, y: 22, w: 20, h: 10  (first 10px shelf is full, new shelf)
+    assert(bin3->x == 0);
+    assert(bin3->y == 22);
+    assert(bin3->maxh == 10);
+
+    //  x: 20, y: 22, w: 10, h: 10  (second 10px shelf)
+    assert(bin4->x == 20);
+    assert(bin4->y == 22);
+    assert(bin4->maxh == 10);
+
+    //  x: 20, y: 10, w: 10, h: 9  (both 10px shelves full, next tallest shelf)
+    assert(bin5->x == 20);
+    assert(bin5->y == 10);
+    assert(bin5->maxh == 12);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testPackOne14() {
+    std::cout << "packOne() reuses the earliest freed bin among equally wasteful free bins";
+
+    ShelfPack sprite(64, 64);
+    Bin* bin1 = sprite.packOne(1, 20, 10);
+    Bin* bin2 = sprite.packOne(2, 10, 20);
+    Bin* bin3 = sprite.packOne(3, 10, 20);
+
+    sprite.unref(*bin3);
+    sprite.unref(*bin1);
+    sprite.unref(*bin2);
+
+    Bin* bin4 = sprite.packOne(4, 10, 9);
+    Bin* bin5 = sprite.packOne(5, 10, 9);
+    Bin* bin6 = sprite.packOne(6, 10, 9);
+
+    //  x: 10, y: 10, w: 10, h: 9
+    assert(bin4 == bin3);   // reused bin3
+    assert(bin4->x == 10);
+    assert(bin4->y == 10);
+    assert(bin4->maxw == 10);
+    assert(bin4->maxh == 20);
+
+    //  x: 0, y: 0, w: 10, h: 9
+    assert(bin5 == bin1);   // reused bin1
+    assert(bin5->x == 0);
+    assert(bin5->y == 0);
+    assert(bin5->maxw == 20);
+    assert(bin5->maxh == 10);
+
+    //  x: 0, y: 10, w: 10, h: 9
+    assert(bin6 == bin2);   // reused bin2
+    assert(bin6->x == 0);
+    assert(bin6->y == 10);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testPackOne15() {
+    std::cout << "packOne() splits reused free bins with splitFreebins";
+
+    ShelfPack::ShelfPackOptions options;
+    options.splitFreebins = true;
+    ShelfPack sprite(64, 64, options);
+
+    Bin* bin1 = sprite.packOne(-1, 30, 10);
+    sprite.packOne(-1, 30, 10);
+    sprite.unref(*bin1);
+
+    //  x: 0, y: 0, w: 10, h: 10, reuses the front of the free bin
+    Bin* bin3 = sprite.packOne(-1, 10, 10);
+    assert(bin3->x == 0);
+    assert(bin3->y == 0);
+    assert(bin3->maxw == 10);
+    assert(bin3->maxh == 10);
+
+    //  x: 10, y: 0, w: 20, h: 10, the leftover width is an exact fit
+    Bin* bin4 = sprite.packOne(-1, 20, 10);
+    assert(bin4->x == 10);
+    assert(bin4->y == 0);
+    assert(bin4->maxw == 20);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testPackOne16() {
+    std::cout << "packOne() finds the shortest taller shelf with room among many heights";
+
+    for (std::size_t n = 0; n < 40; n++) {
+        std::vector<int32_t> values(n, 100);
+        assert(detail::findAtMost(values.data(), n, 99) == n);
+        for (std::size_t i = 0; i < n; i++) {
+            values[i] = 99;
+            assert(detail::findAtMost(values.data(), n, 99) == i);
+            assert(detail::findAtMost(values.data(), n, 99) == detail::findAtMostScalar(values.data(), n, 99));
+            assert(detail::minOf(values.data(), n) == 99);
+            values[i] = 100;
+        }
+    }
+
+    // shelves of heights 10 .. 109, all 60 wide except the 90 tall one
+    ShelfPack sprite(100, 10000);
+    for (int32_t h = 10; h < 110; h++) {
+        sprite.packOne(-1, h == 90 ? 20 : 60, h);
+    }
+
+    //  x: 20, y: 3960, on the only shelf with 50 free
+    Bin* bin1 = sprite.packOne(-1, 50, 30);
+    assert(bin1->x == 20);
+    assert(bin1->y == 3960);
+
+    //  x: 60, y: 0, on the shortest shelf
+    Bin* bin2 = sprite.packOne(-1, 30, 5);
+    assert(bin2->x == 60);
+    assert(bin2->y == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testPackOne17() {
+    std::cout << "packOne() stops searching full shelves until unref() gives them back room";
+
+    ShelfPack::ShelfPackOptions options;
+    options.mergeFreebins = true;
+    ShelfPack sprite(30, 100, options);
+
+    sprite.packOne(-1, 10, 10);
+    sprite.packOne(-1, 10, 10);
+    Bin* bin3 = sprite.packOne(-1, 10, 10);
+    assert(sprite.stats().retiredHeights == 1);   // no room for a 10 wide bin
+
+    //  x: 0, y: 10, on a new shelf
+    Bin* bin4 = sprite.packOne(-1, 10, 20);
+    assert(bin4->x == 0 && bin4->y == 10);
+
+    //  x: 10, y: 10, still no room on the full shelf
+    Bin* bin5 = sprite.packOne(-1, 5, 10);
+    assert(bin5->x == 10 && bin5->y == 10);
+    assert(sprite.stats().retiredHeights == 1);
+
+    //  x: 20, y: 0, the end of the full shelf was given back
+    sprite.unref(*bin3);
+    assert(sprite.stats().retiredHeights == 0);
+    Bin* bin6 = sprite.packOne(-1, 10, 10);
+    assert(bin6->x == 20 && bin6->y == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+struct StepGrowth {
+    static void grow(int64_t&, int64_t& h, int32_t, int32_t) {
+        h += 8;
+    }
+};
+
+void testPackOne18() {
+    std::cout << "packOne() skips shelves with less room than `minBinWidth`";
+
+    ShelfPack::ShelfPackOptions options;
+    options.minBinWidth = 8;
+    ShelfPack sprite(30, 100, options);
+
+    sprite.packOne(-1, 25, 10);
+    assert(sprite.stats().retiredHeights == 1);
+
+    //  x: 0, y: 10, a 4 wide bin would fit the first shelf, but it is full
+    Bin* bin2 = sprite.packOne(-1, 4, 10);
+    assert(bin2->x == 0 && bin2->y == 10);
+    assert(sprite.stats().retiredHeights == 0);
+
+    // growing the sprite gives full shelves room again
+    sprite.resize(40, 100);
+    Bin* bin3 = sprite.packOne(-1, 15, 10);
+    assert(bin3->x == 25 && bin3->y == 0);
+
+    // autoResize grows until a shelf has `minBinWidth` of room, or a new shelf fits
+    typedef BasicShelfPack<int32_t, StepGrowth> StepPack;
+    StepPack::ShelfPackOptions options2;
+    options2.autoResize = true;
+    options2.minBinWidth = 10;
+    StepPack sprite2(64, 64, options2);
+    sprite2.packOne(-1, 60, 32);
+    sprite2.packOne(-1, 60, 32);
+    StepPack::Bin* bin4 = sprite2.packOne(-1, 4, 32);
+    assert(bin4 && bin4->x == 0 && bin4->y == 64);
+    assert(sprite2.width() == 64 && sprite2.height() == 96);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testPackOne19() {
+    std::cout << "packOne() pads and aligns bins with `alignment` and `gutter`";
+
+    ShelfPack::ShelfPackOptions options;
+    options.alignment = 3;
+    options.gutter = 1;
+    options.splitFreebins = true;
+    options.mergeFreebins = true;
+    ShelfPack sprite(64, 64, options);
+    assert(sprite.alignment() == 4);
+
+    //  w: 8, h: 8, a 5x3 bin with a gutter of 1, rounded up to 4
+    Bin* bin1 = sprite.packOne(-1, 5, 3);
+    assert(bin1->x == 0 && bin1->y == 0);
+    assert(bin1->w == 8 && bin1->h == 8);
+
+    // shelves, free bins and their splits all stay aligned
+    bool aligned = true;
+    for (int32_t i = 0; i < 60; i++) {
+        Bin* bin = sprite.packOne(-1, 1 + (i * 7) % 13, 1 + (i * 5) % 11);
+        if (bin && i % 3 == 0) {
+            sprite.unref(*bin);
+        }
+    }
+    sprite.forEachBin([&](const Bin& bin) {
+        aligned = aligned && bin.x % 4 == 0 && bin.y % 4 == 0 && bin.w % 4 == 0 && bin.h % 4 == 0;
+    });
+    sprite.forEachShelf([&](const Shelf& shelf) {
+        aligned = aligned && shelf.y() % 4 == 0 && shelf.h() % 4 == 0;
+    });
+    assert(aligned);
+
+    std::cout << " - OK" << std::endl;
+}
+
 
 void testGetBin1() {
     std::cout << "getBin() returns NULL if Bin not found";
@@ -710,6 +1088,140 @@ void testGetBin2() {
     std::cout << " - OK" << std::endl;
 }
 
+void testGetBin3() {
+    std::cout << "getBin() gets a Bin by numeric id with a dense id index";
+
+    ShelfPack::ShelfPackOptions options;
+    options.idIndex = ShelfPack::IdIndex::Dense;
+    ShelfPack sprite(64, 64, options);
+
+    Bin* bin1 = sprite.packOne(-1, 10, 10);
+    Bin* bin2 = sprite.packOne(1000000000, 10, 10);
+    Bin* bin3 = sprite.packOne(-5, 10, 10);
+
+    assert(sprite.getBin(1) == bin1);
+    assert(sprite.getBin(1000000000) == bin2);
+    assert(sprite.getBin(-5) == bin3);
+    assert(sprite.getBin(2) == NULL);
+
+    sprite.unref(*bin2);
+    assert(sprite.getBin(1000000000) == NULL);
+    assert(sprite.getBin(1) == bin1);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testGetBin4() {
+    std::cout << "getBin() finds every remaining Bin after many unrefs";
+
+    for (int i = 0; i < 2; i++) {
+        ShelfPack::ShelfPackOptions options;
+        options.idIndex = i ? ShelfPack::IdIndex::Dense : ShelfPack::IdIndex::Hash;
+        ShelfPack sprite(1024, 1024, options);
+
+        for (int32_t id = 1; id <= 2000; id++) {
+            sprite.packOne(id * 7919, 10, 10);
+        }
+        for (int32_t id = 1; id <= 2000; id += 3) {
+            sprite.unref(*sprite.getBin(id * 7919));
+        }
+        for (int32_t id = 1; id <= 2000; id++) {
+            Bin* bin = sprite.getBin(id * 7919);
+            if (id % 3 == 1) {
+                assert(bin == NULL);
+            } else {
+                assert(bin && bin->id == id * 7919);
+            }
+        }
+    }
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testGetBin5() {
+    std::cout << "getBin() gets a Bin by handle, and not once it is freed";
+
+    ShelfPack::ShelfPackOptions options;
+    options.handles = true;
+    ShelfPack sprite(64, 64, options);
+
+    Bin* bin1 = sprite.packOne(-1, 10, 10);
+    BinHandle handle1 = bin1->handle();
+    assert(handle1);
+    assert(sprite.getBin(handle1) == bin1);
+    assert(!sprite.getBin(BinHandle()));
+
+    // the freed bin, and its handle slot, are reused for another bin
+    sprite.unref(*bin1);
+    Bin* bin2 = sprite.packOne(-1, 10, 10);
+    assert(bin2 == bin1);
+    assert(bin2->handle() != handle1);
+    assert(bin2->handle().index() == handle1.index());
+    assert(sprite.getBin(handle1) == NULL);
+    assert(sprite.getBin(bin2->handle()) == bin2);
+
+    // without the option, bins have no handle
+    ShelfPack plain(64, 64);
+    assert(!plain.packOne(-1, 10, 10)->handle());
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testGetBin6() {
+    std::cout << "getBin() handles survive rollback(), but not clear()";
+
+    ShelfPack::ShelfPackOptions options;
+    options.handles = true;
+    ShelfPack sprite(64, 64, options);
+
+    Bin* bin1 = sprite.packOne(-1, 10, 10);
+    BinHandle handle1 = bin1->handle();
+
+    sprite.begin();
+    sprite.unref(*bin1);
+    BinHandle handle2 = sprite.packOne(-1, 20, 20)->handle();
+    assert(!sprite.getBin(handle1));
+    sprite.rollback();
+
+    assert(sprite.getBin(handle1) == bin1);
+    assert(!sprite.getBin(handle2));
+
+    sprite.clear();
+    assert(!sprite.getBin(handle1));
+    assert(sprite.packOne(-1, 10, 10)->handle() != handle1);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testGetBin7() {
+    std::cout << "packOne() packs no more bins than there are handles for";
+
+    ShelfPack::ShelfPackOptions options;
+    options.handles = true;
+    ShelfPack sprite(2048, 4096, options);
+
+    const int32_t limit = int32_t(BinHandle::kIndexMask) + 1;
+    Bin* last = nullptr;
+    for (int32_t i = 0; i < limit; i++) {
+        last = sprite.packOne(-1, 1, 1);
+    }
+    assert(last && last->handle() && sprite.getBin(last->handle()) == last);
+
+    // there is room, but no handle..
+    assert(sprite.packOne(-1, 1, 1) == NULL);
+    assert(sprite.stats().outOfSpace == 1);
+
+    // ..until a bin is freed
+    BinHandle old = last->handle();
+    sprite.unref(*last);
+    Bin* bin = sprite.packOne(-1, 1, 1);
+    assert(bin && bin->handle() && bin->handle() != old);
+    assert(sprite.getBin(bin->handle()) == bin);
+
+    std::cout << " - OK" << std::endl;
+}
+
 
 void testRef() {
     std::cout << "ref() increments the Bin refcount and updates stats";
@@ -780,62 +1292,906 @@ void testUnref2() {
 
     std::cout << " - OK" << std::endl;
 }
+void testUnref3() {
+    std::cout << "unref() merges free bins and reclaims shelf ends with mergeFreebins";
 
-void testClear() {
-    std::cout << "clear succeeds";
+    ShelfPack::ShelfPackOptions options;
+    options.mergeFreebins = true;
+    ShelfPack sprite(64, 64, options);
 
-    ShelfPack sprite(10, 10);
     Bin* bin1 = sprite.packOne(-1, 10, 10);
+    Bin* bin2 = sprite.packOne(-1, 10, 10);
+    Bin* bin3 = sprite.packOne(-1, 10, 10);
+    Bin* bin4 = sprite.packOne(-1, 10, 15);    // new shelf below
+    sprite.unref(*bin1);
+    sprite.unref(*bin2);
 
-    //  x: 0, y: 0, w: 10, h: 10
-    assert(bin1->id == 1);
-    assert(bin1->x == 0);
-    assert(bin1->y == 0);
-    assert(bin1->w == 10);
-    assert(bin1->h == 10);
-    assert(bin1->maxw == 10);
-    assert(bin1->maxh == 10);
+    //  x: 0, y: 0, w: 20, h: 10, the two free bins merged
+    Bin* bin5 = sprite.packOne(-1, 20, 10);
+    assert(bin5->x == 0);
+    assert(bin5->y == 0);
 
-    Bin* bin2 = sprite.packOne(-1, 10, 10);
-    assert(bin2 == NULL);
+    // freeing the bin at the end of a shelf gives the space back..
+    sprite.unref(*bin3);
+    Bin* bin6 = sprite.packOne(-1, 40, 10);
+    assert(bin6->x == 20);
+    assert(bin6->y == 0);
 
-    sprite.clear();
+    // freeing the bottom shelf's only bin removes the shelf..
+    sprite.unref(*bin4);
+    Bin* bin7 = sprite.packOne(-1, 10, 20);
+    assert(bin7->x == 0);
+    assert(bin7->y == 10);
 
-    Bin* bin3 = sprite.packOne(-1, 10, 10);
+    std::cout << " - OK" << std::endl;
+}
 
-    //  x: 0, y: 0, w: 10, h: 10
-    assert(bin3->id == 1);    // clear resets max id
-    assert(bin3->x == 0);
-    assert(bin3->y == 0);
-    assert(bin3->w == 10);
-    assert(bin3->h == 10);
-    assert(bin3->maxw == 10);
-    assert(bin3->maxh == 10);
+void testUnref4() {
+    std::cout << "unref() batch unrefs bins by id";
+
+    ShelfPack sprite(64, 64);
+    sprite.packOne(1, 10, 10);
+    sprite.packOne(2, 10, 10);
+    sprite.packOne(2, 10, 10);
+
+    int32_t ids[] = { 1, 2, 7 };
+    assert(sprite.unref(3, ids) == 1);
+    assert(sprite.getBin(1) == NULL);
+    assert(sprite.getBin(2)->refcount() == 1);
+    assert(sprite.unref(3, ids) == 1);
+    assert(sprite.getBin(2) == NULL);
 
     std::cout << " - OK" << std::endl;
 }
 
-void testShrink() {
-    std::cout << "shrink succeeds";
+void testUnref5() {
+    std::cout << "unref() keeps bins packed until evicted with evictUnused";
 
-    ShelfPack sprite(20, 20);
-    sprite.packOne(-1, 10, 5);
+    ShelfPack::ShelfPackOptions options;
+    options.evictUnused = true;
+    ShelfPack sprite(30, 10, options);
 
-    assert(sprite.width() == 20);
-    assert(sprite.height() == 20);
+    sprite.packOne(1, 10, 10);
+    sprite.packOne(2, 10, 10);
+    sprite.packOne(3, 10, 10);
+    int32_t ids[] = { 1, 2 };
+    assert(sprite.unref(2, ids) == 2);
+    assert(sprite.unusedBins() == 2);
+    assert(sprite.getBin(1)->refcount() == 0);
 
-    sprite.shrink();
+    // packing an unused bin's id refs it again, in place..
+    Bin* bin1 = sprite.packOne(1, 10, 10);
+    assert(bin1->x == 0);
+    assert(bin1->refcount() == 1);
+    assert(sprite.unusedBins() == 1);
 
-    assert(sprite.width() == 10);
-    assert(sprite.height() == 5);
+    // no room, the unused bin is evicted..
+    Bin* bin4 = sprite.packOne(4, 10, 10);
+    assert(bin4->x == 10);
+    assert(sprite.getBin(2) == NULL);
+    assert(sprite.unusedBins() == 0);
+    assert(sprite.packOne(5, 10, 10) == NULL);
+
+    // evicting least recently used first..
+    sprite.unref(*sprite.getBin(4));
+    sprite.unref(*bin1);
+    assert(sprite.evict(1) == 1);
+    assert(sprite.getBin(4) == NULL);
+    assert(sprite.getBin(1) == bin1);
+    assert(sprite.unusedBins() == 1);
 
     std::cout << " - OK" << std::endl;
 }
 
-void testResize1() {
-    std::cout << "resize larger succeeds";
+void testUnref6() {
+    std::cout << "unref() batch frees bins side by side as one free bin, and can be rolled back";
 
-    ShelfPack sprite(10, 10);
+    ShelfPack::ShelfPackOptions options;
+    options.splitFreebins = true;
+    options.mergeFreebins = true;
+    ShelfPack sprite(50, 20, options);
+    for (int32_t id = 1; id <= 5; id++) {
+        sprite.packOne(id, 10, 10);
+    }
+
+    auto freebins = [&sprite]() {
+        std::vector<int32_t> widths;
+        sprite.forEachFreebin([&](const Bin& bin) { widths.push_back(bin.maxw); });
+        return widths;
+    };
+
+    int32_t ids[] = { 3, 1, 2 };
+    sprite.begin();
+    assert(sprite.unref(3, ids) == 3);
+    assert(freebins() == std::vector<int32_t>({ 30 }));
+    sprite.rollback();
+    assert(freebins().empty());
+    for (int32_t id = 1; id <= 3; id++) {
+        assert(sprite.getBin(id)->refcount() == 1);
+    }
+
+    assert(sprite.unref(3, ids) == 3);
+    Bin* bin6 = sprite.packOne(6, 30, 10);
+    assert(bin6->x == 0 && bin6->y == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testUnref7() {
+    std::cout << "evictUnused evicts the least recently used bin that is large enough";
+
+    ShelfPack::ShelfPackOptions options;
+    options.evictUnused = true;
+    ShelfPack sprite(40, 10, options);
+    sprite.packOne(1, 10, 10);
+    sprite.packOne(2, 20, 10);
+    sprite.packOne(3, 10, 10);
+    int32_t ids[] = { 1, 3, 2 };
+    assert(sprite.unref(3, ids) == 3);
+
+    Bin* bin4 = sprite.packOne(4, 20, 10);   // bins 1 and 3 are older, but too small
+    assert(bin4->x == 10);
+    assert(sprite.getBin(2) == NULL);
+
+    Bin* bin5 = sprite.packOne(5, 10, 10);
+    assert(bin5->x == 0);
+    assert(sprite.getBin(1) == NULL);
+    assert(sprite.getBin(3)->refcount() == 0);
+    assert(sprite.unusedBins() == 1);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testForEach1() {
+    std::cout << "forEachShelf() and forEachBin() visit shelves and bins in spatial order";
+
+    ShelfPack sprite(30, 64);
+    sprite.packOne(5, 10, 20);
+    sprite.packOne(1, 10, 10);
+    sprite.packOne(3, 10, 20);
+    sprite.packOne(2, 10, 10);
+    sprite.packOne(4, 20, 10);
+
+    std::vector<int32_t> shelves;
+    sprite.forEachShelf([&](const Shelf& shelf) { shelves.push_back(shelf.y()); });
+    assert(shelves == std::vector<int32_t>({ 0, 20 }));
+
+    std::vector<int32_t> ids;
+    sprite.forEachBin([&](const Bin& bin) { ids.push_back(bin.id); }, ShelfPack::VisitOrder::Spatial);
+    assert(ids == std::vector<int32_t>({ 5, 1, 3, 2, 4 }));
+
+    int32_t count = 0;
+    sprite.forEachBin([&](const Bin& bin) { count += bin.refcount(); });
+    assert(count == 5);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testForEach2() {
+    std::cout << "forEachFreebin() visits the free bins";
+
+    ShelfPack sprite(30, 30);
+    Bin* bin1 = sprite.packOne(-1, 10, 10);
+    Bin* bin2 = sprite.packOne(-1, 10, 10);
+    sprite.packOne(-1, 10, 10);
+    Bin* bin4 = sprite.packOne(-1, 10, 20);
+    sprite.unref(*bin4);
+    sprite.unref(*bin2);
+    sprite.unref(*bin1);
+
+    std::vector<int32_t> xs;
+    sprite.forEachFreebin([&](const Bin& bin) {
+        assert(bin.refcount() == 0);
+        xs.push_back(bin.y * 100 + bin.x);
+    }, ShelfPack::VisitOrder::Spatial);
+    assert(xs == std::vector<int32_t>({ 0, 10, 1000 }));
+
+    int32_t area = 0;
+    sprite.forEachFreebin([&](const Bin& bin) { area += bin.maxw * bin.maxh; });
+    assert(area == 400);
+
+    // spatial visits can nest..
+    ShelfPack nested(40, 10);
+    for (int32_t i = 0; i < 4; i++) {
+        nested.packOne(-1, 10, 10);
+    }
+    nested.unref(*nested.getBin(1));
+    nested.unref(*nested.getBin(3));
+    xs.clear();
+    int32_t free = 0;
+    nested.forEachBin([&](const Bin& bin) {
+        assert(bin.refcount() == 1);
+        xs.push_back(bin.x);
+        nested.forEachFreebin([&](const Bin&) { free++; }, ShelfPack::VisitOrder::Spatial);
+    }, ShelfPack::VisitOrder::Spatial);
+    assert(xs == std::vector<int32_t>({ 10, 30 }) && free == 4);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testForEach3() {
+    std::cout << "forEachShelf() reports shelf widths after resize() and shrink()";
+
+    ShelfPack sprite(64, 64);
+    sprite.packOne(-1, 10, 10);
+    sprite.packOne(-1, 6, 20);
+
+    sprite.shrink();
+    assert(sprite.width() == 10);
+    std::vector<int32_t> widths;
+    sprite.forEachShelf([&](const Shelf& shelf) {
+        assert(shelf.wfree() == shelf.w() - shelf.x());
+        widths.push_back(shelf.w());
+        widths.push_back(shelf.wfree());
+    });
+    assert(widths == std::vector<int32_t>({ 10, 0, 10, 4 }));
+
+    sprite.resize(40, 64);
+    widths.clear();
+    sprite.forEachShelf([&](const Shelf& shelf) { widths.push_back(shelf.wfree()); });
+    assert(widths == std::vector<int32_t>({ 30, 34 }));
+
+    // snapshots do not depend on how the sprite got to its width..
+    ShelfPack sized(40, 64);
+    sized.packOne(-1, 10, 10);
+    sized.packOne(-1, 6, 20);
+    assert(sprite.serialize() == sized.serialize());
+
+    // nor do shelves restored by rollback()..
+    sprite.begin();
+    sprite.resize(128, 64);
+    sprite.packOne(-1, 100, 10);
+    sprite.rollback();
+    widths.clear();
+    sprite.forEachShelf([&](const Shelf& shelf) {
+        widths.push_back(shelf.w());
+        widths.push_back(shelf.wfree());
+    });
+    assert(widths == std::vector<int32_t>({ 40, 30, 40, 34 }));
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testHeightHistogram() {
+    std::cout << "heightHistogram() counts referenced bins by height";
+
+    ShelfPack sprite(64, 64);
+    assert(sprite.heightHistogram().empty());
+
+    Bin* bin1 = sprite.packOne(1, 10, 10);
+    Bin* bin2 = sprite.packOne(2, 10, 10);
+    Bin* bin3 = sprite.packOne(3, 10, 15);
+    sprite.ref(*bin3);   // no new entry, only the first ref counts
+
+    const std::vector<int32_t>& histogram = sprite.heightHistogram();
+    assert(histogram.size() > 15);
+    assert(histogram[10] == 2);
+    assert(histogram[15] == 1);
+    assert(histogram[12] == 0);
+
+    sprite.unref(*bin1);
+    assert(histogram[10] == 1);
+    sprite.unref(*bin3);
+    assert(histogram[15] == 1);   // still referenced once
+    sprite.unref(*bin3);
+    assert(histogram[15] == 0);
+
+    sprite.packOne(4, 10, 9);     // reuses a free bin, counted by its new height
+    assert(histogram[9] == 1);
+    assert(histogram[10] == 1);
+    assert(bin2->refcount() == 1);
+
+    sprite.clear();
+    assert(sprite.heightHistogram().empty());
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testStats() {
+    std::cout << "stats() counts how bins were placed and how the area is used";
+
+    ShelfPack sprite(64, 64);
+    Bin* bin1 = sprite.packOne(-1, 10, 10);     // new shelf
+    Bin* bin2 = sprite.packOne(-1, 10, 10);     // exact height shelf
+    sprite.packOne(-1, 10, 5);                  // taller shelf
+    assert(sprite.packOne(bin1->id, 10, 10) == bin1);  // already packed
+    sprite.unref(*bin2);
+    Bin* bin4 = sprite.packOne(-1, 10, 10);     // exact free bin
+    sprite.unref(*bin4);
+    sprite.packOne(-1, 8, 8);                   // larger free bin
+    assert(sprite.packOne(-1, 100, 10) == nullptr);
+
+    ShelfPack::ShelfPackStats stats = sprite.stats();
+    assert(stats.newShelves == 1);
+    assert(stats.exactShelves == 1);
+    assert(stats.tallerShelves == 1);
+    assert(stats.refs == 1);
+    assert(stats.exactFreebins == 1);
+    assert(stats.bestFreebins == 1);
+    assert(stats.outOfSpace == 1);
+    assert(stats.packs() == 7);
+    assert(stats.autoResizes == 0);
+    assert(stats.bucketsScanned > 0);
+    assert(stats.freebinsScanned > 0);
+
+    assert(stats.usedArea == 100 + 50 + 64);
+    assert(stats.slackArea == 50 + 36);
+    assert(stats.freebinArea == 0);
+    assert(stats.shelfTailArea == 64 * 10 - 300);
+    assert(stats.spriteArea == 64 * 64);
+    assert(stats.occupancy() == 214.0 / 4096.0);
+    assert(stats.fragmentation() == 86.0 / 300.0);
+
+    ShelfPack::ShelfPackOptions options;
+    options.autoResize = true;
+    ShelfPack sprite2(10, 10, options);
+    sprite2.packOne(-1, 10, 10);
+    sprite2.packOne(-1, 10, 10);
+    assert(sprite2.stats().autoResizes == 1);
+    assert(sprite2.stats().packs() == 2);
+
+    sprite.clear();
+    assert(sprite.stats().packs() == 0);
+    assert(sprite.stats().usedArea == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testCompact1() {
+    std::cout << "compact() moves bins off the bottom shelves into free space";
+
+    ShelfPack sprite(30, 64);
+    Bin* bin1 = sprite.packOne(-1, 10, 20);
+    Bin* bin2 = sprite.packOne(-1, 10, 20);
+    Bin* bin3 = sprite.packOne(-1, 10, 20);
+    Bin* bin4 = sprite.packOne(-1, 10, 10);     // new shelf below
+    sprite.unref(*bin2);
+
+    std::vector<ShelfPack::Move> moves = sprite.compact();
+    assert(moves.size() == 1);
+    assert(moves[0].id == bin4->id);
+    assert(moves[0].w == 10);
+    assert(moves[0].h == 10);
+    assert(moves[0].fromX == 0);
+    assert(moves[0].fromY == 20);
+    assert(moves[0].toX == 10);
+    assert(moves[0].toY == 0);
+
+    //  x: 10, y: 0, w: 10, h: 10, in the freed slot
+    assert(sprite.getBin(bin4->id) == bin4);
+    assert(bin4->x == 10);
+    assert(bin4->y == 0);
+    assert(bin4->maxw == 10);
+    assert(bin4->maxh == 20);
+    assert(bin1->x == 0 && bin3->x == 20);
+
+    sprite.shrink();
+    assert(sprite.width() == 30);
+    assert(sprite.height() == 20);
+
+    // the emptied shelf is gone, a new one opens in its place..
+    sprite.resize(30, 64);
+    Bin* bin5 = sprite.packOne(-1, 10, 10);
+    assert(bin5->x == 0);
+    assert(bin5->y == 20);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testCompact2() {
+    std::cout << "compact() stays within its budget";
+
+    ShelfPack sprite(30, 64);
+    sprite.packOne(-1, 10, 20);
+    Bin* bin2 = sprite.packOne(-1, 10, 20);
+    Bin* bin3 = sprite.packOne(-1, 10, 20);
+    Bin* bin4 = sprite.packOne(-1, 10, 10);
+    Bin* bin5 = sprite.packOne(-1, 10, 10);
+    sprite.unref(*bin2);
+    sprite.unref(*bin3);
+
+    ShelfPack::CompactOptions options;
+    options.maxMoves = 1;
+    assert(sprite.compact(options).empty());   // the bottom shelf needs 2 moves
+    assert(bin4->y == 20 && bin5->y == 20);
+
+    options.maxMoves = 2;
+    std::vector<ShelfPack::Move> moves = sprite.compact(options);
+    assert(moves.size() == 2);
+    assert(bin4->y == 0 && bin5->y == 0);
+    assert(bin4->x != bin5->x);
+
+    assert(sprite.compact().empty());   // nothing left to do
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testCompact3() {
+    std::cout << "compact() keeps unused bins on the shelves it keeps";
+
+    ShelfPack::ShelfPackOptions options;
+    options.evictUnused = true;
+    ShelfPack sprite(30, 64, options);
+    Bin* bin1 = sprite.packOne(-1, 10, 20);
+    Bin* bin2 = sprite.packOne(-1, 10, 20);
+    Bin* filler = sprite.packOne(-1, 10, 20);
+    Bin* bin3 = sprite.packOne(-1, 10, 10);     // new shelf below
+    Bin* bin4 = sprite.packOne(-1, 10, 10);
+    int32_t id2 = bin2->id, id4 = bin4->id;
+    sprite.unref(*filler);
+    assert(sprite.evict() == 1);                // free room at the end of the top shelf
+    sprite.unref(*bin2);
+    sprite.unref(*bin4);
+
+    //  x: 20, y: 0, bin3 moves to the end of the top shelf, and the bottom one is dropped
+    std::vector<ShelfPack::Move> moves = sprite.compact();
+    assert(moves.size() == 1 && moves[0].id == bin3->id);
+    assert(bin3->x == 20 && bin3->y == 0);
+
+    // the unused bin on the kept shelf can still be revived, the one on the dropped shelf is gone
+    assert(sprite.unusedBins() == 1);
+    assert(sprite.getBin(id4) == NULL);
+    assert(sprite.stats().evictions == 2);       // the filler, and bin4
+    assert(sprite.getBin(id2) == bin2 && bin2->refcount() == 0);
+    assert(sprite.packOne(id2, 10, 20) == bin2);
+    assert(bin2->x == 10 && bin2->y == 0 && bin2->refcount() == 1);
+    assert(bin1->x == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testSerialize1() {
+    std::cout << "deserialize() restores a serialized sprite";
+
+    ShelfPack::ShelfPackOptions options;
+    options.autoResize = true;
+    ShelfPack sprite(30, 30, options);
+    for (int32_t i = 0; i < 20; i++) {
+        sprite.packOne(-1, 5 + i % 3 * 5, 5 + i % 2 * 5);
+    }
+    sprite.ref(*sprite.getBin(3));
+    sprite.unref(*sprite.getBin(4));
+    sprite.unref(*sprite.getBin(7));
+    sprite.unref(*sprite.getBin(8));
+    std::vector<uint8_t> snapshot = sprite.serialize();
+
+    ShelfPack copy;
+    assert(copy.deserialize(snapshot.data(), snapshot.size()));
+    assert(copy.width() == sprite.width());
+    assert(copy.height() == sprite.height());
+    assert(copy.heightHistogram() == sprite.heightHistogram());
+    assert(copy.stats().packs() == sprite.stats().packs());
+    assert(copy.stats().freebinArea == sprite.stats().freebinArea);
+    assert(copy.serialize().size() == snapshot.size());
+
+    for (int32_t id = 1; id <= 20; id++) {
+        Bin* bin = sprite.getBin(id);
+        Bin* restored = copy.getBin(id);
+        assert(!bin == !restored);
+        if (bin) {
+            assert(restored->x == bin->x && restored->y == bin->y);
+            assert(restored->w == bin->w && restored->h == bin->h);
+            assert(restored->refcount() == bin->refcount());
+        }
+    }
+
+    // both reuse the same free bins and shelves from here on..
+    for (int32_t i = 0; i < 10; i++) {
+        Bin* bin = sprite.packOne(-1, 5 + i % 2 * 5, 5 + i % 3 * 5);
+        Bin* restored = copy.packOne(-1, 5 + i % 2 * 5, 5 + i % 3 * 5);
+        assert(restored->id == bin->id);
+        assert(restored->x == bin->x && restored->y == bin->y);
+    }
+    assert(copy.width() == sprite.width());
+    assert(copy.height() == sprite.height());
+
+    // all the counters are restored..
+    ShelfPack::ShelfPackOptions cacheOptions;
+    cacheOptions.evictUnused = true;
+    ShelfPack cache(20, 10, cacheOptions);
+    cache.packOne(-1, 10, 10);
+    cache.unref(*cache.packOne(-1, 10, 10));
+    cache.packOne(-1, 10, 10);
+    snapshot = cache.serialize();
+    ShelfPack cacheCopy(20, 10, cacheOptions);
+    assert(cacheCopy.deserialize(snapshot.data(), snapshot.size()));
+    assert(cacheCopy.stats().evictions == 1 && cache.stats().evictions == 1);
+    assert(cacheCopy.stats().shelfUpdates == cache.stats().shelfUpdates);
+    assert(cacheCopy.stats().packs() == cache.stats().packs());
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testSerialize2() {
+    std::cout << "deserialize() rejects an invalid snapshot and leaves the sprite unchanged";
+
+    ShelfPack sprite(64, 64);
+    sprite.packOne(-1, 10, 10);
+    std::vector<uint8_t> snapshot = sprite.serialize();
+
+    ShelfPack copy(32, 32);
+    Bin* bin = copy.packOne(-1, 20, 20);
+    assert(!copy.deserialize(snapshot.data(), snapshot.size() - 1));   // truncated
+
+    std::vector<uint8_t> corrupt(snapshot);
+    corrupt[0] = 'X';
+    assert(!copy.deserialize(corrupt.data(), corrupt.size()));   // not a snapshot
+
+    corrupt = snapshot;
+    corrupt[8] = '0';
+    assert(!copy.deserialize(corrupt.data(), corrupt.size()));   // another shelf-pack version
+
+    corrupt = snapshot;
+    corrupt[corrupt.size() - 4] = 100;   // bin below the last shelf
+    assert(!copy.deserialize(corrupt.data(), corrupt.size()));
+
+    ShelfPack::ShelfPackOptions options;
+    options.alignment = 4;
+    ShelfPack aligned(64, 64, options);
+    assert(!aligned.deserialize(snapshot.data(), snapshot.size()));   // placed without the alignment
+    snapshot = aligned.serialize();
+    assert(!copy.deserialize(snapshot.data(), snapshot.size()));
+
+    assert(copy.width() == 32);
+    assert(copy.getBin(1) == bin);
+    assert(bin->w == 20);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testTransaction1() {
+    std::cout << "rollback() undoes everything since begin()";
+
+    ShelfPack sprite(64, 64);
+    Bin* bin1 = sprite.packOne(-1, 10, 10);
+    Bin* bin2 = sprite.packOne(-1, 10, 10);
+    sprite.unref(*bin2);
+    std::vector<uint8_t> before = sprite.serialize();
+
+    sprite.begin();
+    sprite.packOne(-1, 10, 10);            // reuses the free bin
+    sprite.packOne(-1, 20, 20);            // adds a shelf
+    sprite.ref(*bin1);
+    sprite.resize(128, 128);
+    assert(sprite.rollback());
+    assert(!sprite.rollback());
+
+    assert(sprite.serialize() == before);
+    assert(sprite.width() == 64 && sprite.height() == 64);
+    assert(bin1->refcount() == 1);
+
+    // ids are generated again, and the free bin is still there to reuse
+    Bin* bin3 = sprite.packOne(-1, 10, 10);
+    assert(bin3->id == 3);
+    assert(bin3->x == 10 && bin3->y == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testTransaction2() {
+    std::cout << "atomic pack() packs all bins or none";
+
+    ShelfPack sprite(30, 30);
+    sprite.packOne(-1, 10, 10);
+
+    std::vector<Bin> bins;
+    bins.emplace_back(-1, 10, 10);
+    bins.emplace_back(-1, 40, 10);
+    bins.emplace_back(-1, 10, 10);
+
+    ShelfPack::PackOptions options;
+    options.atomic = true;
+    std::vector<Bin*> results = sprite.pack(bins, options);
+    assert(results.empty());
+    assert(sprite.stats().usedArea == 100);
+
+    int32_t widths[]  = { 10, 40, 10 };
+    int32_t heights[] = { 10, 10, 10 };
+    Bin* out[3];
+    ShelfPack::PackStatus statuses[3];
+    assert(sprite.pack(3, widths, heights, nullptr, out, statuses, options) == 0);
+    assert(statuses[0] == ShelfPack::PackStatus::RolledBack);
+    assert(statuses[1] == ShelfPack::PackStatus::OutOfSpace);
+    assert(out[0] == nullptr && out[1] == nullptr && out[2] == nullptr);
+    assert(sprite.stats().usedArea == 100);
+
+    // without the bin that does not fit, the batch goes in
+    bins.erase(bins.begin() + 1);
+    results = sprite.pack(bins, options);
+    assert(results.size() == 2);
+    assert(results[0]->id == 2 && results[0]->x == 10);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testTransaction3() {
+    std::cout << "transactions nest";
+
+    ShelfPack sprite(64, 64);
+    sprite.begin();
+    Bin* bin1 = sprite.packOne(-1, 10, 10);
+    sprite.begin();
+    sprite.packOne(-1, 10, 10);
+    assert(sprite.commit());
+    sprite.begin();
+    sprite.packOne(-1, 10, 10);
+    assert(sprite.rollback());
+    assert(sprite.stats().usedArea == 200);
+
+    // the outer rollback also undoes the committed inner transaction
+    assert(sprite.rollback());
+    assert(sprite.stats().usedArea == 0);
+    assert(sprite.getBin(1) == nullptr);
+    (void)bin1;
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testDirty1() {
+    std::cout << "takeDirtyRegions() returns one region per shelf, merged with adjacent shelves";
+
+    ShelfPack::ShelfPackOptions options;
+    options.trackDirty = true;
+    ShelfPack sprite(20, 64, options);
+
+    sprite.packOne(-1, 10, 10);
+    sprite.packOne(-1, 10, 10);
+    sprite.packOne(-1, 20, 10);            // second shelf, same width as the first row
+    sprite.packOne(-1, 5, 20);             // third shelf, much narrower
+
+    std::vector<ShelfPack::DirtyRegion> regions = sprite.takeDirtyRegions();
+    assert(regions.size() == 2);
+    //  x: 0, y: 0, w: 20, h: 20, the first two shelves
+    assert(regions[0].x == 0 && regions[0].y == 0 && regions[0].w == 20 && regions[0].h == 20);
+    //  x: 0, y: 20, w: 5, h: 20
+    assert(regions[1].x == 0 && regions[1].y == 20 && regions[1].w == 5 && regions[1].h == 20);
+
+    assert(sprite.takeDirtyRegions().empty());
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testDirty2() {
+    std::cout << "takeDirtyRegions() includes reused free bins, but not ref'd bins";
+
+    ShelfPack::ShelfPackOptions options;
+    options.trackDirty = true;
+    ShelfPack sprite(64, 64, options);
+
+    Bin* bin1 = sprite.packOne(-1, 10, 10);
+    sprite.packOne(-1, 10, 10);
+    Bin* bin3 = sprite.packOne(-1, 10, 10);
+    sprite.takeDirtyRegions();
+
+    sprite.ref(*bin1);
+    assert(sprite.takeDirtyRegions().empty());
+
+    sprite.unref(*bin3);
+    Bin* bin4 = sprite.packOne(-1, 8, 6);
+    assert(bin4->x == 20 && bin4->y == 0);
+
+    std::vector<ShelfPack::DirtyRegion> regions = sprite.takeDirtyRegions();
+    assert(regions.size() == 1);
+    //  x: 20, y: 0, w: 8, h: 6, only the new bin, not the whole free bin
+    assert(regions[0].x == 20 && regions[0].y == 0 && regions[0].w == 8 && regions[0].h == 6);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testMove() {
+    std::cout << "a moved ShelfPack keeps its bins, and the moved-from one is empty";
+
+    ShelfPack sprite1(64, 64);
+    Bin* bin1 = sprite1.packOne(-1, 10, 10);
+    sprite1.packOne(-1, 10, 20);
+
+    ShelfPack sprite2(std::move(sprite1));
+    assert(sprite2.getBin(1) == bin1);
+    Bin* bin3 = sprite2.packOne(-1, 10, 10);
+    assert(bin3->x == 10 && bin3->y == 0);
+
+    assert(sprite1.getBin(1) == NULL);
+    assert(sprite1.width() == 64);
+    Bin* bin4 = sprite1.packOne(-1, 10, 10);
+    assert(bin4->id == 1 && bin4->x == 0 && bin4->y == 0);
+
+    std::vector<ShelfPack> sprites;
+    sprites.push_back(std::move(sprite2));
+    sprites.emplace_back(32, 32);
+    assert(sprites[0].getBin(3) == bin3);
+    Bin* bin5 = sprites[0].packOne(-1, 10, 20);
+    assert(bin5->x == 10 && bin5->y == 10);
+
+    // shelves take the width of the sprite they were moved to..
+    sprites[0].resize(100, 64);
+    sprites[0].forEachShelf([](const Shelf& shelf) { assert(shelf.w() == 100); });
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testMemory() {
+    std::cout << "reserveBins() and shrinkToFit() grow and release memoryUsage()";
+
+    ShelfPack sprite(1024, 1024);
+    std::size_t empty = sprite.memoryUsage();
+
+    sprite.reserveBins(10000, 100);
+    std::size_t reserved = sprite.memoryUsage();
+    assert(reserved >= empty + 10000 * sizeof(Bin));
+
+    for (int i = 0; i < 10000; i++) {
+        sprite.packOne(-1, 10, 10);
+    }
+    assert(sprite.memoryUsage() < reserved + 10000 * sizeof(Bin) / 4);
+
+    // clear() keeps the memory for reuse, shrinkToFit() gives it back
+    sprite.clear();
+    assert(sprite.memoryUsage() >= reserved);
+    sprite.shrinkToFit();
+    assert(sprite.memoryUsage() < 1024);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testClear() {
+    std::cout << "clear succeeds";
+
+    ShelfPack sprite(10, 10);
+    Bin* bin1 = sprite.packOne(-1, 10, 10);
+
+    //  x: 0, y: 0, w: 10, h: 10
+    assert(bin1->id == 1);
+    assert(bin1->x == 0);
+    assert(bin1->y == 0);
+    assert(bin1->w == 10);
+    assert(bin1->h == 10);
+    assert(bin1->maxw == 10);
+    assert(bin1->maxh == 10);
+
+    Bin* bin2 = sprite.packOne(-1, 10, 10);
+    assert(bin2 == NULL);
+
+    sprite.clear();
+
+    Bin* bin3 = sprite.packOne(-1, 10, 10);
+
+    //  x: 0, y: 0, w: 10, h: 10
+    assert(bin3->id == 1);    // clear resets max id
+    assert(bin3->x == 0);
+    assert(bin3->y == 0);
+    assert(bin3->w == 10);
+    assert(bin3->h == 10);
+    assert(bin3->maxw == 10);
+    assert(bin3->maxh == 10);
+
+    std::cout << " - OK" << std::endl;
+}
+class CountingAllocator : public BinAllocator {
+public:
+    void* allocate(std::size_t bytes) override {
+        allocations++;
+        return ::operator new(bytes);
+    }
+    void deallocate(void* p, std::size_t) override {
+        deallocations++;
+        ::operator delete(p);
+    }
+    int32_t allocations = 0;
+    int32_t deallocations = 0;
+};
+
+void testClear2() {
+    std::cout << "clear keeps bin memory for reuse, from a custom allocator";
+
+    CountingAllocator allocator;
+    {
+        ShelfPack::ShelfPackOptions options;
+        options.allocator = &allocator;
+        ShelfPack sprite(1024, 1024, options);
+
+        std::vector<Bin*> bins;
+        for (int32_t i = 0; i < 1000; i++) {
+            bins.push_back(sprite.packOne(-1, 10, 10));
+        }
+        assert(allocator.allocations > 0);
+        assert(allocator.deallocations == 0);
+        for (int32_t i = 0; i < 1000; i++) {
+            assert(bins[i]->id == i + 1);   // earlier bins did not move
+        }
+
+        int32_t allocations = allocator.allocations;
+        sprite.clear();
+        for (int32_t i = 0; i < 1000; i++) {
+            sprite.packOne(-1, 10, 10);
+        }
+        assert(allocator.allocations == allocations);
+        assert(sprite.getBin(1) == bins[0]);   // same memory
+    }
+    assert(allocator.deallocations == allocator.allocations);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testShrink() {
+    std::cout << "shrink succeeds";
+
+    ShelfPack sprite(20, 20);
+    sprite.packOne(-1, 10, 5);
+
+    assert(sprite.width() == 20);
+    assert(sprite.height() == 20);
+
+    sprite.shrink();
+
+    assert(sprite.width() == 10);
+    assert(sprite.height() == 5);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testShrink2() {
+    std::cout << "batch pack() can skip shrink, and shrink later";
+
+    std::vector<Bin> bins1, bins2;
+    bins1.emplace_back(-1, 10, 10);
+    bins1.emplace_back(-1, 30, 10);
+    bins2.emplace_back(-1, 10, 15);
+
+    ShelfPack::PackOptions options;
+    options.shrink = false;
+
+    ShelfPack sprite(64, 64);
+    sprite.pack(bins1, options);
+    assert(sprite.width() == 64);
+    assert(sprite.height() == 64);
+
+    std::vector<Bin*> results = sprite.pack(bins2, options);
+    assert(sprite.width() == 64);
+    assert(sprite.height() == 64);
+
+    sprite.unref(*results[0]);   // freed bins still count towards the used extent
+    sprite.shrink();
+    assert(sprite.width() == 40);
+    assert(sprite.height() == 25);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testShrink3() {
+    std::cout << "shrink() and autoResize growth leave the shelves alone";
+
+    ShelfPack::ShelfPackOptions options;
+    options.autoResize = true;
+    ShelfPack sprite(16, 16, options);
+
+    std::vector<Bin> bins;
+    for (int32_t i = 0; i < 50; i++) {
+        bins.emplace_back(-1, 4 + i % 7, 4 + i % 5);
+    }
+    for (int32_t batch = 0; batch < 40; batch++) {
+        sprite.pack(bins);   // grows, then shrinks
+        ShelfPack::ShelfPackStats stats = sprite.stats();
+        assert(stats.shelfUpdates == stats.exactShelves + stats.tallerShelves + stats.newShelves);
+        sprite.forEachShelf([&](const Shelf& shelf) { assert(shelf.w() == sprite.width()); });
+    }
+    assert(sprite.stats().autoResizes > 1);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testResize1() {
+    std::cout << "resize larger succeeds";
+
+    ShelfPack sprite(10, 10);
     Bin* bin1 = sprite.packOne(1, 10, 10);
 
     //  x: 0, y: 0, w: 10, h: 10
@@ -1000,6 +2356,537 @@ void testResize3() {
     std::cout << " - OK" << std::endl;
 }
 
+void testResize4() {
+    std::cout << "reserve() grows the sprite, but never shrinks it";
+
+    ShelfPack sprite(64, 64);
+    sprite.packOne(-1, 10, 10);
+
+    sprite.reserve(128, 32);
+    assert(sprite.width() == 128);
+    assert(sprite.height() == 64);
+
+    // existing shelves pick up the new width..
+    Bin* bin = sprite.packOne(-1, 100, 10);
+    assert(bin->x == 10);
+    assert(bin->y == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testResize5() {
+    std::cout << "batch pack() with presize grows an autoResize sprite up front";
+
+    std::vector<Bin> bins;
+    for (int32_t i = 0; i < 16; i++) {
+        bins.emplace_back(-1, 10, 10);
+    }
+
+    ShelfPack::ShelfPackOptions options;
+    options.autoResize = true;
+    ShelfPack sprite(10, 10, options);
+
+    ShelfPack::PackOptions packOptions;
+    packOptions.presize = true;
+    std::vector<Bin*> results = sprite.pack(bins, packOptions);
+
+    assert(results.size() == 16);
+    assert(sprite.stats().autoResizes == 0);
+    assert(sprite.width() == 40);
+    assert(sprite.height() == 40);
+    assert(results[4]->x == 0);
+    assert(results[4]->y == 10);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+struct LinearGrowth {
+    static void grow(int64_t& w, int64_t& h, int32_t binw, int32_t binh) {
+        w = std::max(w, int64_t(binw)) + 16;
+        h = std::max(h, int64_t(binh)) + 16;
+    }
+};
+
+void testBasicShelfPack() {
+    std::cout << "BasicShelfPack supports other coordinate types and growth policies";
+
+    typedef BasicShelfPack<uint16_t> SmallPack;
+    static_assert(sizeof(SmallPack::Bin) < sizeof(Bin), "uint16_t bins are smaller");
+
+    SmallPack sprite(64, 64);
+    SmallPack::Bin* bin1 = sprite.packOne(-1, 10, 10);
+    SmallPack::Bin* bin2 = sprite.packOne(-1, 10, 20);
+    assert(bin1->x == 0 && bin1->y == 0);
+    assert(bin2->x == 0 && bin2->y == 10);
+    sprite.unref(*bin1);
+    assert(sprite.packOne(-1, 10, 10) == bin1);
+
+    std::vector<SmallPack::Bin> bins;
+    bins.emplace_back(-1, 20, 20);
+    std::vector<SmallPack::Bin*> results = sprite.pack(bins);
+    assert(results.size() == 1 && results[0]->x == 10 && results[0]->y == 10);
+
+    // autoResize stops before the sprite outgrows the coordinate type..
+    SmallPack::ShelfPackOptions options;
+    options.autoResize = true;
+    SmallPack sprite2(64, 64, options);
+    SmallPack::Bin* bin3 = sprite2.packOne(-1, 30000, 10);
+    assert(bin3->x == 0 && bin3->w == 30000);
+    assert(sprite2.width() == 60000);
+    sprite2.clear();
+    sprite2.resize(64, 64);
+    assert(sprite2.packOne(-1, 40000, 10) == nullptr);   // 80000 is too wide
+
+    BasicShelfPack<int32_t, LinearGrowth>::ShelfPackOptions options2;
+    options2.autoResize = true;
+    BasicShelfPack<int32_t, LinearGrowth> sprite3(16, 16, options2);
+    sprite3.packOne(-1, 16, 16);
+    sprite3.packOne(-1, 20, 20);
+    assert(sprite3.width() == 36);
+    assert(sprite3.height() == 36);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testSkyline1() {
+    std::cout << "SkylinePack packs bins where their top is lowest, and reuses the gaps below";
+
+    SkylinePack sprite(30, 30);
+    Bin* bin1 = sprite.packOne(-1, 10, 20);
+    Bin* bin2 = sprite.packOne(-1, 20, 10);
+    Bin* bin3 = sprite.packOne(-1, 30, 5);   // leaves a 20x10 gap below it
+    Bin* bin4 = sprite.packOne(-1, 20, 10);
+
+    assert(bin1->x == 0 && bin1->y == 0);
+    assert(bin2->x == 10 && bin2->y == 0);
+    assert(bin3->x == 0 && bin3->y == 20);
+    assert(bin4->x == 10 && bin4->y == 10);
+    assert(sprite.packOne(-1, 10, 10) == nullptr);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testSkyline2() {
+    std::cout << "SkylinePack splits free bins when reusing them";
+
+    SkylinePack sprite(30, 30);
+    Bin* bin1 = sprite.packOne(-1, 20, 20);
+    assert(sprite.unref(*bin1) == 0);
+    assert(sprite.getBin(1) == nullptr);
+
+    Bin* bin2 = sprite.packOne(-1, 10, 5);
+    Bin* bin3 = sprite.packOne(-1, 10, 15);
+    Bin* bin4 = sprite.packOne(-1, 10, 20);
+    assert(bin2->x == 0 && bin2->y == 0);
+    assert(bin3->x == 0 && bin3->y == 5);
+    assert(bin4->x == 10 && bin4->y == 0);
+    assert(sprite.getBin(bin3->id) == bin3);
+
+    std::vector<Bin> bins;
+    bins.emplace_back(-1, 10, 15);
+    bins.emplace_back(-1, 10, 30);
+    SkylinePack::PackOptions options;
+    options.sort = SkylinePack::SortStrategy::HeightDesc;
+    std::vector<Bin*> results = sprite.pack(bins, options);
+    assert(results.size() == 1);   // the 10x15 bin no longer fits above the others
+    assert(results[0]->x == 20 && results[0]->y == 0 && results[0]->h == 30);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testSkyline3() {
+    std::cout << "SkylinePack merges an unref'd bin with the free bins next to it";
+
+    SkylinePack sprite(30, 30);
+    Bin* bin1 = sprite.packOne(-1, 20, 20);
+    sprite.unref(*bin1);
+
+    Bin* bin2 = sprite.packOne(-1, 10, 5);   // splits the 20x20 free bin in three
+    assert(bin2->x == 0 && bin2->y == 0);
+    sprite.unref(*bin2);
+
+    Bin* bin3 = sprite.packOne(-1, 20, 20);   // only fits if the pieces are whole again
+    assert(bin3 && bin3->x == 0 && bin3->y == 0);
+    assert(sprite.packOne(-1, 10, 5)->x == 20);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testMaxRects1() {
+    std::cout << "MaxRectsPack packs bins bottom-left into the free rectangles";
+
+    MaxRectsPack sprite(30, 30);
+    Bin* bin1 = sprite.packOne(-1, 10, 20);
+    Bin* bin2 = sprite.packOne(-1, 20, 10);
+    Bin* bin3 = sprite.packOne(-1, 30, 5);
+    Bin* bin4 = sprite.packOne(-1, 20, 10);
+
+    assert(bin1->x == 0 && bin1->y == 0);
+    assert(bin2->x == 10 && bin2->y == 0);
+    assert(bin3->x == 0 && bin3->y == 20);
+    assert(bin4->x == 10 && bin4->y == 10);
+    assert(sprite.packOne(-1, 10, 10) == nullptr);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testMaxRects2() {
+    std::cout << "MaxRectsPack reuses unref'd bins";
+
+    MaxRectsPack sprite(30, 30);
+    Bin* bin1 = sprite.packOne(-1, 20, 20);
+    sprite.ref(*bin1);
+    assert(sprite.unref(*bin1) == 1);
+    assert(sprite.unref(*bin1) == 0);
+    assert(sprite.getBin(1) == nullptr);
+
+    Bin* bin2 = sprite.packOne(-1, 20, 20);
+    assert(bin2->id == 2);
+    assert(bin2->x == 0 && bin2->y == 0);
+
+    Bin* bin3 = sprite.packOne(7, 10, 30);
+    assert(sprite.packOne(7, 10, 30) == bin3);
+    assert(bin3->refcount() == 2);
+    assert(bin3->x == 20 && bin3->y == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testMaxRects3() {
+    std::cout << "MaxRectsPack finds the highest free rectangle across bands, and after resize";
+
+    MaxRectsPack sprite(64, 256);
+    Bin* bin1 = sprite.packOne(-1, 50, 100);
+    Bin* bin2 = sprite.packOne(-1, 20, 20);
+    Bin* bin3 = sprite.packOne(-1, 10, 200);
+    assert(bin1->x == 0 && bin1->y == 0);
+    assert(bin2->x == 0 && bin2->y == 100);
+    assert(bin3->x == 50 && bin3->y == 0);
+
+    sprite.unref(*bin1);
+    Bin* bin4 = sprite.packOne(-1, 40, 90);
+    assert(bin4->x == 0 && bin4->y == 0);
+    Bin* bin5 = sprite.packOne(-1, 14, 50);   // too wide for what is left of the freed bin
+    assert(bin5->x == 20 && bin5->y == 100);
+
+    assert(sprite.resize(128, 256));
+    Bin* bin6 = sprite.packOne(-1, 60, 256);   // the free strip on the right is stretched
+    assert(bin6 && bin6->x == 60 && bin6->y == 0);
+    Bin* bin7 = sprite.packOne(-1, 10, 100);
+    assert(bin7->x == 40 && bin7->y == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testStream1() {
+    std::cout << "StreamPack places bins as they arrive, starting a new page when full";
+
+    std::vector<int32_t> pages;
+    StreamPack::StreamPackOptions options;
+    options.onPage = [&pages](int32_t page) { pages.push_back(page); };
+    StreamPack stream(30, 20, options);
+
+    StreamPack::Placement p1 = stream.packOne(-1, 10, 10);
+    StreamPack::Placement p2 = stream.packOne(-1, 10, 10);
+    StreamPack::Placement p3 = stream.packOne(-1, 10, 10);   // fills the shelf, which is finalized
+    StreamPack::Placement p4 = stream.packOne(-1, 10, 5);
+    StreamPack::Placement p5 = stream.packOne(-1, 10, 10);   // no room for a shelf, starts page 1
+
+    assert(p1.page == 0 && p1.x == 0 && p1.y == 0 && p1.id == 1);
+    assert(p2.page == 0 && p2.x == 10 && p2.y == 0);
+    assert(p3.page == 0 && p3.x == 20 && p3.y == 0);
+    assert(p4.page == 0 && p4.x == 0 && p4.y == 10);
+    assert(p5.page == 1 && p5.x == 0 && p5.y == 0 && p5.id == 5);
+    assert(stream.openShelves() == 2);
+    assert(pages.empty());   // page 0 still has an open shelf
+
+    StreamPack::Placement p6 = stream.packOne(-1, 31, 1);
+    assert(p6.page == -1 && p6.id == 6);
+
+    stream.finish();
+    assert(stream.openShelves() == 0);
+    assert(stream.pages() == 2);
+    assert((pages == std::vector<int32_t>{ 0, 1 }));
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testStream2() {
+    std::cout << "StreamPack finalizes the least recently used shelf, and shelves with little room left";
+
+    std::vector<int32_t> pages;
+    StreamPack::StreamPackOptions options;
+    options.maxShelves = 2;
+    options.minWidth = 5;
+    options.onPage = [&pages](int32_t page) { pages.push_back(page); };
+    StreamPack stream(30, 30, options);
+
+    int32_t widths[] = { 10, 10, 10, 10, 26 };
+    int32_t heights[] = { 10, 20, 5, 30, 8 };
+    int32_t ids[] = { 7, 3, -1, -1, -1 };
+    StreamPack::Placement placements[5];
+    assert(stream.pack(5, widths, heights, ids, placements) == 5);
+
+    assert(placements[0].page == 0 && placements[0].x == 0 && placements[0].y == 0 && placements[0].id == 7);
+    assert(placements[1].page == 0 && placements[1].x == 0 && placements[1].y == 10 && placements[1].id == 3);
+    assert(placements[2].page == 0 && placements[2].x == 10 && placements[2].y == 0 && placements[2].id == 8);
+    assert(placements[3].page == 1 && placements[3].x == 0 && placements[3].y == 0);   // evicts the 20 tall shelf
+    assert(placements[4].page == 2 && placements[4].x == 0 && placements[4].y == 0);   // evicts the 10 tall shelf
+    assert((pages == std::vector<int32_t>{ 0 }));
+    assert(stream.openShelves() == 1);   // the 8 tall shelf has less than `minWidth` left
+
+    stream.finish();
+    assert((pages == std::vector<int32_t>{ 0, 1, 2 }));
+    assert(stream.pages() == 3);
+
+    std::cout << " - OK" << std::endl;
+}
+
+
+void testConcurrent1() {
+    std::cout << "ConcurrentShelfPack packs, finds, refs and reuses bins";
+
+    ConcurrentShelfPack sprite(64, 64);
+    Bin* bin1 = sprite.packOne(-1, 10, 10);
+    Bin* bin2 = sprite.packOne(-1, 10, 10);
+    Bin* bin3 = sprite.packOne(7, 10, 15);
+
+    //  x: 0, y: 0, w: 10, h: 10
+    assert(bin1->id == 1);
+    assert(bin1->x == 0);
+    assert(bin1->y == 0);
+
+    //  x: 10, y: 0, w: 10, h: 10
+    assert(bin2->id == 2);
+    assert(bin2->x == 10);
+    assert(bin2->y == 0);
+
+    //  x: 0, y: 10, w: 10, h: 15
+    assert(bin3->id == 7);
+    assert(bin3->x == 0);
+    assert(bin3->y == 10);
+
+    assert(sprite.getBin(7) == bin3);
+    assert(sprite.packOne(7, 10, 15) == bin3);
+    assert(bin3->refcount() == 2);
+    assert(sprite.ref(*bin3) == 3);
+    assert(sprite.unref(*bin3) == 2);
+    assert(sprite.unref(*bin3) == 1);
+    assert(sprite.unref(*bin3) == 0);
+    assert(sprite.unref(*bin3) == 0);
+    assert(sprite.getBin(7) == NULL);
+
+    Bin* bin4 = sprite.packOne(-1, 10, 15);
+    assert(bin4 == bin3);   // reused bin3
+    assert(bin4->id == 8);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testConcurrent2() {
+    std::cout << "ConcurrentShelfPack packs from many threads without overlaps";
+
+    const int32_t size = 512;
+    ConcurrentShelfPack sprite(size, size);
+    const int32_t threads = 4;
+    const int32_t count = 1000;
+    std::vector<std::vector<Bin*>> results(threads);
+    std::vector<std::thread> workers;
+
+    for (int32_t t = 0; t < threads; t++) {
+        workers.emplace_back([&sprite, &results, t]() {
+            uint32_t seed = 17 + t;
+            for (int32_t i = 0; i < count; i++) {
+                seed = seed * 1103515245 + 12345;
+                int32_t w = 4 + (seed >> 16) % 8;
+                int32_t h = 4 + (seed >> 8) % 8;
+                Bin* bin = sprite.packOne(-1, w, h);
+                assert(bin);
+                results[t].push_back(bin);
+                if (i % 4 == 0) {   // churn through the free bins..
+                    sprite.unref(*bin);
+                    results[t].pop_back();
+                }
+                sprite.packOne(-2 - i % 50, 4, 4);   // shared ids
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::vector<int32_t> owner(size * size, 0);
+    for (const auto& bins : results) {
+        for (const Bin* bin : bins) {
+            assert(sprite.getBin(bin->id) == bin);
+            for (int32_t y = bin->y; y < bin->y + bin->h; y++) {
+                for (int32_t x = bin->x; x < bin->x + bin->w; x++) {
+                    assert(x < size && y < size);
+                    assert(owner[y * size + x] == 0);
+                    owner[y * size + x] = bin->id;
+                }
+            }
+        }
+    }
+    for (int32_t i = 0; i < 50; i++) {
+        Bin* shared = sprite.getBin(-2 - i);
+        assert(shared && shared->refcount() == threads * count / 50);
+    }
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testConcurrent3() {
+    std::cout << "ConcurrentShelfPack packOne() never returns a bin freed by another thread";
+
+    ConcurrentShelfPack sprite(256, 256);
+    const int32_t threads = 8;
+    std::atomic<int32_t> wrong(0);
+    std::vector<std::thread> workers;
+
+    for (int32_t t = 0; t < threads; t++) {
+        workers.emplace_back([&sprite, &wrong, t]() {
+            uint32_t seed = 31 + t;
+            for (int32_t i = 0; i < 200000; i++) {
+                seed = seed * 1103515245 + 12345;
+                int32_t id = 1 + (seed >> 16) % 8;   // few ids of one size, freed and reused all the time
+                Bin* bin = sprite.packOne(id, 4, 4);
+                assert(bin);
+                if (bin->id != id) {
+                    wrong++;
+                }
+                sprite.unref(*bin);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    assert(wrong == 0);
+    for (int32_t id = 1; id <= 8; id++) {
+        assert(sprite.getBin(id) == nullptr);
+    }
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testMultiPack() {
+    std::cout << "MultiPack spills bins onto more pages without overlaps";
+
+    MultiPack::MultiPackOptions options;
+    options.threads = 4;
+    MultiPack atlas(64, 64, options);
+
+    std::vector<Bin> bins;
+    for (int32_t i = 0; i < 2000; i++) {
+        bins.emplace_back(-1, 4 + i % 7, 4 + (i / 7) % 9);
+    }
+    bins.emplace_back(-1, 65, 10);   // larger than a page
+    bins.emplace_back(-1, 0, 10);    // no size
+
+    std::vector<MultiPack::Placement> placements = atlas.pack(bins);
+    assert(placements.size() == bins.size());
+    assert(atlas.pages() > 1);
+
+    std::vector<std::vector<int32_t>> owner(atlas.pages(), std::vector<int32_t>(64 * 64, -1));
+    for (int32_t i = 0; i < 2000; i++) {
+        const MultiPack::Placement& placement = placements[i];
+        assert(placement.page >= 0 && std::size_t(placement.page) < atlas.pages());
+        assert(placement.bin->w == bins[i].w && placement.bin->h == bins[i].h);
+        assert(placement.x == placement.bin->x && placement.y == placement.bin->y);
+        for (int32_t y = placement.y; y < placement.y + bins[i].h; y++) {
+            for (int32_t x = placement.x; x < placement.x + bins[i].w; x++) {
+                assert(x < 64 && y < 64);
+                assert(owner[placement.page][y * 64 + x] == -1);
+                owner[placement.page][y * 64 + x] = i;
+            }
+        }
+    }
+    assert(placements[2000].page == -1 && placements[2000].bin == NULL);
+    assert(placements[2001].page == -1 && placements[2001].bin == NULL);
+
+    for (std::size_t p = 0; p < atlas.pages(); p++) {
+        assert(atlas.page(p).width() == 64 && atlas.page(p).height() == 64);
+    }
+
+    std::size_t pages = atlas.pages();
+    placements = atlas.pack(std::vector<Bin>(1, Bin(-1, 64, 64)));   // a later batch opens a new page
+    assert(placements[0].page == int32_t(pages));
+    assert(placements[0].x == 0 && placements[0].y == 0);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testMultiPack2() {
+    std::cout << "MultiPack fills the pages it has before opening more";
+
+    MultiPack::MultiPackOptions options;
+    options.threads = 4;
+    MultiPack once(128, 128, options), batched(128, 128, options);
+
+    std::vector<Bin> bins;
+    for (int32_t i = 0; i < 4000; i++) {
+        bins.emplace_back(-1, 4 + (i * 7) % 13, 4 + (i * 5) % 11);
+    }
+    once.pack(bins);
+    for (std::size_t i = 0; i < bins.size(); i += 400) {
+        batched.pack(std::vector<Bin>(bins.begin() + std::ptrdiff_t(i), bins.begin() + std::ptrdiff_t(i + 400)));
+    }
+    assert(batched.pages() <= once.pages() + 1);
+
+    // a small bin goes on a page with room..
+    std::size_t pages = once.pages();
+    std::vector<MultiPack::Placement> placements = once.pack(std::vector<Bin>(1, Bin(-1, 4, 4)));
+    assert(placements[0].page >= 0 && placements[0].page < int32_t(pages));
+    assert(once.pages() == pages);
+
+    std::cout << " - OK" << std::endl;
+}
+
+void testMultiPack3() {
+    std::cout << "MultiPack finds bins packed with an id on any page";
+
+    MultiPack::MultiPackOptions options;
+    options.threads = 2;
+    MultiPack atlas(32, 32, options);
+
+    std::vector<Bin> bins;
+    for (int32_t i = 0; i < 8; i++) {
+        bins.emplace_back(i + 1, 16, 16);
+    }
+    std::vector<MultiPack::Placement> first = atlas.pack(bins);
+    assert(atlas.pages() == 2);
+
+    // packed again, and once more in the same call..
+    bins.push_back(Bin(8, 16, 16));
+    std::vector<MultiPack::Placement> again = atlas.pack(bins);
+    assert(atlas.pages() == 2);
+    for (std::size_t i = 0; i < first.size(); i++) {
+        assert(again[i].page == first[i].page && again[i].bin == first[i].bin);
+        assert(again[i].bin->refcount() == (i == 7 ? 3 : 2));
+    }
+    assert(again[8].bin == first[7].bin);
+
+    // repeated ids in one call share a bin too..
+    MultiPack fresh(32, 32, options);
+    std::vector<MultiPack::Placement> placements = fresh.pack(std::vector<Bin>(6, Bin(1, 16, 16)));
+    for (const auto& placement : placements) {
+        assert(placement.page == 0 && placement.bin == placements[0].bin);
+    }
+    assert(placements[0].bin->refcount() == 6);
+
+    std::cout << " - OK" << std::endl;
+}
 
 
 int main() {
@@ -1013,6 +2900,9 @@ int main() {
     testPack4();
     testPack5();
     testPack6();
+    testPack7();
+    testPack8();
+    testPack9();
 
     std::cout << std::endl << "packOne()" << std::endl << std::string(70, '-') << std::endl;
     testPackOne1();
@@ -1027,10 +2917,22 @@ int main() {
     testPackOne10();
     testPackOne11();
     testPackOne12();
+    testPackOne13();
+    testPackOne14();
+    testPackOne15();
+    testPackOne16();
+    testPackOne17();
+    testPackOne18();
+    testPackOne19();
 
     std::cout << std::endl << "getBin()" << std::endl << std::string(70, '-') << std::endl;
     testGetBin1();
     testGetBin2();
+    testGetBin3();
+    testGetBin4();
+    testGetBin5();
+    testGetBin6();
+    testGetBin7();
 
     std::cout << std::endl << "ref()" << std::endl << std::string(70, '-') << std::endl;
     testRef();
@@ -1038,14 +2940,87 @@ int main() {
     std::cout << std::endl << "unref()" << std::endl << std::string(70, '-') << std::endl;
     testUnref1();
     testUnref2();
+    testUnref3();
+    testUnref4();
+    testUnref5();
+    testUnref6();
+    testUnref7();
+
+    std::cout << std::endl << "forEach" << std::endl << std::string(70, '-') << std::endl;
+    testForEach1();
+    testForEach2();
+    testForEach3();
+
+    std::cout << std::endl << "heightHistogram()" << std::endl << std::string(70, '-') << std::endl;
+    testHeightHistogram();
+
+    std::cout << std::endl << "stats()" << std::endl << std::string(70, '-') << std::endl;
+    testStats();
+
+    std::cout << std::endl << "compact()" << std::endl << std::string(70, '-') << std::endl;
+    testCompact1();
+    testCompact2();
+    testCompact3();
+
+    std::cout << std::endl << "serialize()" << std::endl << std::string(70, '-') << std::endl;
+    testSerialize1();
+    testSerialize2();
+
+    std::cout << std::endl << "begin() / rollback()" << std::endl << std::string(70, '-') << std::endl;
+    testTransaction1();
+    testTransaction2();
+    testTransaction3();
+
+    std::cout << std::endl << "takeDirtyRegions()" << std::endl << std::string(70, '-') << std::endl;
+    testDirty1();
+    testDirty2();
+
+    std::cout << std::endl << "memory" << std::endl << std::string(70, '-') << std::endl;
+    testMove();
+    testMemory();
 
     std::cout << std::endl << "clear()" << std::endl << std::string(70, '-') << std::endl;
     testClear();
+    testClear2();
+
+    std::cout << std::endl << "shrink()" << std::endl << std::string(70, '-') << std::endl;
+    testShrink();
+    testShrink2();
+    testShrink3();
 
     std::cout << std::endl << "resize()" << std::endl << std::string(70, '-') << std::endl;
     testResize1();
     testResize2();
     testResize3();
+    testResize4();
+    testResize5();
+
+    std::cout << std::endl << "BasicShelfPack" << std::endl << std::string(70, '-') << std::endl;
+    testBasicShelfPack();
+
+    std::cout << std::endl << "SkylinePack" << std::endl << std::string(70, '-') << std::endl;
+    testSkyline1();
+    testSkyline2();
+    testSkyline3();
+
+    std::cout << std::endl << "MaxRectsPack" << std::endl << std::string(70, '-') << std::endl;
+    testMaxRects1();
+    testMaxRects2();
+    testMaxRects3();
+
+    std::cout << std::endl << "StreamPack" << std::endl << std::string(70, '-') << std::endl;
+    testStream1();
+    testStream2();
+
+    std::cout << std::endl << "ConcurrentShelfPack" << std::endl << std::string(70, '-') << std::endl;
+    testConcurrent1();
+    testConcurrent2();
+    testConcurrent3();
+
+    std::cout << std::endl << "MultiPack" << std::endl << std::string(70, '-') << std::endl;
+    testMultiPack();
+    testMultiPack2();
+    testMultiPack3();
 
     return 0;
 }